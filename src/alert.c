@@ -0,0 +1,203 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/alert.c
+ *
+ * Priority lane for LED state changes. The measurement thread queues every
+ * change and the alert thread uploads it right away with its own curl
+ * handle, so an alert neither waits for the upload slot nor behind a
+ * routine upload in flight. Changes to a worse state are sent first. A
+ * relaying device sends its alerts to the gateway instead
+ */
+
+#include <stdlib.h>
+#include <syslog.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <curl/curl.h>
+
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "alert.h"
+#include "upload.h"
+#include "gateway.h"
+#include "rcu.h"
+#include "realtime.h"
+#include "stats.h"
+#include "trace.h"
+#include "tls.h"
+#include "log.h"
+
+struct alert {
+	int room;
+	int old_state;
+	struct sample sample;
+	// sequence number of the sample in the history
+	uint32_t seq;
+	// CLOCK_MONOTONIC of the state change
+	struct timespec detected;
+};
+
+// unordered, alert_pop() picks by priority
+static struct alert queue[ALERT_QUEUE_LEN];
+static unsigned int queue_len;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+// called by the measurement thread right after the LEDs of room changed.
+// never waits for an upload
+void alert_push(int room, const struct sample *sample, int old_state,
+		uint32_t seq) {
+	struct alert *alert;
+
+	pthread_mutex_lock(&queue_mutex);
+
+	if(queue_len == ALERT_QUEUE_LEN) {
+		// the oldest alert is at the front
+		for(queue_len--, alert = queue; alert < queue + queue_len; alert++)
+			alert[0] = alert[1];
+		atomic_fetch_add_explicit(&alerts_dropped, 1, memory_order_relaxed);
+	}
+
+	alert = &queue[queue_len++];
+	alert->room = room;
+	alert->old_state = old_state;
+	alert->sample = *sample;
+	alert->seq = seq;
+	clock_gettime(CLOCK_MONOTONIC, &alert->detected);
+
+	pthread_cond_signal(&queue_cond);
+	pthread_mutex_unlock(&queue_mutex);
+}
+
+// removes the most urgent alert, the oldest one with the worst new state.
+// called with queue_mutex held and a non-empty queue
+static struct alert alert_pop() {
+	struct alert alert;
+	unsigned int i, best = 0;
+
+	for(i = 1; i < queue_len; i++)
+		if(queue[i].sample.led_state > queue[best].sample.led_state)
+			best = i;
+
+	alert = queue[best];
+	for(i = best + 1; i < queue_len; i++)
+		queue[i - 1] = queue[i];
+	queue_len--;
+
+	return alert;
+}
+
+// puts a failed alert back, unless a newer one of its room is queued
+static void alert_requeue(const struct alert *alert) {
+	unsigned int i;
+
+	for(i = 0; i < queue_len; i++)
+		if(queue[i].room == alert->room)
+			return;
+
+	if(queue_len == ALERT_QUEUE_LEN) {
+		atomic_fetch_add_explicit(&alerts_dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	for(i = queue_len++; i > 0; i--)
+		queue[i] = queue[i - 1];
+	queue[0] = *alert;
+}
+
+// uploads queued state changes, or sends them to the gateway on a relaying
+// device. started by the logging thread once libcurl is initialized
+void *alert_sender() {
+	struct iaq_config *conf;
+	struct timespec now, retry;
+	struct alert alert;
+	CURL *curl;
+	int status;
+	unsigned int waiting;
+	int failed = 0;
+
+	rcu_register_thread();
+	trace_register_thread("alert");
+
+	// a handle of its own, so a routine upload in flight doesn't delay it
+	if((curl = curl_easy_init()) == NULL) {
+		log_msg(LOG_ERR, "failed to curl_easy_init(). terminating");
+		terminate(EXIT_FAILURE);
+	}
+	tls_setup_handle(curl);
+
+	while(1) {
+		rcu_thread_offline();
+
+		pthread_mutex_lock(&queue_mutex);
+
+		// after a failure only a new alert ends the retry delay early
+		if(failed) {
+			clock_gettime(CLOCK_REALTIME, &retry);
+			retry.tv_sec += ALERT_RETRY_DELAY;
+			waiting = queue_len;
+			while(queue_len == waiting && pthread_cond_timedwait(&queue_cond,
+						&queue_mutex, &retry) != ETIMEDOUT);
+		}
+
+		while(queue_len == 0)
+			pthread_cond_wait(&queue_cond, &queue_mutex);
+
+		alert = alert_pop();
+		pthread_mutex_unlock(&queue_mutex);
+
+		rcu_thread_online();
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(now.tv_sec - alert.detected.tv_sec > ALERT_MAX_AGE) {
+			atomic_fetch_add_explicit(&alerts_dropped, 1,
+					memory_order_relaxed);
+			failed = 0;
+			continue;
+		}
+
+		conf = get_config();
+
+		trace(TRACE_ALERT_START, alert.room << 8 | alert.old_state,
+				alert.sample.led_state);
+		// a datagram to the gateway is not confirmed, only a failure to
+		// send it is retried
+		if(conf->relay != NULL)
+			status = relay_alert(alert.room, &alert.sample, alert.seq);
+		else
+			status = http_send(curl, conf, conf->rooms[alert.room].room,
+					alert.sample.co2, alert.sample.temp, alert.sample.rh,
+					alert.sample.led_state, NULL);
+		trace(TRACE_ALERT_END, alert.room, status);
+
+		if(status != 0) {
+			pthread_mutex_lock(&queue_mutex);
+			alert_requeue(&alert);
+			pthread_mutex_unlock(&queue_mutex);
+			failed = 1;
+			continue;
+		}
+
+		failed = 0;
+
+		// from the LED change to the response of the server, or to the
+		// datagram sent to the gateway
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		histogram_record(&alert_latency_hist, elapsed_us(&alert.detected,
+					&now));
+		atomic_fetch_add_explicit(&alerts_sent, 1, memory_order_relaxed);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,36 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/alert.h
+ *
+ * Header file for the priority upload of LED state changes
+ */
+
+#ifndef _IAQ_MEASUREMENTD_ALERT_H_
+#define _IAQ_MEASUREMENTD_ALERT_H_
+
+#include <stdint.h>
+
+#include "history.h"
+
+// state changes waiting for upload, the oldest is dropped when full
+#define ALERT_QUEUE_LEN 32
+// delay before retrying a failed alert upload
+#define ALERT_RETRY_DELAY 10 // in s
+// alerts older than this are not worth sending anymore
+#define ALERT_MAX_AGE 600 // in s
+
+void alert_push(int room, const struct sample *sample, int old_state,
+		uint32_t seq);
+void *alert_sender();
+
+#endif
@@ -0,0 +1,100 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/bench-led-table.c
+ *
+ * Benchmark of led_step() against the CO2 if-chain LEDsystem() used before
+ * the decision tables. Both follow the same random walk of CO2 values
+ * around the default thresholds, so the branches of the if-chain are as
+ * hard to predict as for a room crossing them
+ *
+ * usage: bench-led-table [steps]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "iaq-measurementd.h"
+#include "led.h"
+
+#define DEFAULT_STEPS 100000000UL
+#define WALK_LEN 65536
+
+static int walk[WALK_LEN];
+
+// the if-chain of LEDsystem() before the decision tables, without the LED
+// updates. returns the new LED state
+static int led_chain(int co2, int led_state, int yellow, int red,
+		int hysteresis) {
+	if((led_state == RED && co2 > (red - hysteresis)) ||
+			(led_state == YELLOW && co2 > red) ||
+			(led_state == OFF && co2 > red))
+		return RED;
+
+	else if((led_state == YELLOW && co2 < (yellow - hysteresis)) ||
+			(led_state == GREEN && co2 < yellow) ||
+			(led_state == OFF && co2 < yellow))
+		return GREEN;
+
+	else
+		return YELLOW;
+}
+
+static double elapsed_ns(const struct timespec *start,
+		const struct timespec *end) {
+	return (end->tv_sec - start->tv_sec) * 1e9 +
+		(end->tv_nsec - start->tv_nsec);
+}
+
+int main(int argc, char *argv[]) {
+	struct led_rule rules[4];
+	struct timespec start, end;
+	unsigned long steps = DEFAULT_STEPS, i;
+	int state, co2 = DEFAULT_CO2_THRESHOLD_YELLOW;
+	double chain_ns, table_ns;
+
+	if(argc > 1 && (steps = strtoul(argv[1], NULL, 10)) == 0) {
+		fprintf(stderr, "usage: %s [steps]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// steps of up to 100 ppm between 400 and 2500 ppm
+	srand(1);
+	for(i = 0; i < WALK_LEN; i++) {
+		co2 += rand() % 201 - 100;
+		co2 = co2 < 400 ? 400 : co2 > 2500 ? 2500 : co2;
+		walk[i] = co2;
+	}
+
+	compile_led_rules(rules, DEFAULT_CO2_THRESHOLD_YELLOW,
+			DEFAULT_CO2_THRESHOLD_RED, DEFAULT_CO2_HYSTERESIS);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0, state = OFF; i < steps; i++)
+		state = led_chain(walk[i % WALK_LEN], state,
+				DEFAULT_CO2_THRESHOLD_YELLOW, DEFAULT_CO2_THRESHOLD_RED,
+				DEFAULT_CO2_HYSTERESIS);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	chain_ns = elapsed_ns(&start, &end) / steps;
+	// the final states keep the loops from being optimized away
+	printf("if-chain:       %6.2f ns per step (state %d)\n", chain_ns, state);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0, state = OFF; i < steps; i++)
+		state = led_step(rules, state, walk[i % WALK_LEN]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	table_ns = elapsed_ns(&start, &end) / steps;
+	printf("decision table: %6.2f ns per step (state %d)\n", table_ns, state);
+
+	return EXIT_SUCCESS;
+}
@@ -16,416 +16,631 @@
  */
 
 #include <stdio.h>
-#include <sys/stat.h>
 #include <syslog.h>
 #include <stdlib.h>
 #include <libconfig.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
+#include <float.h>
 
 #include "config-parser.h"
+#include "wire.h"
+#include "publish.h"
 #include "config.h"
 #include "iaq-measurementd.h"
+#include "log.h"
 
-void parse_config() {
-	config_t cfg;
-	config_setting_t *setting;
-	int logging_interval_min;
-	const char *i2c_device_local;
-	const char *room_local;
-	const char *host_local;
-	double double_helper; // libconfig uses double instead of float
-	struct stat st;
-
-	config_init(&cfg);
+_Atomic(struct iaq_config *) current_config;
 
-	if(config_read_file(&cfg, CONFFILE) == CONFIG_FALSE) {
+// looks up an int setting within min..max. *value is kept if the setting is
+// missing or invalid. missing settings are only logged if log_missing is set
+static void lookup_int(const config_setting_t *setting, const char *prefix,
+		const char *name, int *value, int min, int max, int log_missing) {
+	int int_helper;
 
-		if(config_error_type(&cfg) == CONFIG_ERR_FILE_IO) {
-			syslog(LOG_INFO, "config-file " CONFFILE " not found."
-					" terminating");
-
-			terminate(EXIT_FAILURE);
-		}
-
-		else { // parsing error
-			syslog(LOG_INFO, "%s:%d - %s. terminating.",
-					config_error_file(&cfg), config_error_line(&cfg),
-					config_error_text(&cfg));
-
-			config_destroy(&cfg);
-			terminate(EXIT_FAILURE);
-		}
+	if(config_setting_lookup_int(setting, name, &int_helper) == CONFIG_FALSE) {
+		if(log_missing)
+			log_msg(LOG_INFO, "%s%s: either not set or wrong format. using "
+					"default value", prefix, name);
 	}
 
-	else {
-		syslog(LOG_INFO, "reading config-file " CONFFILE);
+	else if(int_helper < min || int_helper > max)
+		log_msg(LOG_INFO, "%s%s: out of range (%d..%d). using default value",
+				prefix, name, min, max);
 
-/* ******************************* ic2_device ******************************* */
-		if(config_lookup_string(&cfg, "i2c_device", &i2c_device_local)
-				== CONFIG_FALSE)
+	else
+		*value = int_helper;
+}
 
-			syslog(LOG_INFO, "i2c_device: either not set or wrong format. using"
-					" default value");
+// same as lookup_int() for floating point settings
+static void lookup_float(const config_setting_t *setting, const char *prefix,
+		const char *name, float *value, float min, int log_missing) {
+	double double_helper; // libconfig uses double instead of float
 
-		else
-			if((i2c_device = strdup(i2c_device_local)) == NULL) {
-				syslog(LOG_ERR, "failed to strdup i2c_device: %m. terminating");
-				terminate(EXIT_FAILURE);
-			}
+	if(config_setting_lookup_float(setting, name, &double_helper)
+			== CONFIG_FALSE) {
+		if(log_missing)
+			log_msg(LOG_INFO, "%s%s: either not set or wrong format. using "
+					"default value", prefix, name);
+	}
 
-/* ************************ logging_interval_min *************************** */
-		if(config_lookup_int(&cfg, "logging_interval", &logging_interval_min)
-				== CONFIG_FALSE)
+	else if(double_helper < min)
+		log_msg(LOG_INFO, "%s%s: cannot be smaller than %.1f. using default "
+				"value", prefix, name, min);
 
-			syslog(LOG_INFO, "logging_interval: either not set or wrong "
-					"format. using default value");
+	else
+		*value = (float) double_helper;
+}
 
-		else if(logging_interval_min < LOGGING_INTERVAL_MIN) {
+// parses the LED pins and thresholds of a room. settings missing in a rooms
+// list entry are inherited from the top level, given in room. pins are
+// checked against pin_max of the LED backend. returns -1 if the thresholds
+// contradict each other, 0 otherwise
+static int parse_room(const config_setting_t *setting, const char *prefix,
+		struct room_config *room, int pin_max, int top_level) {
+
+	lookup_int(setting, prefix, "green_pin", &room->green_pin, WIRING_PI_MIN,
+			pin_max, top_level);
+	lookup_int(setting, prefix, "yellow_pin", &room->yellow_pin,
+			WIRING_PI_MIN, pin_max, top_level);
+	lookup_int(setting, prefix, "red_pin", &room->red_pin, WIRING_PI_MIN,
+			pin_max, top_level);
+
+	lookup_int(setting, prefix, "co2_threshold_yellow",
+			&room->co2_threshold_yellow, 0, INT_MAX, top_level);
+	lookup_int(setting, prefix, "co2_threshold_red", &room->co2_threshold_red,
+			0, INT_MAX, top_level);
+
+	if(room->co2_threshold_yellow > room->co2_threshold_red) {
+		log_msg(LOG_ERR, "%sco2_threshold_yellow: bigger than "
+				"co2_threshold_red", prefix);
+		return -1;
+	}
 
-			syslog(LOG_INFO, "logging_interval: out of range."
-					" using default value");
+	lookup_int(setting, prefix, "co2_hysteresis", &room->co2_hysteresis, 0,
+			INT_MAX, top_level);
+
+	lookup_float(setting, prefix, "temp_threshold_yellow",
+			&room->temp_threshold_yellow, -FLT_MAX, top_level);
+	lookup_float(setting, prefix, "temp_threshold_red",
+			&room->temp_threshold_red, -FLT_MAX, top_level);
+	lookup_float(setting, prefix, "rh_threshold_yellow",
+			&room->rh_threshold_yellow, 0, top_level);
+	lookup_float(setting, prefix, "rh_threshold_red", &room->rh_threshold_red,
+			0, top_level);
+
+	if(room->temp_threshold_yellow > room->temp_threshold_red) {
+		log_msg(LOG_ERR, "%stemp_threshold_yellow: bigger than "
+				"temp_threshold_red", prefix);
+		return -1;
+	}
 
-			logging_interval_sec = DEFAULT_LOGGING_INTERVAL * 60;
-		}
+	if(room->rh_threshold_yellow > room->rh_threshold_red) {
+		log_msg(LOG_ERR, "%srh_threshold_yellow: bigger than "
+				"rh_threshold_red", prefix);
+		return -1;
+	}
 
-		else
-			logging_interval_sec = logging_interval_min * 60;
+	lookup_float(setting, prefix, "temp_hysteresis", &room->temp_hysteresis,
+			0, 0);
+	lookup_float(setting, prefix, "rh_hysteresis", &room->rh_hysteresis, 0,
+			0);
 
-/* ******************************* green_pin ******************************** */
-		if(config_lookup_int(&cfg, "green_pin", &green_pin) == CONFIG_FALSE)
+	lookup_int(setting, prefix, "co2_offset", &room->co2_offset,
+			-CO2_OFFSET_MAX, CO2_OFFSET_MAX, 0);
+	lookup_float(setting, prefix, "temp_offset", &room->temp_offset, -FLT_MAX,
+			0);
+	lookup_float(setting, prefix, "rh_offset", &room->rh_offset, -FLT_MAX, 0);
 
-			syslog(LOG_INFO, "green_pin: either not set or wrong format. "
-					"using default value");
+	return 0;
+}
 
-		else if(green_pin < WIRING_PI_MIN || green_pin > WIRING_PI_MAX) {
+// compiles the thresholds of room into its LED decision table
+static void compile_led_table(struct room_config *room) {
+	// exact for the co2 range of the k-30
+	compile_led_rules(room->led_table[LED_METRIC_CO2],
+			room->co2_threshold_yellow, room->co2_threshold_red,
+			room->co2_hysteresis);
+
+	compile_led_rules(room->led_table[LED_METRIC_TEMP],
+			room->temp_threshold_yellow, room->temp_threshold_red,
+			room->temp_hysteresis);
+	compile_led_rules(room->led_table[LED_METRIC_RH],
+			room->rh_threshold_yellow, room->rh_threshold_red,
+			room->rh_hysteresis);
+}
 
-			syslog(LOG_INFO, "green_pin: out of range. using default value");
+static int compare_channels(const void *a, const void *b) {
+	return ((const struct room_config *)a)->channel -
+		((const struct room_config *)b)->channel;
+}
 
-			green_pin = DEFAULT_GREEN_PIN;
-		}
+// parses and validates CONFFILE into a newly allocated config.
+// returns NULL if the file cannot be used, the caller decides whether that
+// is fatal (startup) or not (reload)
+struct iaq_config *parse_config() {
+	config_t cfg;
+	config_setting_t *rooms_setting, *room_setting;
+	struct iaq_config *conf;
+	struct room_config defaults;
+	char prefix[32];
+	int logging_interval_min;
+	int int_helper;
+	int i, j;
+	const char *i2c_device_local;
+	const char *room_local;
+	const char *host_local;
+	const char *relay_local;
+	const char *led_backend_local;
+	const char *gpio_chip_local;
+	const char *led_combine_local;
+	const char *string_helper;
+	int pin_max;
+	const char *multicast_group_local;
+
+	conf = calloc(1, sizeof(struct iaq_config));
+
+	if(conf == NULL) {
+		log_msg(LOG_ERR, "failed to allocate config: %m");
+		return NULL;
+	}
 
-/* ****************************** yellow_pin ******************************** */
-		if(config_lookup_int(&cfg, "yellow_pin", &yellow_pin) == CONFIG_FALSE)
+	conf->logging_interval_sec = DEFAULT_LOGGING_INTERVAL * 60;
+	conf->co2_deadband = DEFAULT_CO2_DEADBAND;
+	conf->co2_deadband_relative = DEFAULT_CO2_DEADBAND_RELATIVE;
+	conf->temp_deadband = DEFAULT_TEMP_DEADBAND;
+	conf->temp_deadband_relative = DEFAULT_TEMP_DEADBAND_RELATIVE;
+	conf->rh_deadband = DEFAULT_RH_DEADBAND;
+	conf->rh_deadband_relative = DEFAULT_RH_DEADBAND_RELATIVE;
+	conf->heartbeat_interval_sec = DEFAULT_HEARTBEAT_INTERVAL * 60;
+	conf->sample_interval_min = MEASUREMENT_INTERVAL;
+	conf->sample_interval_max = MEASUREMENT_INTERVAL;
+	conf->si7021_period = DEFAULT_SI7021_PERIOD;
+	conf->cycle_deadline_ms = DEFAULT_CYCLE_DEADLINE;
+	conf->realtime = 0;
+	conf->realtime_priority = DEFAULT_REALTIME_PRIORITY;
+	conf->realtime_cpu = DEFAULT_REALTIME_CPU;
+	conf->mux_address = NO_MUX;
+	conf->gateway_port = DEFAULT_GATEWAY_PORT;
+	conf->multicast_port = DEFAULT_MULTICAST_PORT;
+	conf->multicast_ttl = DEFAULT_MULTICAST_TTL;
+
+	memset(&defaults, 0, sizeof(defaults));
+	defaults.channel = NO_MUX;
+	defaults.green_pin = DEFAULT_GREEN_PIN;
+	defaults.yellow_pin = DEFAULT_YELLOW_PIN;
+	defaults.red_pin = DEFAULT_RED_PIN;
+	defaults.co2_threshold_yellow = DEFAULT_CO2_THRESHOLD_YELLOW;
+	defaults.co2_threshold_red = DEFAULT_CO2_THRESHOLD_RED;
+	defaults.co2_hysteresis = DEFAULT_CO2_HYSTERESIS;
+	defaults.temp_hysteresis = DEFAULT_TEMP_HYSTERESIS;
+	defaults.rh_hysteresis = DEFAULT_RH_HYSTERESIS;
+	defaults.temp_threshold_yellow = DEFAULT_TEMP_THRESHOLD_YELLOW;
+	defaults.temp_threshold_red = DEFAULT_TEMP_THRESHOLD_RED;
+	defaults.rh_threshold_yellow = DEFAULT_RH_THRESHOLD_YELLOW;
+	defaults.rh_threshold_red = DEFAULT_RH_THRESHOLD_RED;
 
-			syslog(LOG_INFO, "yellow_pin: either not set or wrong format. "
-					"using default value");
+	config_init(&cfg);
 
-		else if(yellow_pin < WIRING_PI_MIN || yellow_pin > WIRING_PI_MAX) {
+	if(config_read_file(&cfg, CONFFILE) == CONFIG_FALSE) {
 
-			syslog(LOG_INFO, "yellow_pin: out of range (" XSTR(WIRING_PI_MIN)
-					".." XSTR(WIRING_PI_MAX) "). using default value");
+		if(config_error_type(&cfg) == CONFIG_ERR_FILE_IO)
+			log_msg(LOG_INFO, "config-file " CONFFILE " not found");
 
-			yellow_pin = DEFAULT_YELLOW_PIN;
-		}
+		else // parsing error
+			log_msg(LOG_INFO, "%s:%d - %s", config_error_file(&cfg),
+					config_error_line(&cfg), config_error_text(&cfg));
 
-/* ******************************** red_pin ********************************* */
-		if(config_lookup_int(&cfg, "red_pin", &red_pin) == CONFIG_FALSE)
+		goto error;
+	}
 
-			syslog(LOG_INFO, "red_pin: either not set or wrong format. "
-					"using default value");
+	log_msg(LOG_INFO, "reading config-file " CONFFILE);
 
-		else if(red_pin < WIRING_PI_MIN || red_pin > WIRING_PI_MAX) {
+/* ******************************* ic2_device ******************************* */
+	if(config_lookup_string(&cfg, "i2c_device", &i2c_device_local)
+			== CONFIG_FALSE) {
 
-			syslog(LOG_INFO, "red_pin: out of range (" XSTR(WIRING_PI_MIN) ".."
-					XSTR(WIRING_PI_MAX) "). using default value");
+		log_msg(LOG_INFO, "i2c_device: either not set or wrong format. using"
+				" default value");
 
-			red_pin = DEFAULT_RED_PIN;
-		}
+		i2c_device_local = DEFAULT_I2C_DEVICE;
+	}
 
-/* ************************** co2_threshold_yellow ************************** */
-		if(config_lookup_int(&cfg, "co2_threshold_yellow",
-				&co2_threshold_yellow) == CONFIG_FALSE)
+	if((conf->i2c_device = strdup(i2c_device_local)) == NULL) {
+		log_msg(LOG_ERR, "failed to strdup i2c_device: %m");
+		goto error;
+	}
 
-			syslog(LOG_INFO, "co2_threshold_yellow: either not set or wrong "
-					"format. using default value");
+/* ************************ logging_interval_min *************************** */
+	if(config_lookup_int(&cfg, "logging_interval", &logging_interval_min)
+			== CONFIG_FALSE)
 
-		else if(co2_threshold_yellow < 0) {
+		log_msg(LOG_INFO, "logging_interval: either not set or wrong "
+				"format. using default value");
 
-			syslog(LOG_INFO, "co2_threshold_yellow: cannot be negative. using "
-					"default value");
+	else if(logging_interval_min < LOGGING_INTERVAL_MIN)
 
-			co2_threshold_yellow = DEFAULT_CO2_THRESHOLD_YELLOW;
-		}
+		log_msg(LOG_INFO, "logging_interval: out of range."
+				" using default value");
 
-		// PKGSTATEDIR exists? if not, try to create it
-		if(stat(PKGSTATEDIR, &st) == -1) {
-			if(mkdir(PKGSTATEDIR, 0755) == -1) {
-				syslog(LOG_ERR, "failed to create directory " PKGSTATEDIR
-						". %m. terminating");
-				config_destroy(&cfg);
-				terminate(EXIT_FAILURE);
-			}
-		}
+	else
+		conf->logging_interval_sec = logging_interval_min * 60;
 
-		FILE *co2_threshold_file = fopen(PKGSTATEDIR "/co2_threshold_yellow",
-				"w");
+/* ******************************* led_backend ****************************** */
+	if(config_lookup_string(&cfg, "led_backend", &led_backend_local)
+			== CONFIG_FALSE)
+		conf->led_backend = LED_BACKEND_WIRINGPI;
 
-		if(co2_threshold_file == NULL) {
-			syslog(LOG_ERR, "failed to open file " PKGSTATEDIR
-					"/co2_threshold_yellow. %m. terminating");
-			config_destroy(&cfg);
-			terminate(EXIT_FAILURE);
-		}
+	else if(strcmp(led_backend_local, "wiringpi") == 0)
+		conf->led_backend = LED_BACKEND_WIRINGPI;
 
-		else {
-			if(fprintf(co2_threshold_file, "%d\n", co2_threshold_yellow) < 0) {
-				syslog(LOG_ERR, "failed to write to file " PKGSTATEDIR
-						"/co2_threshold_yellow. %m. terminating");
-				fclose(co2_threshold_file);
-				config_destroy(&cfg);
-				exit(EXIT_FAILURE);
-			}
-			fclose(co2_threshold_file);
-		}
+	else if(strcmp(led_backend_local, "gpio-cdev") == 0)
+		conf->led_backend = LED_BACKEND_GPIO_CDEV;
 
-/* ************************** co2_threshold_red ***************************** */
-		if(config_lookup_int(&cfg, "co2_threshold_red", &co2_threshold_red) ==
-				CONFIG_FALSE)
+	else {
+		log_msg(LOG_INFO, "led_backend: must be \"wiringpi\" or "
+				"\"gpio-cdev\". using default value");
+		conf->led_backend = LED_BACKEND_WIRINGPI;
+	}
 
-			syslog(LOG_INFO, "co2_threshold_red: either not set or wrong "
-					"format. using default value");
+	// wiringPi numbering, or line offsets of gpio_chip
+	pin_max = conf->led_backend == LED_BACKEND_WIRINGPI ? WIRING_PI_MAX :
+		GPIO_LINE_MAX;
 
-		else if(co2_threshold_red < 0) {
+/* ******************************** gpio_chip ******************************* */
+	if(config_lookup_string(&cfg, "gpio_chip", &gpio_chip_local)
+			== CONFIG_FALSE)
+		gpio_chip_local = DEFAULT_GPIO_CHIP;
 
-			syslog(LOG_INFO, "co2_threshold_red: cannot be negative. using "
-					"default value");
+	if((conf->gpio_chip = strdup(gpio_chip_local)) == NULL) {
+		log_msg(LOG_ERR, "failed to strdup gpio_chip: %m");
+		goto error;
+	}
 
-			co2_threshold_red = DEFAULT_CO2_THRESHOLD_RED;
+/* ********************* LED pins and thresholds **************************** */
+	// top level values apply to a single room and are the defaults for the
+	// entries of the rooms list
+	if(parse_room(config_root_setting(&cfg), "", &defaults, pin_max, 1) != 0)
+		goto error;
+
+/* ********************************** relay ********************************* */
+	if(config_lookup_string(&cfg, "relay", &relay_local) == CONFIG_TRUE) {
+		if((conf->relay = strdup(relay_local)) == NULL) {
+			log_msg(LOG_ERR, "failed to strdup relay: %m");
+			goto error;
 		}
+	}
 
-		co2_threshold_file = fopen(PKGSTATEDIR "/co2_threshold_red",
-				"w");
-
-		if(co2_threshold_file == NULL) {
-			syslog(LOG_ERR, "failed to open file " PKGSTATEDIR
-					"/co2_threshold_red. %m. terminating");
-			config_destroy(&cfg);
-			terminate(EXIT_FAILURE);
+/* ********************************** host ********************************** */
+	// readings sent to a gateway are uploaded by the gateway
+	if(config_lookup_string(&cfg, "host", &host_local) == CONFIG_FALSE) {
+		if(conf->relay == NULL) {
+			log_msg(LOG_ERR, "host: not set or wrong format");
+			goto error;
 		}
+	}
 
-		else {
-			if(fprintf(co2_threshold_file, "%d\n", co2_threshold_red) < 0) {
-				syslog(LOG_ERR, "failed to write to file " PKGSTATEDIR
-						"/co2_threshold_red. %m. terminating");
-				fclose(co2_threshold_file);
-				config_destroy(&cfg);
-				exit(EXIT_FAILURE);
-			}
-			fclose(co2_threshold_file);
-		}
+	else if((conf->host = strdup(host_local)) == NULL) {
+		log_msg(LOG_ERR, "failed to strdup host: %m");
+		goto error;
+	}
 
-/* ****************************** co2_hysteresis **************************** */
-		if(config_lookup_int(&cfg, "co2_hysteresis", &co2_hysteresis) ==
-				CONFIG_FALSE)
+/* ********************************** https ********************************* */
+	if(config_lookup_bool(&cfg, "https", &conf->https) == CONFIG_FALSE)
+		conf->https = 0;
 
-			syslog(LOG_INFO, "co2_hysteresis: either not set or wrong format. "
-					"using default value");
+	if(config_lookup_string(&cfg, "ca_file", &string_helper) == CONFIG_TRUE &&
+			(conf->ca_file = strdup(string_helper)) == NULL) {
+		log_msg(LOG_ERR, "failed to strdup ca_file: %m");
+		goto error;
+	}
 
-		else if(co2_hysteresis < 0) {
+	if(config_lookup_string(&cfg, "pinned_public_key", &string_helper)
+			== CONFIG_TRUE && (conf->pinned_public_key =
+				strdup(string_helper)) == NULL) {
+		log_msg(LOG_ERR, "failed to strdup pinned_public_key: %m");
+		goto error;
+	}
 
-			syslog(LOG_INFO, "co2_hysteresis: cannot be negative. using "
-					"default value");
+	if(!conf->https && (conf->ca_file != NULL ||
+				conf->pinned_public_key != NULL))
+		log_msg(LOG_INFO, "ca_file and pinned_public_key: only used with "
+				"https");
 
-		}
+/* ********************************* gateway ******************************** */
+	if(config_lookup_bool(&cfg, "gateway", &conf->gateway) == CONFIG_FALSE)
+		conf->gateway = 0;
 
-		FILE *co2_hysteresis_file = fopen(PKGSTATEDIR "/co2_hysteresis",
-				"w");
+	if(conf->gateway && conf->relay != NULL) {
+		log_msg(LOG_ERR, "gateway: cannot be combined with relay");
+		goto error;
+	}
 
-		if(co2_hysteresis_file == NULL) {
-			syslog(LOG_ERR, "failed to open file " PKGSTATEDIR
-					"/co2_hysteresis. %m. terminating");
-			config_destroy(&cfg);
-			terminate(EXIT_FAILURE);
-		}
+/* ******************************* gateway_port ***************************** */
+	lookup_int(config_root_setting(&cfg), "", "gateway_port",
+			&conf->gateway_port, 1, 65535, conf->gateway || conf->relay);
 
-		else {
-			if(fprintf(co2_hysteresis_file, "%d\n", co2_hysteresis) < 0) {
-				syslog(LOG_ERR, "failed to write to file " PKGSTATEDIR
-						"/co2_hysteresis. %m. terminating");
-				fclose(co2_hysteresis_file);
-				config_destroy(&cfg);
-				exit(EXIT_FAILURE);
-			}
-			fclose(co2_hysteresis_file);
+/* ***************************** multicast_group **************************** */
+	if(config_lookup_string(&cfg, "multicast_group", &multicast_group_local)
+			== CONFIG_TRUE) {
+		if((conf->multicast_group = strdup(multicast_group_local)) == NULL) {
+			log_msg(LOG_ERR, "failed to strdup multicast_group: %m");
+			goto error;
 		}
+	}
 
-/* ************************** temp_threshold_yellow ************************* */
-		if(config_lookup_float(&cfg, "temp_threshold_yellow",
-				&double_helper) == CONFIG_FALSE)
+/* ************************ multicast_port, multicast_ttl ******************* */
+	lookup_int(config_root_setting(&cfg), "", "multicast_port",
+			&conf->multicast_port, 1, 65535, conf->multicast_group != NULL);
+	lookup_int(config_root_setting(&cfg), "", "multicast_ttl",
+			&conf->multicast_ttl, 0, 255, 0);
 
-			syslog(LOG_INFO, "temp_threshold_yellow: either not set or wrong "
-					"format. using default value");
+/* ******************************** realtime ******************************** */
+	if(config_lookup_bool(&cfg, "realtime", &conf->realtime) == CONFIG_FALSE)
+		conf->realtime = 0;
 
-		else
-			temp_threshold_yellow = (float) double_helper;
+/* **************************** realtime_priority *************************** */
+	if(config_lookup_int(&cfg, "realtime_priority", &int_helper)
+			== CONFIG_FALSE) {
 
-		FILE *temp_threshold_file = fopen(PKGSTATEDIR "/temp_threshold_yellow",
-				"w");
+		if(conf->realtime)
+			log_msg(LOG_INFO, "realtime_priority: either not set or wrong "
+					"format. using default value");
+	}
 
-		if(temp_threshold_file == NULL) {
-			syslog(LOG_ERR, "failed to open file " PKGSTATEDIR
-					"/temp_threshold_yellow. %m. terminating");
-			config_destroy(&cfg);
-			terminate(EXIT_FAILURE);
-		}
+	else if(int_helper < REALTIME_PRIORITY_MIN ||
+			int_helper > REALTIME_PRIORITY_MAX)
 
-		else {
-			if(fprintf(temp_threshold_file, "%f\n", temp_threshold_yellow)
-					< 0) {
-				syslog(LOG_ERR, "failed to write to file " PKGSTATEDIR
-						"/temp_threshold_yellow. %m. terminating");
-				fclose(temp_threshold_file);
-				config_destroy(&cfg);
-				exit(EXIT_FAILURE);
-			}
-			fclose(temp_threshold_file);
-		}
+		log_msg(LOG_INFO, "realtime_priority: out of range ("
+				XSTR(REALTIME_PRIORITY_MIN) ".." XSTR(REALTIME_PRIORITY_MAX)
+				"). using default value");
 
+	else
+		conf->realtime_priority = int_helper;
 
-/* *************************** temp_threshold_red *************************** */
-		if(config_lookup_float(&cfg, "temp_threshold_red",
-				&double_helper) == CONFIG_FALSE)
+/* **************************** si7021_resolution *************************** */
+	if(config_lookup_string(&cfg, "si7021_resolution", &string_helper)
+			== CONFIG_FALSE || strcmp(string_helper, "precision") == 0)
+		conf->si7021_resolution = SI7021_RESOLUTION_PRECISION;
 
-			syslog(LOG_INFO, "temp_threshold_red: either not set or wrong "
-					"format. using default value");
+	else if(strcmp(string_helper, "balanced") == 0)
+		conf->si7021_resolution = SI7021_RESOLUTION_BALANCED;
 
-		else if(double_helper < 0) {
+	else if(strcmp(string_helper, "latency") == 0)
+		conf->si7021_resolution = SI7021_RESOLUTION_LATENCY;
 
-			syslog(LOG_INFO, "temp_threshold_red: cannot be negative. using "
-					"default value");
+	else {
+		log_msg(LOG_INFO, "si7021_resolution: must be \"precision\", "
+				"\"balanced\" or \"latency\". using default value");
+		conf->si7021_resolution = SI7021_RESOLUTION_PRECISION;
+	}
 
-			temp_threshold_red = DEFAULT_TEMP_THRESHOLD_RED;
-		}
+/* ****************************** si7021_heater ***************************** */
+	if(config_lookup_string(&cfg, "si7021_heater", &string_helper)
+			== CONFIG_FALSE || strcmp(string_helper, "off") == 0)
+		conf->si7021_heater = SI7021_HEATER_OFF;
 
-		else
-			temp_threshold_red = (float) double_helper;
+	else if(strcmp(string_helper, "on") == 0)
+		conf->si7021_heater = SI7021_HEATER_ON;
 
-		temp_threshold_file = fopen(PKGSTATEDIR "/temp_threshold_red",
-				"w");
+	else if(strcmp(string_helper, "auto") == 0)
+		conf->si7021_heater = SI7021_HEATER_AUTO;
 
-		if(temp_threshold_file == NULL) {
-			syslog(LOG_ERR, "failed to open file " PKGSTATEDIR
-					"/temp_threshold_red. %m. terminating");
-			config_destroy(&cfg);
-			terminate(EXIT_FAILURE);
-		}
+	else {
+		log_msg(LOG_INFO, "si7021_heater: must be \"off\", \"on\" or "
+				"\"auto\". using default value");
+		conf->si7021_heater = SI7021_HEATER_OFF;
+	}
 
-		else {
-			if(fprintf(temp_threshold_file, "%f\n", temp_threshold_red) < 0) {
-				syslog(LOG_ERR, "failed to write to file " PKGSTATEDIR
-						"/temp_threshold_red. %m. terminating");
-				fclose(temp_threshold_file);
-				config_destroy(&cfg);
-				exit(EXIT_FAILURE);
-			}
-			fclose(temp_threshold_file);
-		}
+/* ******************************* led_combine ****************************** */
+	if(config_lookup_string(&cfg, "led_combine", &led_combine_local)
+			== CONFIG_FALSE || strcmp(led_combine_local, "co2") == 0)
+		conf->led_combine = LED_COMBINE_CO2;
 
-/* *************************** rh_threshold_yellow ************************** */
-		if(config_lookup_float(&cfg, "rh_threshold_yellow",
-				&double_helper) == CONFIG_FALSE)
+	else if(strcmp(led_combine_local, "worst") == 0)
+		conf->led_combine = LED_COMBINE_WORST;
 
-			syslog(LOG_INFO, "rh_threshold_yellow: either not set or wrong "
-					"format. using default value");
+	else {
+		log_msg(LOG_INFO, "led_combine: must be \"co2\" or \"worst\". using "
+				"default value");
+		conf->led_combine = LED_COMBINE_CO2;
+	}
 
-		else if(double_helper < 0) {
+/* ****************************** realtime_cpu ****************************** */
+	if(config_lookup_int(&cfg, "realtime_cpu", &int_helper) == CONFIG_TRUE) {
+		if(int_helper < -1)
+			log_msg(LOG_INFO, "realtime_cpu: out of range. using default "
+					"value");
+		else
+			conf->realtime_cpu = int_helper;
+	}
 
-			syslog(LOG_INFO, "rh_threshold_yellow: cannot be negative. using "
-					"default value");
+/* *************************** report_by_exception ************************** */
+	if(config_lookup_bool(&cfg, "report_by_exception",
+				&conf->report_by_exception) == CONFIG_FALSE)
+		conf->report_by_exception = 0;
+
+	lookup_float(config_root_setting(&cfg), "", "co2_deadband",
+			&conf->co2_deadband, 0, 0);
+	lookup_float(config_root_setting(&cfg), "", "co2_deadband_relative",
+			&conf->co2_deadband_relative, 0, 0);
+	lookup_float(config_root_setting(&cfg), "", "temp_deadband",
+			&conf->temp_deadband, 0, 0);
+	lookup_float(config_root_setting(&cfg), "", "temp_deadband_relative",
+			&conf->temp_deadband_relative, 0, 0);
+	lookup_float(config_root_setting(&cfg), "", "rh_deadband",
+			&conf->rh_deadband, 0, 0);
+	lookup_float(config_root_setting(&cfg), "", "rh_deadband_relative",
+			&conf->rh_deadband_relative, 0, 0);
+
+	int_helper = DEFAULT_HEARTBEAT_INTERVAL;
+	lookup_int(config_root_setting(&cfg), "", "heartbeat_interval",
+			&int_helper, LOGGING_INTERVAL_MIN, 24 * 60, 0);
+	conf->heartbeat_interval_sec = int_helper * 60;
+
+/* ***************************** sample_interval **************************** */
+	lookup_int(config_root_setting(&cfg), "", "sample_interval_min",
+			&conf->sample_interval_min, SAMPLE_INTERVAL_MIN,
+			SAMPLE_INTERVAL_MAX, 0);
+	lookup_int(config_root_setting(&cfg), "", "sample_interval_max",
+			&conf->sample_interval_max, SAMPLE_INTERVAL_MIN,
+			SAMPLE_INTERVAL_MAX, 0);
+
+	if(conf->sample_interval_min > conf->sample_interval_max) {
+		log_msg(LOG_INFO, "sample_interval_min: greater than "
+				"sample_interval_max. using a fixed interval of %d s",
+				conf->sample_interval_max);
+		conf->sample_interval_min = conf->sample_interval_max;
+	}
 
-			rh_threshold_yellow = DEFAULT_RH_THRESHOLD_YELLOW;
+/* ******************************** schedule ******************************** */
+	lookup_int(config_root_setting(&cfg), "", "si7021_period",
+			&conf->si7021_period, SAMPLE_INTERVAL_MIN, SAMPLE_INTERVAL_MAX, 0);
+	lookup_int(config_root_setting(&cfg), "", "co2_phase", &conf->co2_phase,
+			0, SAMPLE_INTERVAL_MAX, 0);
+	lookup_int(config_root_setting(&cfg), "", "si7021_phase",
+			&conf->si7021_phase, 0, SAMPLE_INTERVAL_MAX, 0);
+	lookup_int(config_root_setting(&cfg), "", "cycle_deadline",
+			&conf->cycle_deadline_ms, CYCLE_DEADLINE_MIN, CYCLE_DEADLINE_MAX, 0);
+
+/* ********************************** rooms ********************************* */
+	rooms_setting = config_lookup(&cfg, "rooms");
+
+	// single room without multiplexer
+	if(rooms_setting == NULL) {
+		if(config_lookup_string(&cfg, "room", &room_local) == CONFIG_FALSE) {
+			log_msg(LOG_ERR, "room: either not set or wrong format");
+			goto error;
 		}
 
-		else
-			rh_threshold_yellow = (float) double_helper;
+		conf->nrooms = 1;
+		conf->rooms[0] = defaults;
 
-		FILE *rh_threshold_file = fopen(PKGSTATEDIR "/rh_threshold_yellow",
-				"w");
-
-		if(rh_threshold_file == NULL) {
-			syslog(LOG_ERR, "failed to open file " PKGSTATEDIR
-					"/rh_threshold_yellow. %m. terminating");
-			config_destroy(&cfg);
-			terminate(EXIT_FAILURE);
+		if((conf->rooms[0].room = strdup(room_local)) == NULL) {
+			log_msg(LOG_ERR, "failed to strdup room: %m");
+			goto error;
 		}
+	}
 
-		else {
-			if(fprintf(rh_threshold_file, "%f\n", rh_threshold_yellow) < 0) {
-				syslog(LOG_ERR, "failed to write to file " PKGSTATEDIR
-						"/rh_threshold_yellow. %m. terminating");
-				fclose(rh_threshold_file);
-				config_destroy(&cfg);
-				exit(EXIT_FAILURE);
-			}
-			fclose(rh_threshold_file);
+	else {
+		conf->nrooms = config_setting_length(rooms_setting);
+
+		if(conf->nrooms < 1 || conf->nrooms > MAX_ROOMS) {
+			log_msg(LOG_ERR, "rooms: must be a list of 1.." XSTR(MAX_ROOMS)
+					" rooms");
+			conf->nrooms = 0;
+			goto error;
 		}
 
-/* **************************** rh_threshold_red **************************** */
-		if(config_lookup_float(&cfg, "rh_threshold_red",
-				&double_helper) == CONFIG_FALSE)
+		for(i = 0; i < conf->nrooms; i++) {
+			room_setting = config_setting_get_elem(rooms_setting, i);
+			snprintf(prefix, sizeof(prefix), "rooms[%d].", i);
 
-			syslog(LOG_INFO, "rh_threshold_red: either not set or wrong "
-					"format. using default value");
+			conf->rooms[i] = defaults;
+
+			if(config_setting_lookup_string(room_setting, "room", &room_local)
+					== CONFIG_FALSE) {
+				log_msg(LOG_ERR, "%sroom: either not set or wrong format",
+						prefix);
+				goto error;
+			}
 
-		else if(rh_threshold_red < 0) {
+			if((conf->rooms[i].room = strdup(room_local)) == NULL) {
+				log_msg(LOG_ERR, "failed to strdup room: %m");
+				goto error;
+			}
 
-			syslog(LOG_INFO, "rh_threshold_red: cannot be negative. using "
-					"default value");
+			if(config_setting_lookup_int(room_setting, "channel",
+					&conf->rooms[i].channel) == CONFIG_FALSE ||
+					conf->rooms[i].channel < 0 ||
+					conf->rooms[i].channel >= MUX_CHANNELS) {
+				log_msg(LOG_ERR, "%schannel: not set or out of range (0.."
+						XSTR(MUX_CHANNELS) ")", prefix);
+				goto error;
+			}
 
-			rh_threshold_red = DEFAULT_RH_THRESHOLD_RED;
+			if(parse_room(room_setting, prefix, &conf->rooms[i], pin_max, 0)
+					!= 0)
+				goto error;
 		}
 
-		else
-			rh_threshold_red = (float) double_helper;
+		// measuring in channel order keeps multiplexer switches down
+		qsort(conf->rooms, conf->nrooms, sizeof(struct room_config),
+				compare_channels);
 
-		rh_threshold_file = fopen(PKGSTATEDIR "/rh_threshold_red",
-				"w");
+		for(i = 1; i < conf->nrooms; i++)
+			if(conf->rooms[i].channel == conf->rooms[i - 1].channel) {
+				log_msg(LOG_ERR, "rooms: channel %d used twice",
+						conf->rooms[i].channel);
+				goto error;
+			}
 
-		if(rh_threshold_file == NULL) {
-			syslog(LOG_ERR, "failed to open file " PKGSTATEDIR
-					"/rh_threshold_red. %m. terminating");
-			config_destroy(&cfg);
-			terminate(EXIT_FAILURE);
-		}
+		conf->mux_address = DEFAULT_MUX_ADDRESS;
+		lookup_int(config_root_setting(&cfg), "", "mux_address",
+				&conf->mux_address, MUX_ADDRESS_MIN, MUX_ADDRESS_MAX, 0);
+	}
 
-		else {
-			if(fprintf(rh_threshold_file, "%f\n", rh_threshold_red) < 0) {
-				syslog(LOG_ERR, "failed to write to file " PKGSTATEDIR
-						"/rh_threshold_red. %m. terminating");
-				fclose(rh_threshold_file);
-				config_destroy(&cfg);
-				exit(EXIT_FAILURE);
+	// room names are sent in fixed size datagrams
+	if(conf->relay != NULL || conf->multicast_group != NULL)
+		for(i = 0; i < conf->nrooms; i++)
+			if(strlen(conf->rooms[i].room) >= WIRE_ROOM_LEN) {
+				log_msg(LOG_ERR, "room: %s is longer than "
+						XSTR(WIRE_ROOM_LEN) " - 1 characters, which cannot "
+						"be relayed or published", conf->rooms[i].room);
+				goto error;
 			}
-			fclose(rh_threshold_file);
-		}
 
-/* *********************************** room ********************************* */
-		if(config_lookup_string(&cfg, "room", &room_local) == CONFIG_FALSE) {
+	for(i = 0; i < conf->nrooms; i++)
+		compile_led_table(&conf->rooms[i]);
 
-			syslog(LOG_ERR, "room: either not set or wrong format. terminating"
-					);
-			config_destroy(&cfg);
-			terminate(EXIT_FAILURE);
-		}
-		else
-			if((room = strdup(room_local)) == NULL) {
-				syslog(LOG_ERR, "failed to strdup room: %m. terminating");
-				terminate(EXIT_FAILURE);
+	// LEDs of different rooms must not share pins
+	for(i = 0; i < conf->nrooms * 3; i++)
+		for(j = i + 1; j < conf->nrooms * 3; j++)
+			if(room_pin(conf, i) == room_pin(conf, j)) {
+				log_msg(LOG_ERR, "pin %d used for more than one LED",
+						room_pin(conf, i));
+				goto error;
 			}
-/* ********************************** host ********************************** */
-		if(config_lookup_string(&cfg, "host", &host_local) == CONFIG_FALSE) {
 
-			syslog(LOG_INFO, "host: not set or wrong format. terminating.");
+	config_destroy(&cfg);
+	return conf;
 
-			config_destroy(&cfg);
-			terminate(EXIT_FAILURE);
-		}
-		else
-			if((host = strdup(host_local)) == NULL) {
-				syslog(LOG_ERR, "failed to strdup host: %m. terminating");
-				terminate(EXIT_FAILURE);
-			}
-	}
+error:
 	config_destroy(&cfg);
+	free_config(conf);
+	return NULL;
+}
+
+// i-th LED pin of all rooms, green, yellow and red of each room
+int room_pin(const struct iaq_config *conf, int i) {
+	const struct room_config *room = &conf->rooms[i / 3];
+
+	switch(i % 3) {
+		case 0:
+			return room->green_pin;
+		case 1:
+			return room->yellow_pin;
+		default:
+			return room->red_pin;
+	}
+}
+
+void free_config(struct iaq_config *conf) {
+	int i;
+
+	if(conf == NULL)
+		return;
+
+	for(i = 0; i < conf->nrooms; i++)
+		free(conf->rooms[i].room);
+
+	free(conf->i2c_device);
+	free(conf->host);
+	free(conf->relay);
+	free(conf->ca_file);
+	free(conf->pinned_public_key);
+	free(conf->gpio_chip);
+	free(conf->multicast_group);
+	free(conf);
 }
@@ -17,11 +17,117 @@
 
 #ifndef _IAQ_MEASUREMENTD_CONFIG_PARSER_H_
 #define _IAQ_MEASUREMENTD_CONFIG_PARSER_H_
-#endif
 
 #include <libconfig.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <stdint.h>
 #include "config.h"
+#include "iaq-measurementd.h"
+#include "led.h"
 
 #define CONFFILE SYSCONFDIR "/" PACKAGE_NAME ".cfg"
 
-void parse_config();
+// settings of a room, i.e. one K-30/Si7021 pair and its LEDs
+struct room_config {
+	// room number to be displayed on the website
+	char *room;
+	// channel of the i2c multiplexer, NO_MUX without multiplexer
+	int channel;
+	// wiringPi pins for LEDs
+	int green_pin, yellow_pin, red_pin;
+	// threshold values for yellow and red LED
+	int co2_threshold_yellow, co2_threshold_red; // in ppm
+	int co2_hysteresis; // in ppm
+	// in degree celcius
+	float temp_threshold_yellow, temp_threshold_red;
+	float temp_hysteresis;
+	// in percent
+	float rh_threshold_yellow, rh_threshold_red;
+	float rh_hysteresis;
+	// calibration, added to the readings of the sensors. applied when the
+	// readings are converted, so a change applies to the history as well
+	int co2_offset; // in ppm
+	float temp_offset; // in degree celcius
+	float rh_offset; // in percent
+	// the thresholds compiled by parse_config(), indexed by LED_METRIC_* and
+	// the current LED state
+	struct led_rule led_table[LED_METRICS][4];
+};
+
+// configuration read from CONFFILE. a parsed config is never modified, on
+// SIGHUP a new one is parsed and swapped in as a whole (see rcu.h)
+struct iaq_config {
+	char *i2c_device;
+	// LED_BACKEND_*, the pins of the rooms are wiringPi pins or line
+	// offsets of gpio_chip
+	int led_backend;
+	char *gpio_chip;
+	// time between log entries in seconds
+	time_t logging_interval_sec;
+	// upload a sample only if a metric left its deadband around the last
+	// uploaded value, the LED state changed or heartbeat_interval_sec passed.
+	// the relative deadbands are in percent of the last uploaded value
+	int report_by_exception;
+	float co2_deadband, co2_deadband_relative;
+	float temp_deadband, temp_deadband_relative;
+	float rh_deadband, rh_deadband_relative;
+	time_t heartbeat_interval_sec;
+	// bounds of the adaptive time between co2 measurements in seconds,
+	// equal for a fixed interval
+	int sample_interval_min, sample_interval_max;
+	// time between temperature/humidity measurements in seconds. the
+	// measurements of a sensor are taken phase seconds after every multiple
+	// of its period (see schedule.c)
+	int si7021_period;
+	int co2_phase, si7021_phase;
+	// time budget of a measurement cycle in milliseconds. sensors not
+	// measured within it keep their last value, flagged as stale
+	int cycle_deadline_ms;
+	// hostname or IP-address of the iaq-server. NULL if relay is set
+	char *host;
+	// hostname or IP-address of a gateway the readings are sent to instead
+	// of the iaq-server, NULL to upload them directly
+	char *relay;
+	// upload to the iaq-server over TLS. ca_file and pinned_public_key are
+	// passed to libcurl, NULL for its defaults
+	int https;
+	char *ca_file;
+	char *pinned_public_key;
+	// receive readings of relaying devices and forward them to host
+	int gateway;
+	// UDP port of the gateway
+	int gateway_port;
+	// multicast address every sample is published to, NULL to disable
+	char *multicast_group;
+	int multicast_port;
+	int multicast_ttl;
+	// run the measurement thread with SCHED_FIFO
+	int realtime;
+	int realtime_priority;
+	int realtime_cpu; // -1: any
+	// SI7021_RESOLUTION_* and SI7021_HEATER_*
+	int si7021_resolution;
+	int si7021_heater;
+	// LED_COMBINE_*, metrics deciding the LED state
+	int led_combine;
+	// address of the i2c multiplexer, NO_MUX without multiplexer
+	int mux_address;
+	// sorted by channel
+	int nrooms;
+	struct room_config rooms[MAX_ROOMS];
+};
+
+extern _Atomic(struct iaq_config *) current_config;
+
+// readers must be registered rcu threads and must not keep the pointer
+// across a quiescent state
+static inline struct iaq_config *get_config() {
+	return atomic_load_explicit(&current_config, memory_order_acquire);
+}
+
+struct iaq_config *parse_config();
+void free_config(struct iaq_config *conf);
+int room_pin(const struct iaq_config *conf, int i);
+
+#endif
@@ -0,0 +1,272 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/fake-i2c.c
+ *
+ * LD_PRELOAD shim for make check. Emulates a K-30 and a Si7021 behind a
+ * TCA9548A on every /dev/i2c-* device file and stubs wiringPi, so the daemon
+ * runs its measurement loop without hardware. Every emulated read(), write()
+ * and ioctl() still issues the syscall, on /dev/null, so the syscalls of a
+ * cycle are those on a Raspberry Pi.
+ *
+ * While the file named by FAKE_I2C_MUX_NAK exists, the multiplexer NAKs
+ * every write and a byte is appended to the file for each one
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <linux/i2c-dev.h>
+
+#define FAKE_I2C_PREFIX "/dev/i2c-"
+
+#define K30_ADDRESS 0x68
+#define SI7021_ADDRESS 0x40
+#define MUX_ADDRESS_MIN 0x70
+#define MUX_ADDRESS_MAX 0x77
+
+#define MUX_NAK_ENV "FAKE_I2C_MUX_NAK"
+
+// 650 ppm, 22 degree celcius and 45 % rh
+#define FAKE_CO2 650
+#define FAKE_TEMP_WORD 0x644c
+#define FAKE_RH_WORD 0x6870
+
+// file descriptor of the emulated bus, on /dev/null
+static int bus_fd = -1;
+static int address;
+// last command written to the si7021, and its user register after reset
+static uint8_t si7021_command;
+static uint8_t si7021_user_reg = 0x3a;
+// the k-30 answers a read after a complete request
+static int k30_requested;
+// file switching the multiplexer off, NULL if not set
+static const char *mux_nak_path;
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_close)(int);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static int (*real_ioctl)(int, unsigned long, ...);
+static int (*real_access)(const char *, int);
+
+static void __attribute__((constructor)) fake_i2c_init() {
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_read = dlsym(RTLD_NEXT, "read");
+	real_write = dlsym(RTLD_NEXT, "write");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_access = dlsym(RTLD_NEXT, "access");
+	mux_nak_path = getenv(MUX_NAK_ENV);
+}
+
+// crc-8 of the si7021, polynomial x^8 + x^5 + x^4 + 1
+static uint8_t si7021_crc(const uint8_t *data, int len) {
+	uint8_t crc = 0;
+	int i, j;
+
+	for(i = 0; i < len; i++) {
+		crc ^= data[i];
+		for(j = 0; j < 8; j++)
+			crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+	}
+
+	return crc;
+}
+
+static int bus_open(int flags) {
+	bus_fd = real_open("/dev/null", flags & (O_RDWR | O_CLOEXEC));
+	address = 0;
+	k30_requested = 0;
+
+	return bus_fd;
+}
+
+// returns 1 if the multiplexer NAKs, the NAK is counted in mux_nak_path
+static int mux_nak() {
+	int fd;
+
+	if(mux_nak_path == NULL ||
+			(fd = real_open(mux_nak_path, O_WRONLY | O_APPEND | O_CLOEXEC))
+			< 0)
+		return 0;
+
+	real_write(fd, "n", 1);
+	real_close(fd);
+
+	return 1;
+}
+
+int open(const char *path, int flags, ...) {
+	va_list ap;
+	mode_t mode = 0;
+
+	if(strncmp(path, FAKE_I2C_PREFIX, strlen(FAKE_I2C_PREFIX)) == 0)
+		return bus_open(flags);
+
+	if(flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	return real_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...) {
+	va_list ap;
+	mode_t mode = 0;
+
+	if(flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	return open(path, flags | O_LARGEFILE, mode);
+}
+
+int close(int fd) {
+	if(fd == bus_fd)
+		bus_fd = -1;
+
+	return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long request, ...) {
+	va_list ap;
+	unsigned long arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, unsigned long);
+	va_end(ap);
+
+	if(fd != bus_fd || request != I2C_SLAVE)
+		return real_ioctl(fd, request, arg);
+
+	// fails with ENOTTY on /dev/null, only the syscall counts
+	real_ioctl(fd, request, arg);
+	address = arg;
+
+	return 0;
+}
+
+ssize_t write(int fd, const void *buffer, size_t len) {
+	const uint8_t *data = buffer;
+
+	if(fd != bus_fd)
+		return real_write(fd, buffer, len);
+
+	real_write(fd, buffer, len);
+
+	switch(address) {
+		case K30_ADDRESS:
+			// read 2 bytes of ram at 0x0008, the co2 value
+			k30_requested = len == 4 && data[0] == 0x22 && data[1] == 0x00 &&
+				data[2] == 0x08 && data[3] == 0x2a;
+			return len;
+
+		case SI7021_ADDRESS:
+			si7021_command = data[0];
+			if(len == 2 && data[0] == 0xe6)
+				si7021_user_reg = data[1];
+			return len;
+
+		default:
+			if(address >= MUX_ADDRESS_MIN && address <= MUX_ADDRESS_MAX) {
+				if(!mux_nak())
+					return len;
+
+				// as reported by the i2c-bcm2835 driver
+				errno = EREMOTEIO;
+				return -1;
+			}
+
+			// e.g. the wake-up pulse of the k-30 to address 0
+			errno = EIO;
+			return -1;
+	}
+}
+
+ssize_t read(int fd, void *buffer, size_t len) {
+	uint8_t *data = buffer;
+	uint8_t response[4];
+
+	if(fd != bus_fd)
+		return real_read(fd, buffer, len);
+
+	real_read(fd, buffer, 0);
+
+	if(address == K30_ADDRESS && k30_requested && len == 4) {
+		response[0] = 0x21;
+		response[1] = FAKE_CO2 >> 8;
+		response[2] = FAKE_CO2 & 0xff;
+		response[3] = response[0] + response[1] + response[2];
+		memcpy(data, response, 4);
+		k30_requested = 0;
+		return len;
+	}
+
+	if(address == SI7021_ADDRESS) {
+		if(si7021_command == 0xf5 && len == 3) {
+			data[0] = FAKE_RH_WORD >> 8;
+			data[1] = FAKE_RH_WORD & 0xff;
+			data[2] = si7021_crc(data, 2);
+			return len;
+		}
+
+		if(si7021_command == 0xe0 && len == 2) {
+			data[0] = FAKE_TEMP_WORD >> 8;
+			data[1] = FAKE_TEMP_WORD & 0xff;
+			return len;
+		}
+
+		if(si7021_command == 0xe7 && len == 1) {
+			data[0] = si7021_user_reg;
+			return len;
+		}
+	}
+
+	errno = EIO;
+	return -1;
+}
+
+// the i2c modules are reported as loaded, so none is loaded
+int access(const char *path, int mode) {
+	if(strncmp(path, "/sys/module/", strlen("/sys/module/")) == 0)
+		return 0;
+
+	return real_access(path, mode);
+}
+
+// the daemon refuses to run without root
+uid_t getuid() {
+	return 0;
+}
+
+// wiringPi writes to mapped gpio registers without syscalls
+int wiringPiSetup() {
+	return 0;
+}
+
+void pinMode(int pin, int mode) {
+}
+
+void digitalWrite(int pin, int value) {
+}
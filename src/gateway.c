@@ -0,0 +1,381 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/gateway.c
+ *
+ * Relay mode: devices send their readings as UDP datagrams to a gateway
+ * instead of uploading them. The gateway buffers the readings of all devices
+ * and forwards them in batches over one persistent connection to the
+ * iaq-server, so the server handles one connection instead of one per device
+ * and logging interval. LED state changes are sent by the devices right away
+ * and forwarded ahead of the buffered readings
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <curl/curl.h>
+
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "upload.h"
+#include "gateway.h"
+#include "wire.h"
+#include "rcu.h"
+#include "realtime.h"
+#include "stats.h"
+#include "trace.h"
+#include "tls.h"
+#include "log.h"
+
+// socket of the relaying device, connected to relay_host. shared by the
+// logging and alert threads
+static int relay_fd = -1;
+static char *relay_host;
+static int relay_port;
+static pthread_mutex_t relay_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// connects relay_fd to the gateway of conf. called with relay_mutex held.
+// returns 0 on success, -1 otherwise
+static int relay_connect(struct iaq_config *conf) {
+	// reconnect if the gateway was changed by a config reload
+	if(relay_fd >= 0 && (strcmp(relay_host, conf->relay) != 0 ||
+				relay_port != conf->gateway_port)) {
+		close(relay_fd);
+		relay_fd = -1;
+	}
+
+	if(relay_fd < 0) {
+		free(relay_host);
+		if((relay_host = strdup(conf->relay)) == NULL) {
+			log_msg(LOG_WARNING, "failed to strdup relay: %m");
+			return -1;
+		}
+		relay_port = conf->gateway_port;
+
+		// resolved again on the next send if it fails
+		if((relay_fd = udp_connect(relay_host, relay_port)) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+// sends one datagram to the gateway. called with relay_mutex held. returns
+// 0 if it was sent, -1 otherwise
+static int relay_send(int room, const struct wire_sample *datagram) {
+	trace(TRACE_UPLOAD_START, room, ntohl(datagram->co2));
+
+	if(send(relay_fd, datagram, sizeof(*datagram), 0) != sizeof(*datagram)) {
+		// e.g. ECONNREFUSED reported for an earlier datagram
+		trace(TRACE_UPLOAD_END, room, -errno);
+		log_msg(LOG_WARNING, "could not send measurement data to the "
+				"gateway %s: %m", relay_host);
+		return -1;
+	}
+
+	trace(TRACE_UPLOAD_END, room, 0);
+
+	return 0;
+}
+
+// sends the latest samples of all rooms to the gateway. called by the
+// logging thread instead of http_log(). returns 0 if all datagrams were sent
+// and -1 otherwise, delivery is not confirmed by the gateway
+int relay_log(const struct sample *samples, const uint32_t *seqs,
+		int nrooms) {
+	struct iaq_config *conf = get_config();
+	struct wire_sample datagram;
+	int status = 0;
+	int i;
+
+	pthread_mutex_lock(&relay_mutex);
+
+	if(relay_connect(conf) != 0) {
+		pthread_mutex_unlock(&relay_mutex);
+		return -1;
+	}
+
+	for(i = 0; i < nrooms; i++) {
+		if((samples[i].quality & SAMPLE_EMPTY) == SAMPLE_EMPTY)
+			continue;
+
+		wire_encode(&datagram, conf->rooms[i].room, seqs[i], &samples[i]);
+		if(relay_send(i, &datagram) != 0)
+			status = -1;
+	}
+
+	pthread_mutex_unlock(&relay_mutex);
+
+	return status;
+}
+
+// sends the sample of room right after its LED state changed, marked with
+// WIRE_ALERT. called by the alert thread instead of http_send(). returns 0
+// if the datagram was sent, -1 otherwise
+int relay_alert(int room, const struct sample *sample, uint32_t seq) {
+	struct iaq_config *conf = get_config();
+	struct wire_sample datagram;
+	int status = -1;
+
+	pthread_mutex_lock(&relay_mutex);
+
+	if(relay_connect(conf) == 0) {
+		wire_encode(&datagram, conf->rooms[room].room, seq, sample);
+		datagram.led_state |= WIRE_ALERT;
+		status = relay_send(room, &datagram);
+	}
+
+	pthread_mutex_unlock(&relay_mutex);
+
+	return status;
+}
+
+struct relayed {
+	char room[WIRE_ROOM_LEN];
+	struct sample sample;
+};
+
+// readings received by the gateway. the first batch_alerts are state
+// changes, then the other readings, each oldest first
+static struct relayed batch[GATEWAY_BATCH_LEN];
+static unsigned int batch_len;
+static unsigned int batch_alerts;
+
+static int gateway_socket(int port) {
+	struct sockaddr_in6 addr6;
+	struct sockaddr_in addr;
+	int fd, off = 0;
+
+	// one dual-stack socket receives IPv4 and IPv6 datagrams
+	fd = socket(AF_INET6, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(fd >= 0) {
+		setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+		memset(&addr6, 0, sizeof(addr6));
+		addr6.sin6_family = AF_INET6;
+		addr6.sin6_addr = in6addr_any;
+		addr6.sin6_port = htons(port);
+
+		if(bind(fd, (struct sockaddr *)&addr6, sizeof(addr6)) == 0)
+			return fd;
+
+		close(fd);
+	}
+
+	// kernel without IPv6
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// receives all pending datagrams into the batch, state changes behind the
+// ones received before
+static void gateway_receive(int fd) {
+	struct wire_sample datagrams[GATEWAY_RECV_BATCH];
+	struct iovec iov[GATEWAY_RECV_BATCH];
+	struct mmsghdr msgs[GATEWAY_RECV_BATCH];
+	struct relayed alert;
+	uint32_t seq;
+	int i, n, is_alert;
+
+	memset(msgs, 0, sizeof(msgs));
+	for(i = 0; i < GATEWAY_RECV_BATCH; i++) {
+		iov[i].iov_base = &datagrams[i];
+		iov[i].iov_len = sizeof(datagrams[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	do {
+		n = recvmmsg(fd, msgs, GATEWAY_RECV_BATCH, MSG_DONTWAIT, NULL);
+
+		for(i = 0; i < n; i++) {
+			// MSG_TRUNC marks datagrams bigger than struct wire_sample
+			if(msgs[i].msg_hdr.msg_flags & MSG_TRUNC ||
+					wire_decode(&datagrams[i], msgs[i].msg_len,
+						batch[batch_len].room, &seq,
+						&batch[batch_len].sample, &is_alert) != 0) {
+				atomic_fetch_add_explicit(&gateway_invalid, 1,
+						memory_order_relaxed);
+				continue;
+			}
+
+			atomic_fetch_add_explicit(&gateway_received, 1,
+					memory_order_relaxed);
+
+			if(batch_len == GATEWAY_BATCH_LEN - 1) {
+				atomic_fetch_add_explicit(&gateway_dropped, 1,
+						memory_order_relaxed);
+
+				// keep the slot free for decoding. a state change replaces
+				// the newest other reading
+				if(!is_alert || batch_alerts == batch_len)
+					continue;
+
+				batch[batch_len - 1] = batch[batch_len];
+				batch_len--;
+			}
+
+			if(is_alert) {
+				alert = batch[batch_len];
+				memmove(batch + batch_alerts + 1, batch + batch_alerts,
+						(batch_len - batch_alerts) * sizeof(batch[0]));
+				batch[batch_alerts++] = alert;
+			}
+
+			batch_len++;
+		}
+	} while(n == GATEWAY_RECV_BATCH);
+}
+
+// forwards the batch to the iaq-server. readings that could not be
+// forwarded stay in the batch. returns 0 if the batch is empty afterwards
+static int gateway_forward(CURL *curl) {
+	struct timespec start, end;
+	unsigned int i, forwarded = 0;
+	time_t now = time(NULL);
+	CURLcode res = CURLE_OK;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for(i = 0; i < batch_len; i++) {
+		if(now - batch[i].sample.timestamp > GATEWAY_MAX_AGE) {
+			atomic_fetch_add_explicit(&gateway_dropped, 1,
+					memory_order_relaxed);
+			continue;
+		}
+
+		res = http_send(curl, get_config(), batch[i].room,
+				batch[i].sample.co2, batch[i].sample.temp,
+				batch[i].sample.rh, batch[i].sample.led_state, NULL);
+
+		// the server is not reachable, the rest would fail as well
+		if(res != CURLE_OK)
+			break;
+
+		forwarded++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	histogram_record(&gateway_forward_hist, elapsed_us(&start, &end));
+
+	atomic_fetch_add_explicit(&gateway_forwarded, forwarded,
+			memory_order_relaxed);
+
+	memmove(batch, batch + i, (batch_len - i) * sizeof(batch[0]));
+	batch_len -= i;
+	batch_alerts = batch_alerts > i ? batch_alerts - i : 0;
+
+	trace(TRACE_GATEWAY_FORWARD, forwarded, batch_len);
+
+	return batch_len == 0 ? 0 : -1;
+}
+
+// receives the readings of relaying devices and forwards them. started by
+// the logging thread once libcurl is initialized
+void *gateway() {
+	struct pollfd pfd;
+	struct timespec now, deadline = {0, 0};
+	CURL *curl;
+	int timeout, expired;
+	// the last forward failed, wait for the deadline even if the batch is
+	// full
+	int retrying = 0;
+
+	rcu_register_thread();
+	trace_register_thread("gateway");
+
+	if((pfd.fd = gateway_socket(get_config()->gateway_port)) < 0) {
+		log_msg(LOG_ERR, "failed to open gateway port %d: %m. terminating",
+				get_config()->gateway_port);
+		terminate(EXIT_FAILURE);
+	}
+	pfd.events = POLLIN;
+
+	// kept for all batches, so the connection to the server stays open
+	if((curl = curl_easy_init()) == NULL) {
+		log_msg(LOG_ERR, "failed to curl_easy_init(). terminating");
+		terminate(EXIT_FAILURE);
+	}
+	tls_setup_handle(curl);
+
+	log_msg(LOG_INFO, "gateway: receiving readings on port %d",
+			get_config()->gateway_port);
+
+	while(1) {
+		if(batch_len == 0)
+			timeout = -1;
+		else {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			timeout = (deadline.tv_sec - now.tv_sec) * 1000 +
+				(deadline.tv_nsec - now.tv_nsec) / 1000000;
+			if(timeout < 0)
+				timeout = 0;
+		}
+
+		rcu_thread_offline();
+		if(poll(&pfd, 1, timeout) == -1 && errno != EINTR)
+			log_msg(LOG_WARNING, "gateway: poll() failed: %m");
+		rcu_thread_online();
+
+		if(pfd.revents & POLLIN) {
+			// the interval starts with the first reading of a batch
+			if(batch_len == 0) {
+				clock_gettime(CLOCK_MONOTONIC, &deadline);
+				deadline.tv_sec += GATEWAY_FLUSH_INTERVAL;
+			}
+
+			gateway_receive(pfd.fd);
+		}
+
+		if(batch_len == 0)
+			continue;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		expired = now.tv_sec > deadline.tv_sec ||
+			(now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec);
+
+		// state changes are forwarded right away
+		if(expired || ((batch_len >= GATEWAY_FLUSH_COUNT ||
+						batch_alerts > 0) && !retrying)) {
+			// retry the remaining readings after the next interval
+			retrying = gateway_forward(curl) != 0;
+			if(retrying) {
+				deadline = now;
+				deadline.tv_sec += GATEWAY_FLUSH_INTERVAL;
+			}
+		}
+	}
+}
@@ -0,0 +1,42 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/gateway.h
+ *
+ * Header file for relaying readings through a gateway
+ */
+
+#ifndef _IAQ_MEASUREMENTD_GATEWAY_H_
+#define _IAQ_MEASUREMENTD_GATEWAY_H_
+
+#include <stdint.h>
+
+#include "history.h"
+
+// relayed readings buffered by the gateway until they are forwarded
+#define GATEWAY_BATCH_LEN 256
+// forward as soon as this many readings are buffered
+#define GATEWAY_FLUSH_COUNT 64
+// forward buffered readings at least this often, and retry failed
+// forwards after this delay
+#define GATEWAY_FLUSH_INTERVAL 10 // in s
+// readings that could not be forwarded for this long are dropped
+#define GATEWAY_MAX_AGE 600 // in s
+// datagrams received per recvmmsg()
+#define GATEWAY_RECV_BATCH 16
+
+int relay_log(const struct sample *samples, const uint32_t *seqs,
+		int nrooms);
+int relay_alert(int room, const struct sample *sample, uint32_t seq);
+void *gateway();
+
+#endif
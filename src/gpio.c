@@ -0,0 +1,78 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/gpio.c
+ *
+ * LED backend using the GPIO v2 character device interface of the kernel.
+ * All LED lines are requested once, so the LEDs of a room are switched
+ * together by one ioctl() and never show two states or none in between
+ */
+
+#include <string.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "config.h"
+#include "gpio.h"
+#include "log.h"
+
+// requests the lines at offsets of chip as outputs, initially inactive.
+// returns the file descriptor of the request or -1 on error
+int gpio_request_outputs(const char *chip, const unsigned int *offsets,
+		unsigned int nlines) {
+	struct gpio_v2_line_request request;
+	int chip_fd;
+	unsigned int i;
+
+	if(nlines > GPIO_V2_LINES_MAX) {
+		log_msg(LOG_ERR, "cannot request more than %d GPIO lines",
+				GPIO_V2_LINES_MAX);
+		return -1;
+	}
+
+	if((chip_fd = open(chip, O_RDWR | O_CLOEXEC)) < 0) {
+		log_msg(LOG_ERR, "failed to open GPIO chip %s: %m", chip);
+		return -1;
+	}
+
+	memset(&request, 0, sizeof(request));
+	for(i = 0; i < nlines; i++)
+		request.offsets[i] = offsets[i];
+	strncpy(request.consumer, PACKAGE, GPIO_MAX_NAME_SIZE - 1);
+	request.config.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+	request.num_lines = nlines;
+
+	if(ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &request) == -1) {
+		log_msg(LOG_ERR, "failed to request GPIO lines of %s: %m", chip);
+		close(chip_fd);
+		return -1;
+	}
+
+	// the request stays valid without the chip
+	close(chip_fd);
+
+	return request.fd;
+}
+
+// sets the lines selected by mask to bits, indexed like the offsets of the
+// request. returns 0 on success and -1 on error
+int gpio_set_values(int fd, uint64_t bits, uint64_t mask) {
+	struct gpio_v2_line_values values = {
+		.bits = bits,
+		.mask = mask,
+	};
+
+	return ioctl(fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) == -1 ? -1 : 0;
+}
@@ -0,0 +1,27 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/gpio.h
+ *
+ * Header file for the GPIO character device LED backend
+ */
+
+#ifndef _IAQ_MEASUREMENTD_GPIO_H_
+#define _IAQ_MEASUREMENTD_GPIO_H_
+
+#include <stdint.h>
+
+int gpio_request_outputs(const char *chip, const unsigned int *offsets,
+		unsigned int nlines);
+int gpio_set_values(int fd, uint64_t bits, uint64_t mask);
+
+#endif
@@ -0,0 +1,179 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/health.c
+ *
+ * Health state of every sensor. A sensor failing repeatedly is quarantined:
+ * it is left out of the measurement cycles, so a dead sensor costs neither
+ * its retries nor the measurements of the other sensors, and is probed with
+ * exponential backoff until it responds again. updated by the measurement
+ * thread only, the states are read through health_name() for the state files
+ */
+
+#include <stdatomic.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "measurement.h"
+#include "schedule.h"
+#include "health.h"
+#include "stats.h"
+#include "trace.h"
+#include "log.h"
+
+#define SENSOR_INDEX(SENSOR) ((SENSOR) == SENSOR_K30 ? 0 : 1)
+
+static const char *sensor_names[] = {"co2", "temp/rh"};
+static const char *state_names[] = {"healthy", "degraded", "quarantined"};
+
+static struct sensor_health {
+	// HEALTH_*, atomic for health_name()
+	atomic_int state;
+	// failed measurements in a row
+	int failures;
+	// CLOCK_MONOTONIC of the next probe of a quarantined sensor
+	time_t next_probe;
+	long backoff; // in s
+} health[MAX_ROOMS][2];
+
+static void set_state(int room, int sensor, int state) {
+	struct sensor_health *h = &health[room][SENSOR_INDEX(sensor)];
+
+	if(state == atomic_load(&h->state))
+		return;
+
+	atomic_store(&h->state, state);
+	trace(TRACE_SENSOR_HEALTH, room << 8 | sensor, state);
+
+	if(state == HEALTH_QUARANTINED) {
+		atomic_fetch_add(&health_quarantines, 1);
+		log_msg(LOG_WARNING, "%s sensor of room %s quarantined, probing it "
+				"again in %ld s", sensor_names[SENSOR_INDEX(sensor)],
+				get_config()->rooms[room].room, h->backoff);
+	}
+
+	else if(state == HEALTH_HEALTHY)
+		log_msg(LOG_INFO, "%s sensor of room %s healthy again",
+				sensor_names[SENSOR_INDEX(sensor)],
+				get_config()->rooms[room].room);
+}
+
+// mask of the sensors of room measured in the cycles, the quarantined ones
+// are left out
+int health_usable(int room) {
+	int sensors = 0;
+
+	if(atomic_load(&health[room][0].state) != HEALTH_QUARANTINED)
+		sensors |= SENSOR_K30;
+	if(atomic_load(&health[room][1].state) != HEALTH_QUARANTINED)
+		sensors |= SENSOR_SI7021;
+
+	return sensors;
+}
+
+// records the driver status of a measurement of sensor. running out of the
+// deadline of the cycle doesn't say anything about the sensor
+static void record(int room, int sensor, int status,
+		const struct timespec *now) {
+	struct sensor_health *h = &health[room][SENSOR_INDEX(sensor)];
+
+	if(status == MEASUREMENT_DEADLINE)
+		return;
+
+	if(status == 0) {
+		h->failures = 0;
+		h->backoff = 0;
+		set_state(room, sensor, HEALTH_HEALTHY);
+		return;
+	}
+
+	if(++h->failures < HEALTH_QUARANTINE_FAILURES) {
+		set_state(room, sensor, HEALTH_DEGRADED);
+		return;
+	}
+
+	// a failed probe doubles the time until the next one
+	h->backoff = h->backoff == 0 ? HEALTH_PROBE_MIN : h->backoff * 2;
+	if(h->backoff > HEALTH_PROBE_MAX)
+		h->backoff = HEALTH_PROBE_MAX;
+	h->next_probe = now->tv_sec + h->backoff;
+
+	set_state(room, sensor, HEALTH_QUARANTINED);
+}
+
+// called by the measurement thread for every measurement of a cycle
+void health_update(int room, int sensor, int status) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	record(room, sensor, status, &now);
+}
+
+// probes the quarantined sensors that are due, each with a deadline of its
+// own. a sensor responding is measured in the cycles again, on probation:
+// the next failure quarantines it again with a longer backoff. called by the
+// measurement thread after a cycle, so the probes don't delay the others
+void health_probe(int nrooms) {
+	struct iaq_config *conf = get_config();
+	struct sensor_health *h;
+	struct timespec now, deadline;
+	uint16_t co2, temp, rh;
+	int room, i, sensor, status;
+
+	for(room = 0; room < nrooms; room++)
+		for(i = 0; i < 2; i++) {
+			h = &health[room][i];
+			sensor = i == 0 ? SENSOR_K30 : SENSOR_SI7021;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+
+			if(atomic_load(&h->state) != HEALTH_QUARANTINED ||
+					h->next_probe > now.tv_sec)
+				continue;
+
+			deadline = now;
+			deadline.tv_nsec += HEALTH_PROBE_DEADLINE;
+			if(deadline.tv_nsec >= 1000000000L) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+			measurement_deadline(&deadline);
+			atomic_fetch_add(&health_probes, 1);
+
+			// a failing multiplexer says nothing about the sensor, it is
+			// probed again after the same backoff
+			if(mux_select(conf->mux_address, conf->rooms[room].channel) != 0) {
+				h->next_probe = now.tv_sec + h->backoff;
+				continue;
+			}
+
+			status = sensor == SENSOR_K30 ? CO2(&co2) : si7021(&temp, &rh);
+
+			// a probe cut short by its deadline failed as well
+			if(status == 0) {
+				atomic_fetch_add(&health_recoveries, 1);
+				log_msg(LOG_INFO, "%s sensor of room %s responded to a probe",
+						sensor_names[i], conf->rooms[room].room);
+				h->failures = HEALTH_QUARANTINE_FAILURES - 1;
+				set_state(room, sensor, HEALTH_DEGRADED);
+			}
+
+			else
+				record(room, sensor, 1, &now);
+		}
+}
+
+// name of the health state of sensor, for the state files
+const char *health_name(int room, int sensor) {
+	return state_names[atomic_load(&health[room][SENSOR_INDEX(sensor)].state)];
+}
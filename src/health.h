@@ -0,0 +1,41 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/health.h
+ *
+ * Header file for the health tracking of the sensors
+ */
+
+#ifndef _IAQ_MEASUREMENTD_HEALTH_H_
+#define _IAQ_MEASUREMENTD_HEALTH_H_
+
+// a healthy sensor measured successfully the last time, a degraded one
+// failed fewer than HEALTH_QUARANTINE_FAILURES times in a row. a quarantined
+// sensor is not measured anymore, only probed with exponential backoff
+#define HEALTH_HEALTHY 0
+#define HEALTH_DEGRADED 1
+#define HEALTH_QUARANTINED 2
+
+#define HEALTH_QUARANTINE_FAILURES 3
+// time between probes of a quarantined sensor, doubled after every failed
+// probe
+#define HEALTH_PROBE_MIN 30 // in s
+#define HEALTH_PROBE_MAX 3600 // in s
+// time budget of one probe
+#define HEALTH_PROBE_DEADLINE 200000000L // in ns
+
+int health_usable(int room);
+void health_update(int room, int sensor, int status);
+void health_probe(int nrooms);
+const char *health_name(int room, int sensor);
+
+#endif
@@ -0,0 +1,130 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/histogram.c
+ *
+ * Log-linear bucketed histograms with fixed memory usage
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "histogram.h"
+
+static unsigned int bucket_index(uint32_t value) {
+	unsigned int exponent;
+
+	if(value < HISTOGRAM_SUB_BUCKETS)
+		return value;
+
+	exponent = 31 - __builtin_clz(value);
+
+	return ((exponent - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS) +
+		((value >> (exponent - HISTOGRAM_SUB_BITS)) &
+		(HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+// smallest value that is counted in bucket index
+static uint32_t bucket_lower(unsigned int index) {
+	unsigned int group = index >> HISTOGRAM_SUB_BITS;
+
+	if(group == 0)
+		return index;
+
+	return (uint32_t)(HISTOGRAM_SUB_BUCKETS + (index &
+		(HISTOGRAM_SUB_BUCKETS - 1))) << (group - 1);
+}
+
+// biggest value that is counted in bucket index
+static uint32_t bucket_upper(unsigned int index) {
+	unsigned int group = index >> HISTOGRAM_SUB_BITS;
+
+	if(group == 0)
+		return index;
+
+	return bucket_lower(index) + ((1U << (group - 1)) - 1);
+}
+
+void histogram_record(struct histogram *h, uint32_t value) {
+	uint32_t old;
+
+	atomic_fetch_add_explicit(&h->buckets[bucket_index(value)], 1,
+		memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+
+	old = atomic_load_explicit(&h->min, memory_order_relaxed);
+	while(value < old && !atomic_compare_exchange_weak_explicit(&h->min,
+			&old, value, memory_order_relaxed, memory_order_relaxed))
+		;
+
+	old = atomic_load_explicit(&h->max, memory_order_relaxed);
+	while(value > old && !atomic_compare_exchange_weak_explicit(&h->max,
+			&old, value, memory_order_relaxed, memory_order_relaxed))
+		;
+}
+
+// returns the upper bound of the bucket containing the given percentile
+// (0..100), or 0 if nothing has been recorded yet
+uint32_t histogram_percentile(struct histogram *h, double percentile) {
+	unsigned int i;
+	uint32_t count, target, seen = 0, max;
+
+	count = atomic_load_explicit(&h->count, memory_order_relaxed);
+	if(count == 0)
+		return 0;
+
+	target = (uint32_t)(count * percentile / 100.0 + 0.5);
+	if(target == 0)
+		target = 1;
+
+	max = atomic_load_explicit(&h->max, memory_order_relaxed);
+
+	for(i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+		if(seen >= target)
+			return bucket_upper(i) < max ? bucket_upper(i) : max;
+	}
+
+	return max;
+}
+
+// writes h as one JSON object, buckets as [lower bound, count] pairs
+void histogram_write_json(FILE *file, struct histogram *h) {
+	unsigned int i, bucket_count;
+	uint32_t count, min;
+	int first = 1;
+
+	count = atomic_load_explicit(&h->count, memory_order_relaxed);
+	min = atomic_load_explicit(&h->min, memory_order_relaxed);
+
+	fprintf(file, "{\"name\":\"%s\",\"unit\":\"%s\",\"count\":%u,\"min\":%u,\"max\":%u,"
+		"\"p50\":%u,\"p90\":%u,\"p99\":%u,\"p999\":%u,\"buckets\":[",
+		h->name, h->unit, count, count ? min : 0,
+		atomic_load_explicit(&h->max, memory_order_relaxed),
+		histogram_percentile(h, 50), histogram_percentile(h, 90),
+		histogram_percentile(h, 99), histogram_percentile(h, 99.9));
+
+	for(i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		bucket_count = atomic_load_explicit(&h->buckets[i],
+			memory_order_relaxed);
+
+		if(bucket_count == 0)
+			continue;
+
+		fprintf(file, "%s[%u,%u]", first ? "" : ",", bucket_lower(i),
+			bucket_count);
+		first = 0;
+	}
+
+	fprintf(file, "]}");
+}
@@ -0,0 +1,49 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/histogram.h
+ *
+ * Header file for the latency histograms
+ */
+
+#ifndef _IAQ_MEASUREMENTD_HISTOGRAM_H_
+#define _IAQ_MEASUREMENTD_HISTOGRAM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// every power of two is split into 2^HISTOGRAM_SUB_BITS linear buckets, so
+// the relative error of a recorded value is at most 12.5%
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+// enough buckets for the whole uint32_t range
+#define HISTOGRAM_BUCKETS ((32 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+// fixed size, can be recorded to from any thread without locking
+struct histogram {
+	const char *name;
+	const char *unit;
+	atomic_uint buckets[HISTOGRAM_BUCKETS];
+	atomic_uint count;
+	atomic_uint min;
+	atomic_uint max;
+};
+
+#define HISTOGRAM_INIT(NAME, UNIT) \
+	{ .name = (NAME), .unit = (UNIT), .min = UINT32_MAX }
+
+void histogram_record(struct histogram *h, uint32_t value);
+uint32_t histogram_percentile(struct histogram *h, double percentile);
+void histogram_write_json(FILE *file, struct histogram *h);
+
+#endif
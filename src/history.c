@@ -0,0 +1,251 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/history.c
+ *
+ * Ring buffer of the last HISTORY_LEN measurements
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "history.h"
+#include "units.h"
+#include "log.h"
+
+static pthread_mutex_t history_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// one ring per room, one array per field so the words of a metric can be
+// converted in one batch. sequence number of the next sample, the ring holds
+// the samples next_seq - count .. next_seq - 1
+static struct history {
+	uint32_t timestamp[HISTORY_LEN];
+	uint16_t co2[HISTORY_LEN];
+	uint16_t temp[HISTORY_LEN];
+	uint16_t rh[HISTORY_LEN];
+	uint8_t led_state[HISTORY_LEN];
+	uint8_t quality[HISTORY_LEN];
+	uint32_t next_seq;
+	unsigned int count;
+} histories[MAX_ROOMS];
+
+// the words of a history copied out of the ring in order, and the converted
+// values. only used by the controller thread, which reads the histories
+static struct history_words {
+	uint32_t timestamp[HISTORY_LEN];
+	uint16_t co2[HISTORY_LEN];
+	uint16_t temp[HISTORY_LEN];
+	uint16_t rh[HISTORY_LEN];
+	uint8_t led_state[HISTORY_LEN];
+	uint8_t quality[HISTORY_LEN];
+} words;
+static struct {
+	int32_t co2[HISTORY_LEN];
+	float temp[HISTORY_LEN];
+	float rh[HISTORY_LEN];
+} converted;
+
+void history_add(int room, const struct raw_sample *sample) {
+	struct history *h = &histories[room];
+	unsigned int i;
+
+	pthread_mutex_lock(&history_mutex);
+
+	i = h->next_seq % HISTORY_LEN;
+	h->timestamp[i] = sample->timestamp;
+	h->co2[i] = sample->co2;
+	h->temp[i] = sample->temp;
+	h->rh[i] = sample->rh;
+	h->led_state[i] = sample->led_state;
+	h->quality[i] = sample->quality;
+	h->next_seq++;
+	if(h->count < HISTORY_LEN)
+		h->count++;
+
+	pthread_mutex_unlock(&history_mutex);
+}
+
+// sequence number of the latest sample of room
+uint32_t history_seq(int room) {
+	uint32_t seq;
+
+	pthread_mutex_lock(&history_mutex);
+	seq = histories[room].next_seq - 1;
+	pthread_mutex_unlock(&history_mutex);
+
+	return seq;
+}
+
+// copies count elements of size bytes out of a ring, starting at sequence
+// number first
+static void ring_copy(void *dst, const void *ring, size_t size, uint32_t first,
+		unsigned int count) {
+	unsigned int start = first % HISTORY_LEN;
+	unsigned int n = HISTORY_LEN - start;
+
+	if(n > count)
+		n = count;
+
+	memcpy(dst, (const char *)ring + start * size, n * size);
+	memcpy((char *)dst + n * size, ring, (count - n) * size);
+}
+
+#define RING_COPY(WORDS, H, FIELD, FIRST, COUNT) \
+	ring_copy((WORDS)->FIELD, (H)->FIELD, sizeof((H)->FIELD[0]), FIRST, COUNT)
+
+// copies the last samples of room to words, up to max. returns their
+// number, the sequence number of the next sample is stored in next_seq
+static unsigned int copy_words(int room, unsigned int max,
+		uint32_t *next_seq) {
+	struct history *h = &histories[room];
+	unsigned int count;
+	uint32_t first;
+
+	pthread_mutex_lock(&history_mutex);
+
+	count = h->count < max ? h->count : max;
+	first = h->next_seq - count;
+	RING_COPY(&words, h, timestamp, first, count);
+	RING_COPY(&words, h, co2, first, count);
+	RING_COPY(&words, h, temp, first, count);
+	RING_COPY(&words, h, rh, first, count);
+	RING_COPY(&words, h, led_state, first, count);
+	RING_COPY(&words, h, quality, first, count);
+	*next_seq = h->next_seq;
+
+	pthread_mutex_unlock(&history_mutex);
+
+	return count;
+}
+
+// copies up to max samples of room, oldest first, converted with the current
+// calibration of the room. returns the number of samples copied, the
+// sequence number of the next sample is stored in next_seq. called by the
+// controller thread only
+unsigned int history_copy(int room, struct sample *samples, unsigned int max,
+		uint32_t *next_seq) {
+	struct room_config *room_config = &get_config()->rooms[room];
+	unsigned int i, count;
+
+	count = copy_words(room, max, next_seq);
+
+	convert_co2(words.co2, converted.co2, count, room_config);
+	convert_temp(words.temp, converted.temp, count, room_config);
+	convert_rh(words.rh, converted.rh, count, room_config);
+
+	for(i = 0; i < count; i++) {
+		samples[i].timestamp = words.timestamp[i];
+		samples[i].co2 = converted.co2[i];
+		samples[i].temp = converted.temp[i];
+		samples[i].rh = converted.rh[i];
+		samples[i].led_state = words.led_state[i];
+		// the history keeps no measurement times, quality tells which
+		// metrics are stale or missing
+		samples[i].co2_age = 0;
+		samples[i].temp_rh_age = 0;
+		samples[i].quality = words.quality[i];
+	}
+
+	return count;
+}
+
+// same as history_copy() without the conversion
+unsigned int history_copy_raw(int room, struct raw_sample *samples,
+		unsigned int max, uint32_t *next_seq) {
+	unsigned int i, count;
+
+	count = copy_words(room, max, next_seq);
+
+	for(i = 0; i < count; i++) {
+		samples[i].timestamp = words.timestamp[i];
+		samples[i].co2 = words.co2[i];
+		samples[i].temp = words.temp[i];
+		samples[i].rh = words.rh[i];
+		samples[i].led_state = words.led_state[i];
+		samples[i].quality = words.quality[i];
+	}
+
+	return count;
+}
+
+// replaces the history of room, samples are given oldest first
+void history_restore(int room, const struct raw_sample *samples,
+		unsigned int count, uint32_t next_seq) {
+	struct history *h = &histories[room];
+	unsigned int i, j;
+
+	if(count > HISTORY_LEN) {
+		samples += count - HISTORY_LEN;
+		count = HISTORY_LEN;
+	}
+
+	pthread_mutex_lock(&history_mutex);
+
+	h->next_seq = next_seq;
+	h->count = count;
+	for(i = 0; i < count; i++) {
+		j = (next_seq - count + i) % HISTORY_LEN;
+		h->timestamp[j] = samples[i].timestamp;
+		h->co2[j] = samples[i].co2;
+		h->temp[j] = samples[i].temp;
+		h->rh[j] = samples[i].rh;
+		h->led_state[j] = samples[i].led_state;
+		h->quality[j] = samples[i].quality;
+	}
+
+	pthread_mutex_unlock(&history_mutex);
+}
+
+// writes the histories of all rooms to HISTORYFILE, converted with the
+// current calibration. a temporary file is renamed, so readers never see a
+// partial file. called by the controller thread only
+void history_export() {
+	struct iaq_config *conf = get_config();
+	static struct sample samples[HISTORY_LEN];
+	FILE *file;
+	uint32_t next_seq;
+	unsigned int i, count;
+	int room;
+
+	file = fopen(HISTORYFILE ".tmp", "w");
+
+	if(file == NULL) {
+		log_msg(LOG_WARNING, "failed to open file " HISTORYFILE ".tmp. %m");
+		return;
+	}
+
+	fprintf(file, "room,timestamp,co2,temp,rh,led_state,quality\n");
+
+	for(room = 0; room < conf->nrooms; room++) {
+		count = history_copy(room, samples, HISTORY_LEN, &next_seq);
+
+		for(i = 0; i < count; i++)
+			fprintf(file, "%s,%lld,%d,%.2f,%.2f,%d,%u\n",
+					conf->rooms[room].room, (long long)samples[i].timestamp,
+					samples[i].co2, samples[i].temp, samples[i].rh,
+					samples[i].led_state, samples[i].quality);
+	}
+
+	if(fclose(file) != 0) {
+		log_msg(LOG_WARNING, "failed to write to file " HISTORYFILE ".tmp. %m");
+		remove(HISTORYFILE ".tmp");
+		return;
+	}
+
+	if(rename(HISTORYFILE ".tmp", HISTORYFILE) == -1)
+		log_msg(LOG_WARNING, "failed to rename " HISTORYFILE ".tmp. %m");
+}
@@ -0,0 +1,73 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/history.h
+ *
+ * Header file for the in-memory measurement history
+ */
+
+#ifndef _IAQ_MEASUREMENTD_HISTORY_H_
+#define _IAQ_MEASUREMENTD_HISTORY_H_
+
+#include <stdint.h>
+
+// number of samples kept per room, one hour at the default measurement interval
+#define HISTORY_LEN 360
+
+// written by history_export() on SIGUSR2
+#define HISTORYFILE PKGSTATEDIR "/history.csv"
+
+// quality of the metrics of a sample. a stale metric could not be measured
+// when it was due, within the deadline of the cycle or because of an error,
+// and keeps its last value. a missing one was never measured
+#define SAMPLE_CO2_STALE (1 << 0)
+#define SAMPLE_CO2_MISSING (1 << 1)
+#define SAMPLE_TEMP_RH_STALE (1 << 2)
+#define SAMPLE_TEMP_RH_MISSING (1 << 3)
+// nothing measured yet, e.g. right after startup
+#define SAMPLE_EMPTY (SAMPLE_CO2_MISSING | SAMPLE_TEMP_RH_MISSING)
+
+struct sample {
+	int64_t timestamp; // CLOCK_REALTIME in s
+	int32_t co2;
+	float temp;
+	float rh;
+	int32_t led_state;
+	// time since the metrics were measured, in s
+	uint16_t co2_age;
+	uint16_t temp_rh_age;
+	// SAMPLE_*_STALE and SAMPLE_*_MISSING
+	uint8_t quality;
+};
+
+// a sample as read from the sensors, converted to struct sample with the
+// calibration of the room when it is read (see units.h)
+struct raw_sample {
+	uint32_t timestamp; // CLOCK_REALTIME in s
+	uint16_t co2;
+	uint16_t temp;
+	uint16_t rh;
+	uint8_t led_state;
+	uint8_t quality; // SAMPLE_*_STALE and SAMPLE_*_MISSING
+};
+
+void history_add(int room, const struct raw_sample *sample);
+uint32_t history_seq(int room);
+unsigned int history_copy(int room, struct sample *samples, unsigned int max,
+		uint32_t *next_seq);
+unsigned int history_copy_raw(int room, struct raw_sample *samples,
+		unsigned int max, uint32_t *next_seq);
+void history_restore(int room, const struct raw_sample *samples,
+		unsigned int count, uint32_t next_seq);
+void history_export();
+
+#endif
@@ -0,0 +1,562 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/iaq-loadgen.c
+ *
+ * Load generator for the iaq-server. Simulates a fleet of devices, each
+ * uploading with the code and the persistent connection of the daemon, to
+ * the server at -H or to a bundled stand-in for device_interface.php
+ *
+ * usage: iaq-loadgen [-n devices] [-t duration] [-i interval] [-j jitter]
+ *                    [-p outage probability] [-o outage duration]
+ *                    [-b batch] [-w workers] [-H host] [-s] [-c ca-file] [-u]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <curl/curl.h>
+
+#include "config.h"
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "history.h"
+#include "upload.h"
+#include "phase.h"
+#include "stats.h"
+#include "tls.h"
+#include "log.h"
+
+#define DEFAULT_DEVICES 100
+#define DEFAULT_DURATION 60 // in s
+#define DEFAULT_INTERVAL 10 // in s
+#define DEFAULT_OUTAGE 60 // in s
+#define DEFAULT_WORKERS 4
+
+// requests of the stand-in server must fit into one buffer
+#define STANDIN_BUFFER 2048
+#define STANDIN_PATH "GET /device_interface.php"
+
+struct device {
+	char room[24];
+	uint32_t identity;
+	CURL *curl;
+	// CLOCK_REALTIME of the next wakeup and the end of an outage
+	struct timespec due;
+	struct timespec outage_end;
+	// readings not uploaded yet, at most one history of the daemon
+	unsigned int pending;
+};
+
+// uploads the devices of its heap, ordered by due time
+struct worker {
+	pthread_t thread;
+	struct device **heap;
+	unsigned int len;
+	struct drand48_data rand;
+	unsigned long requests, errors, outages;
+};
+
+static struct {
+	int devices;
+	time_t duration;
+	time_t interval;
+	long jitter_ms;
+	double outage_probability;
+	time_t outage;
+	unsigned int batch;
+	int workers;
+	int unspread;
+} options = {
+	DEFAULT_DEVICES, DEFAULT_DURATION, DEFAULT_INTERVAL, 0, 0, DEFAULT_OUTAGE,
+	1, DEFAULT_WORKERS, 0,
+};
+
+// settings of the simulated daemons, only the upload settings are used
+static struct iaq_config conf;
+static struct timespec start, end;
+
+static struct {
+	int listen_fd, epoll_fd;
+	atomic_int stop;
+	atomic_ulong requests;
+	struct timespec cpu;
+} standin;
+
+struct connection {
+	int fd;
+	size_t len;
+	char buffer[STANDIN_BUFFER];
+};
+
+// the shared upload code terminates the daemon on fatal errors
+void terminate(int status) {
+	log_flush();
+	exit(status);
+}
+
+static int before(const struct timespec *a, const struct timespec *b) {
+	return a->tv_sec < b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void add_ms(struct timespec *t, long ms) {
+	t->tv_sec += ms / 1000;
+	t->tv_nsec += ms % 1000 * 1000000;
+	if(t->tv_nsec >= 1000000000) {
+		t->tv_sec++;
+		t->tv_nsec -= 1000000000;
+	}
+}
+
+static double cpu_seconds(const struct timeval *utime,
+		const struct timeval *stime) {
+	return utime->tv_sec + stime->tv_sec +
+		(utime->tv_usec + stime->tv_usec) / 1e6;
+}
+
+/* ******************************** stand-in ******************************** */
+
+// answers every complete request in the buffer of c. returns -1 if the
+// connection is to be closed
+static int standin_respond(struct connection *c) {
+	static const char ok[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+	static const char not_found[] =
+		"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+	const char *response;
+	char *head_end;
+	size_t used;
+
+	while((head_end = memmem(c->buffer, c->len, "\r\n\r\n", 4)) != NULL) {
+		used = head_end + 4 - c->buffer;
+
+		if(c->len >= sizeof(STANDIN_PATH) - 1 && memcmp(c->buffer,
+					STANDIN_PATH, sizeof(STANDIN_PATH) - 1) == 0) {
+			response = ok;
+			atomic_fetch_add_explicit(&standin.requests, 1,
+					memory_order_relaxed);
+		}
+		else
+			response = not_found;
+
+		// a few bytes always fit into the socket buffer of a client that
+		// waits for the response
+		if(write(c->fd, response, strlen(response)) !=
+				(ssize_t)strlen(response))
+			return -1;
+
+		c->len -= used;
+		memmove(c->buffer, c->buffer + used, c->len);
+	}
+
+	return c->len == sizeof(c->buffer) ? -1 : 0;
+}
+
+static void standin_close(struct connection *c) {
+	close(c->fd);
+	free(c);
+}
+
+// minimal HTTP/1.1 server with persistent connections, counting the
+// requests for device_interface.php
+static void *standin_server() {
+	struct epoll_event events[64], event;
+	struct connection *c;
+	ssize_t n;
+	int i, count, fd;
+
+	while(!atomic_load(&standin.stop)) {
+		count = epoll_wait(standin.epoll_fd, events, 64, 100);
+
+		for(i = 0; i < count; i++) {
+			if(events[i].data.ptr == NULL) {
+				while((fd = accept4(standin.listen_fd, NULL, NULL,
+								SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+					if((c = malloc(sizeof(*c))) == NULL) {
+						close(fd);
+						continue;
+					}
+					c->fd = fd;
+					c->len = 0;
+					event.events = EPOLLIN;
+					event.data.ptr = c;
+					if(epoll_ctl(standin.epoll_fd, EPOLL_CTL_ADD, fd, &event)
+							== -1)
+						standin_close(c);
+				}
+				continue;
+			}
+
+			c = events[i].data.ptr;
+			n = read(c->fd, c->buffer + c->len, sizeof(c->buffer) - c->len);
+
+			if(n == -1 && errno == EAGAIN)
+				continue;
+
+			if(n <= 0) {
+				standin_close(c);
+				continue;
+			}
+
+			c->len += n;
+			if(standin_respond(c) == -1)
+				standin_close(c);
+		}
+	}
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &standin.cpu);
+
+	return NULL;
+}
+
+// listens on an ephemeral port of the loopback interface. returns the port
+static int standin_start(pthread_t *thread) {
+	struct sockaddr_in addr;
+	struct epoll_event event;
+	socklen_t len = sizeof(addr);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	standin.listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK |
+			SOCK_CLOEXEC, 0);
+	standin.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+
+	if(standin.listen_fd < 0 || standin.epoll_fd < 0 ||
+			bind(standin.listen_fd, (struct sockaddr *)&addr, sizeof(addr))
+			== -1 || listen(standin.listen_fd, SOMAXCONN) == -1 ||
+			getsockname(standin.listen_fd, (struct sockaddr *)&addr, &len)
+			== -1 || epoll_ctl(standin.epoll_fd, EPOLL_CTL_ADD,
+				standin.listen_fd, &event) == -1 ||
+			pthread_create(thread, NULL, standin_server, NULL) != 0) {
+		perror("stand-in server");
+		exit(EXIT_FAILURE);
+	}
+
+	return ntohs(addr.sin_port);
+}
+
+/* ********************************* devices ******************************** */
+
+static void heap_down(struct worker *w, unsigned int i) {
+	struct device *tmp;
+	unsigned int child;
+
+	while((child = 2 * i + 1) < w->len) {
+		if(child + 1 < w->len &&
+				before(&w->heap[child + 1]->due, &w->heap[child]->due))
+			child++;
+		if(!before(&w->heap[child]->due, &w->heap[i]->due))
+			break;
+
+		tmp = w->heap[i];
+		w->heap[i] = w->heap[child];
+		w->heap[child] = tmp;
+		i = child;
+	}
+}
+
+static void heap_build(struct worker *w) {
+	unsigned int i;
+
+	for(i = w->len / 2; i-- > 0;)
+		heap_down(w, i);
+}
+
+// the next wakeup after now. spread devices use the upload slots of the
+// daemon, plus a random delay of up to jitter_ms
+static void schedule(struct worker *w, struct device *d) {
+	double r;
+
+	if(options.unspread)
+		d->due.tv_sec += options.interval;
+	else
+		next_upload_slot(d->identity, options.interval, &d->due);
+
+	if(options.jitter_ms > 0) {
+		drand48_r(&w->rand, &r);
+		add_ms(&d->due, r * options.jitter_ms);
+	}
+}
+
+// one logging interval of d: takes a reading and uploads the pending ones
+// unless the device is offline or still collecting a batch
+static void wake(struct worker *w, struct device *d) {
+	struct timespec now;
+	double r;
+	CURLcode res;
+
+	if(d->pending < HISTORY_LEN)
+		d->pending++;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	if(before(&now, &d->outage_end))
+		return;
+
+	drand48_r(&w->rand, &r);
+	if(r < options.outage_probability) {
+		d->outage_end = now;
+		d->outage_end.tv_sec += options.outage;
+		w->outages++;
+		return;
+	}
+
+	if(d->pending < options.batch)
+		return;
+
+	drand48_r(&w->rand, &r);
+
+	while(d->pending > 0) {
+		res = http_send(d->curl, &conf, d->room, 400 + r * 1600, 18 + r * 10,
+				30 + r * 40, GREEN + r * 3, NULL);
+		w->requests++;
+
+		// the server is not reachable, keep the rest for the next interval
+		if(res != CURLE_OK) {
+			w->errors++;
+			break;
+		}
+
+		d->pending--;
+	}
+}
+
+static void *worker_thread(void *arg) {
+	struct worker *w = arg;
+	struct device *d;
+
+	while(w->len > 0 && before(&w->heap[0]->due, &end)) {
+		d = w->heap[0];
+		while(clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &d->due, NULL)
+				== EINTR);
+
+		wake(w, d);
+		schedule(w, d);
+		heap_down(w, 0);
+	}
+
+	return NULL;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage: %s [-n devices] [-t duration] [-i interval] "
+		"[-j jitter]\n"
+		"\t[-p outage probability] [-o outage duration] [-b batch] "
+		"[-w workers]\n"
+		"\t[-H host] [-s] [-c ca-file] [-u]\n\n"
+		"  -n  simulated devices (default " XSTR(DEFAULT_DEVICES) ")\n"
+		"  -t  duration of the run in s (default " XSTR(DEFAULT_DURATION)
+		")\n"
+		"  -i  logging interval of the devices in s (default "
+		XSTR(DEFAULT_INTERVAL) ")\n"
+		"  -j  random delay of every upload of up to the given ms\n"
+		"  -p  probability of a device going offline per interval (0..1)\n"
+		"  -o  duration of an outage in s (default " XSTR(DEFAULT_OUTAGE)
+		")\n"
+		"  -b  readings collected before uploading them back to back\n"
+		"  -w  upload threads (default " XSTR(DEFAULT_WORKERS) ")\n"
+		"  -H  host of the iaq-server, default a bundled stand-in\n"
+		"  -s  upload over https\n"
+		"  -c  CA file for https\n"
+		"  -u  start all devices at once instead of in their upload slots\n",
+		name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+	pthread_t standin_thread;
+	struct worker *workers;
+	struct device *devices;
+	struct rusage usage_start, usage_end;
+	struct rlimit rlimit;
+	unsigned long requests = 0, errors = 0, outages = 0;
+	double elapsed, client_cpu, standin_cpu = 0;
+	char host[32];
+	int i, opt;
+
+	while((opt = getopt(argc, argv, "n:t:i:j:p:o:b:w:H:sc:u")) != -1) {
+		switch(opt) {
+			case 'n': options.devices = atoi(optarg); break;
+			case 't': options.duration = atoi(optarg); break;
+			case 'i': options.interval = atoi(optarg); break;
+			case 'j': options.jitter_ms = atol(optarg); break;
+			case 'p': options.outage_probability = atof(optarg); break;
+			case 'o': options.outage = atoi(optarg); break;
+			case 'b': options.batch = atoi(optarg); break;
+			case 'w': options.workers = atoi(optarg); break;
+			case 'H': conf.host = optarg; break;
+			case 's': conf.https = 1; break;
+			case 'c': conf.ca_file = optarg; break;
+			case 'u': options.unspread = 1; break;
+			default: usage(argv[0]);
+		}
+	}
+
+	if(options.devices < 1 || options.duration < 1 || options.interval < 1 ||
+			options.jitter_ms < 0 || options.outage < 0 || options.batch < 1
+			|| options.batch > HISTORY_LEN || options.workers < 1 ||
+			options.outage_probability < 0 ||
+			options.outage_probability > 1 || (conf.https && !conf.host))
+		usage(argv[0]);
+
+	if(options.workers > options.devices)
+		options.workers = options.devices;
+
+	// warnings of the upload code go to stderr, rate limited like in the
+	// daemon
+	openlog("iaq-loadgen", LOG_PERROR, LOG_USER);
+	log_start();
+
+	// one connection per device, on both ends with the stand-in
+	if(getrlimit(RLIMIT_NOFILE, &rlimit) == 0) {
+		rlimit.rlim_cur = rlimit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlimit);
+		if(rlimit.rlim_cur < (conf.host ? 1 : 2) * options.devices + 64)
+			fprintf(stderr, "warning: %llu file descriptors are not enough "
+				"for a connection per device\n",
+				(unsigned long long)rlimit.rlim_cur);
+	}
+
+	if(conf.host == NULL) {
+		snprintf(host, sizeof(host), "127.0.0.1:%d",
+				standin_start(&standin_thread));
+		conf.host = host;
+	}
+
+	if(curl_global_init(CURL_GLOBAL_ALL)) {
+		fprintf(stderr, "failed to initialize libcurl\n");
+		return EXIT_FAILURE;
+	}
+
+	devices = calloc(options.devices, sizeof(struct device));
+	workers = calloc(options.workers, sizeof(struct worker));
+	for(i = 0; i < options.workers && workers != NULL; i++)
+		if((workers[i].heap = calloc(options.devices / options.workers + 1,
+						sizeof(struct device *))) == NULL)
+			break;
+
+	if(devices == NULL || workers == NULL || i < options.workers) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &start);
+	end = start;
+	end.tv_sec += options.duration;
+
+	for(i = 0; i < options.workers; i++)
+		srand48_r(start.tv_nsec + i, &workers[i].rand);
+
+	// a handle per device without tls_init(), so devices neither share
+	// their connections nor their TLS sessions
+	for(i = 0; i < options.devices; i++) {
+		struct iaq_config device_conf = {.nrooms = 1};
+		struct worker *w = &workers[i % options.workers];
+		struct device *d = &devices[i];
+
+		snprintf(d->room, sizeof(d->room), "loadgen-%d", i);
+		device_conf.rooms[0].room = d->room;
+		d->identity = upload_identity(&device_conf);
+
+		if((d->curl = curl_easy_init()) == NULL) {
+			fprintf(stderr, "failed to curl_easy_init()\n");
+			return EXIT_FAILURE;
+		}
+		tls_setup_handle(d->curl);
+
+		if(options.unspread) {
+			d->due = start;
+			d->due.tv_sec += options.interval;
+		}
+		else
+			next_upload_slot(d->identity, options.interval, &d->due);
+
+		w->heap[w->len++] = d;
+	}
+
+	for(i = 0; i < options.workers; i++)
+		heap_build(&workers[i]);
+
+	getrusage(RUSAGE_SELF, &usage_start);
+
+	for(i = 0; i < options.workers; i++)
+		if(pthread_create(&workers[i].thread, NULL, worker_thread,
+					&workers[i]) != 0) {
+			perror("pthread_create");
+			return EXIT_FAILURE;
+		}
+
+	for(i = 0; i < options.workers; i++) {
+		pthread_join(workers[i].thread, NULL);
+		requests += workers[i].requests;
+		errors += workers[i].errors;
+		outages += workers[i].outages;
+	}
+
+	getrusage(RUSAGE_SELF, &usage_end);
+
+	if(conf.host == host) {
+		atomic_store(&standin.stop, 1);
+		pthread_join(standin_thread, NULL);
+		standin_cpu = standin.cpu.tv_sec + standin.cpu.tv_nsec / 1e9;
+	}
+
+	elapsed = options.duration;
+	client_cpu = cpu_seconds(&usage_end.ru_utime, &usage_end.ru_stime) -
+		cpu_seconds(&usage_start.ru_utime, &usage_start.ru_stime) -
+		standin_cpu;
+
+	printf("devices: %d, workers: %d, interval: %ld s, duration: %ld s\n",
+		options.devices, options.workers, (long)options.interval,
+		(long)options.duration);
+	printf("requests: %lu, errors: %lu, outages: %lu\n", requests, errors,
+		outages);
+	printf("rate: %.1f req/s achieved, %.1f req/s offered\n",
+		requests / elapsed, (double)options.devices / options.interval);
+	printf("latency (us): min %u, p50 %u, p90 %u, p99 %u, p99.9 %u, max %u\n",
+		atomic_load(&http_upload_hist.count) ?
+		atomic_load(&http_upload_hist.min) : 0,
+		histogram_percentile(&http_upload_hist, 50),
+		histogram_percentile(&http_upload_hist, 90),
+		histogram_percentile(&http_upload_hist, 99),
+		histogram_percentile(&http_upload_hist, 99.9),
+		atomic_load(&http_upload_hist.max));
+	printf("connections: %u, tls handshakes: %u, handshake p50 %u us\n",
+		atomic_load(&http_connections), atomic_load(&tls_handshakes),
+		histogram_percentile(&tls_handshake_hist, 50));
+	printf("client cpu: %.3f s, %.1f us per request, %.3f ms/s per device\n",
+		client_cpu, requests ? client_cpu * 1e6 / requests : 0,
+		client_cpu * 1e3 / elapsed / options.devices);
+	if(conf.host == host)
+		printf("stand-in: %lu requests, cpu %.3f s\n",
+			atomic_load(&standin.requests), standin_cpu);
+
+	log_flush();
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -29,60 +29,213 @@
 #include <sys/syscall.h>
 #include <sys/utsname.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <time.h>
 #include <pthread.h>
-#include <wiringPi.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include <curl/curl.h>
 
 #include "config.h"
 #include "config-parser.h"
 #include "measurement.h"
 #include "output.h"
+#include "rcu.h"
+#include "realtime.h"
+#include "sampling.h"
+#include "stats.h"
+#include "tls.h"
+#include "trace.h"
+#include "history.h"
+#include "snapshot.h"
+#include "resources.h"
+#include "units.h"
+#include "schedule.h"
+#include "health.h"
+#include "gateway.h"
+#include "publish.h"
+#include "phase.h"
+#include "report.h"
+#include "alert.h"
 
 #include "iaq-measurementd.h"
+#include "log.h"
 
 pid_t pid, sid;
 struct sigaction sa;
 
-const char *i2c_device = DEFAULT_I2C_DEVICE;
+struct room_state room_states[MAX_ROOMS];
 
-// in seconds for use with struct timespec
-time_t logging_interval_sec = DEFAULT_LOGGING_INTERVAL * 60;
+pthread_mutex_t measurement_mutex;
 
-int green_pin = DEFAULT_GREEN_PIN;
-int yellow_pin = DEFAULT_YELLOW_PIN;
-int red_pin = DEFAULT_RED_PIN;
+// signal handlers only post requests, they are served by the controller
+sem_t control_sem;
+atomic_int reload_requested;
+atomic_int stats_requested;
+atomic_int trace_requested;
+atomic_int terminate_requested;
+
+atomic_uint last_upload_time;
+
+// CLOCK_MONOTONIC at process start, for the startup metrics
+struct timespec process_start;
+
+// measures the sensors of room due, a mask of SENSOR_*, switches its LEDs and
+// adds the results to its history. metrics of the other sensors keep their
+// last value, as do those not measured within the deadline of the cycle and
+// those of quarantined sensors (see health.c). returns the number of
+// measurements skipped because of the deadline. called by the measurement
+// thread only
+static int measure_room(int room, int due) {
+	struct iaq_config *conf = get_config();
+	struct room_config *room_config = &conf->rooms[room];
+	struct room_state *state = &room_states[room];
+	struct sample sample;
+	struct raw_sample raw;
+	struct timespec now;
+	struct timespec co2_time = state->co2_time;
+	struct timespec temp_rh_time = state->temp_rh_time;
+	int measurement_status, co2_status = MEASUREMENT_DEADLINE;
+	int temp_rh_status = MEASUREMENT_DEADLINE;
+	int sensors = due & health_usable(room);
+	uint16_t co2 = state->co2_word;
+	uint16_t temp = state->temp_word;
+	uint16_t rh = state->rh_word;
+	uint8_t quality = state->quality;
+	int metric_states[LED_METRICS];
+	int led_state, old_state, skipped = 0;
+
+	memcpy(metric_states, state->metric_states, sizeof(metric_states));
+
+	// all quarantined or out of time, the sensors are not even selected
+	if(sensors == 0 || deadline_passed())
+		goto measured;
+
+	measurement_status = mux_select(conf->mux_address,
+			conf->rooms[room].channel);
+	if(measurement_status != 0) {
+		log_msg(LOG_WARNING, "sensors of room %s not reachable",
+				conf->rooms[room].room);
+		// both sensors keep their previous values. a failing multiplexer
+		// says nothing about the sensors, their health is kept as well
+		co2_status = temp_rh_status = measurement_status;
+		goto measured;
+	}
 
-int co2_threshold_yellow = DEFAULT_CO2_THRESHOLD_YELLOW;
-int co2_threshold_red = DEFAULT_CO2_THRESHOLD_RED;
+	if(sensors & SENSOR_K30) {
+		co2_status = CO2(&co2);
+		if(co2_status != 0 && co2_status != MEASUREMENT_DEADLINE)
+			log_msg(LOG_WARNING, "error during co2 measurement in room %s",
+					conf->rooms[room].room);
 
-int co2_hysteresis = DEFAULT_CO2_HYSTERESIS;
+		else if(co2_status == 0)
+			clock_gettime(CLOCK_MONOTONIC, &co2_time);
 
-float temp_threshold_yellow = DEFAULT_TEMP_THRESHOLD_YELLOW;
-float temp_threshold_red = DEFAULT_TEMP_THRESHOLD_RED;
+		health_update(room, SENSOR_K30, co2_status);
+	}
 
-float rh_threshold_yellow = DEFAULT_RH_THRESHOLD_YELLOW;
-float rh_threshold_red = DEFAULT_RH_THRESHOLD_RED;
+	if(sensors & SENSOR_SI7021) {
+		temp_rh_status = si7021(&temp, &rh);
+		if(temp_rh_status != 0 && temp_rh_status != MEASUREMENT_DEADLINE)
+			log_msg(LOG_WARNING, "error during temp/rh measurement in room %s",
+					conf->rooms[room].room);
 
-const char *room;
+		else if(temp_rh_status == 0)
+			clock_gettime(CLOCK_MONOTONIC, &temp_rh_time);
 
-const char *host;
+		health_update(room, SENSOR_SI7021, temp_rh_status);
+	}
 
-int co2 = 0;
-float temp = 0;
-float rh = 0;
+measured:
+	// a quarantined sensor was not skipped because of the deadline
+	if(due & SENSOR_K30) {
+		if(co2_status == 0)
+			quality &= ~(SAMPLE_CO2_STALE | SAMPLE_CO2_MISSING);
+		else
+			quality |= SAMPLE_CO2_STALE;
+		skipped += (sensors & SENSOR_K30) &&
+			co2_status == MEASUREMENT_DEADLINE;
+	}
 
-int led_state = 0;
+	if(due & SENSOR_SI7021) {
+		if(temp_rh_status == 0)
+			quality &= ~(SAMPLE_TEMP_RH_STALE | SAMPLE_TEMP_RH_MISSING);
+		else
+			quality |= SAMPLE_TEMP_RH_STALE;
+		skipped += (sensors & SENSOR_SI7021) &&
+			temp_rh_status == MEASUREMENT_DEADLINE;
+	}
 
-pthread_mutex_t measurement_mutex;
-pthread_cond_t measurement_cond;
-uint8_t measurement_lock = 1;
+	// a kept word is converted again, so a reloaded calibration applies
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	sample.timestamp = time(NULL);
+	sample.co2 = co2_ppm(co2, room_config);
+	sample.temp = temp_celsius(temp, room_config);
+	sample.rh = rh_percent(rh, room_config);
+	sample.co2_age = metric_age(&co2_time, &now, UINT16_MAX);
+	sample.temp_rh_age = metric_age(&temp_rh_time, &now, UINT16_MAX);
+	sample.quality = quality;
+
+	led_state = LEDsystem(room, &sample, state->led_state, metric_states);
+	sample.led_state = led_state;
+
+	// a kept value would look like a stable room. the distance is the one
+	// to the next change of the co2 state, which decides the LED state
+	// alone only with LED_COMBINE_CO2
+	if(co2_status == 0)
+		sampling_update(room, sample.co2,
+				conf->led_combine == LED_COMBINE_CO2 ? led_state :
+				metric_states[LED_METRIC_CO2], &now);
+
+	publish_add(room, &sample);
+
+	old_state = state->led_state;
+
+	pthread_mutex_lock(&measurement_mutex);
+	state->co2_word = co2;
+	state->temp_word = temp;
+	state->rh_word = rh;
+	state->co2 = sample.co2;
+	state->temp = sample.temp;
+	state->rh = sample.rh;
+	state->co2_time = co2_time;
+	state->temp_rh_time = temp_rh_time;
+	state->quality = quality;
+	state->led_state = led_state;
+	memcpy(state->metric_states, metric_states, sizeof(metric_states));
+	pthread_mutex_unlock(&measurement_mutex);
+
+	// the history keeps the words, they are converted when it is read
+	raw.timestamp = sample.timestamp;
+	raw.co2 = co2;
+	raw.temp = temp;
+	raw.rh = rh;
+	raw.led_state = led_state;
+	raw.quality = quality;
+	history_add(room, &raw);
+
+	// the first state after startup is no change
+	if(led_state != old_state && old_state != OFF)
+		alert_push(room, &sample, old_state, history_seq(room));
+
+	return skipped;
+}
 
 int main() {
 	uid_t uid;
-	pthread_t logging_thread;
-	struct timespec measurement_interval = {MEASUREMENT_INTERVAL, 0L};
-	int measurement_status;
+	pthread_t logging_thread, control_thread, module_thread;
+	void *module_status;
+	struct iaq_config *conf;
+	struct timespec cycle_start, cycle_end, next_cycle, deadline;
+	pthread_mutexattr_t mutex_attr;
+	int first_cycle = 1;
+	int leds_restored = 0;
+	int reverse = 0;
+	int nrooms;
+	int sensors, skipped;
+	int i, n;
+
+	clock_gettime(CLOCK_MONOTONIC, &process_start);
 
 	// set up logging: include pid, write to system console if log opening fails
 	openlog(PACKAGE, LOG_PID|LOG_CONS, LOG_USER);
@@ -97,92 +250,191 @@ int main() {
 	uid = getuid();
 
 	if(uid != 0) {
-		syslog(LOG_ERR, "please run iaq-measurementd as root and use the "
+		log_msg(LOG_ERR, "please run iaq-measurementd as root and use the "
 				"initscript. terminating");
 		terminate(EXIT_FAILURE);
 	}
 
+	if(sem_init(&control_sem, 0, 0) != 0) {
+		log_msg(LOG_ERR, "failed to init sem_t: %m. terminating");
+		terminate(EXIT_FAILURE);
+	}
+
 	daemonize();
 
-	load_kernel_modules();
+	// after the fork, the writer thread would not survive it
+	log_start();
 
-	parse_config();
+	// the modules are only needed once the i2c device file is opened, so
+	// load them while the config is read and the LEDs are set up
+	if(pthread_create(&module_thread, NULL, module_loader, NULL) != 0) {
+		log_msg(LOG_ERR, "failed to create module loading thread: %m. "
+				"terminating");
+		terminate(EXIT_FAILURE);
+	}
 
-	if(pthread_mutex_init(&measurement_mutex, NULL) != 0) {
-		syslog(LOG_ERR, "failed to init pthread_mutex_t: %m. terminating");
+	if((conf = parse_config()) == NULL) {
+		log_msg(LOG_ERR, "failed to read config-file. terminating");
 		terminate(EXIT_FAILURE);
 	}
 
-	if(pthread_cond_init(&measurement_cond, NULL) != 0) {
-		syslog(LOG_ERR, "failed to init pthread_cond_t: %m. terminating");
+	if(write_threshold_files(conf) != 0) {
+		log_msg(LOG_ERR, "terminating");
 		terminate(EXIT_FAILURE);
 	}
 
+	atomic_store(&current_config, conf);
+
+	rcu_register_thread();
+	trace_register_thread("measurement");
+
+	// the measurement thread may run with SCHED_FIFO, so a logger holding
+	// the mutex must not be preempted by threads of lower priority
+	if(pthread_mutexattr_init(&mutex_attr) != 0 ||
+			pthread_mutexattr_setprotocol(&mutex_attr,
+				PTHREAD_PRIO_INHERIT) != 0 ||
+			pthread_mutex_init(&measurement_mutex, &mutex_attr) != 0) {
+		log_msg(LOG_ERR, "failed to init pthread_mutex_t: %m. terminating");
+		terminate(EXIT_FAILURE);
+	}
+
+	pthread_mutexattr_destroy(&mutex_attr);
+
+	for(i = 0; i < conf->nrooms; i++)
+		room_states[i].quality = SAMPLE_CO2_MISSING | SAMPLE_TEMP_RH_MISSING;
+
+	// warm restart: continue with the state of the previous run
+	restore_snapshot();
+
 	if(pthread_create(&logging_thread, NULL, http_logger, NULL) != 0) {
-		syslog(LOG_ERR, "failed to create logging thread: %m. terminating");
+		log_msg(LOG_ERR, "failed to create logging thread: %m. terminating");
+		terminate(EXIT_FAILURE);
+	}
+
+	if(pthread_create(&control_thread, NULL, controller, NULL) != 0) {
+		log_msg(LOG_ERR, "failed to create control thread: %m. terminating");
 		terminate(EXIT_FAILURE);
 	}
 
 	// setup GPIO-pins
 	inipin();
 
-	// open i2c device file
-	if((i2c_fd = open((char *)i2c_device, O_RDWR)) < 0) {
-		syslog(LOG_ERR, "failed to open i2c device file %s: %m. terminating",
-				i2c_device);
+	// show the state from before the restart until the first measurement
+	for(i = 0; i < conf->nrooms; i++)
+		if(room_states[i].led_state != OFF) {
+			trace(TRACE_LED_STATE, i << 8 | OFF, room_states[i].led_state);
+			set_leds(i, room_states[i].led_state);
+			leds_restored = 1;
+		}
+
+	if(leds_restored)
+		record_startup_time(&startup_first_led_us);
+
+	pthread_join(module_thread, &module_status);
+	if(module_status != NULL) {
+		log_msg(LOG_ERR, "failed to load kernel modules. terminating");
 		terminate(EXIT_FAILURE);
 	}
 
-	// this function is not thread safe so call it here
-	if(curl_global_init(CURL_GLOBAL_ALL)) {
-		syslog(LOG_ERR, "failed to initialize libcurl. terminating");
+	// open i2c device file
+	if((i2c_fd = open(conf->i2c_device, O_RDWR)) < 0) {
+		log_msg(LOG_ERR, "failed to open i2c device file %s: %m. terminating",
+				conf->i2c_device);
 		terminate(EXIT_FAILURE);
 	}
 
+	publish_open(conf);
+
+	// after the other threads have been created, so they don't inherit
+	// the scheduling policy
+	setup_realtime(conf);
+
+	// the rooms cannot be changed by a reload
+	nrooms = conf->nrooms;
+
 	while(1) {
-		pthread_mutex_lock(&measurement_mutex);
-		measurement_lock = 1;
-		pthread_mutex_unlock(&measurement_mutex);
+		clock_gettime(CLOCK_MONOTONIC, &cycle_start);
 
-		measurement_status = CO2((int *)&co2);
-		if(measurement_status != 0) {
-			syslog(LOG_WARNING, "error during co2 measurement");
-			if(measurement_status == 1) {
-				syslog(LOG_ERR, "terminating");
-				terminate(EXIT_FAILURE);
-			}
+		sensors = schedule_due(&cycle_start);
+
+		deadline = cycle_start;
+		deadline.tv_sec += get_config()->cycle_deadline_ms / 1000;
+		deadline.tv_nsec += get_config()->cycle_deadline_ms % 1000 * 1000000L;
+		if(deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		measurement_deadline(&deadline);
+
+		// every other cycle in reverse order, so the multiplexer channel
+		// selected last is measured first in the next cycle
+		for(n = 0, skipped = 0; n < nrooms; n++)
+			skipped += measure_room(reverse ? nrooms - 1 - n : n, sensors);
+		reverse = !reverse;
+
+		if(skipped > 0) {
+			atomic_fetch_add(&deadline_misses, 1);
+			atomic_fetch_add(&deadline_skipped, skipped);
+			log_msg(LOG_WARNING, "measurement cycle ran out of its deadline of "
+					"%d ms, %d measurements skipped",
+					get_config()->cycle_deadline_ms, skipped);
 		}
 
-		measurement_status = si7021((float *)&temp, (float *)&rh);
-		if(measurement_status != 0) {
-			syslog(LOG_WARNING, "error during temp/rh measurement");
-			if(measurement_status == 1) {
-				syslog(LOG_ERR, "terminating");
-				terminate(EXIT_FAILURE);
-			}
+		// one datagram per room, sent together
+		publish_flush();
+
+		clock_gettime(CLOCK_MONOTONIC, &cycle_end);
+
+		histogram_record(&cycle_latency_hist, elapsed_us(&cycle_start,
+					&cycle_end));
+
+		if(first_cycle) {
+			record_startup_time(&startup_first_sample_us);
+			if(atomic_load(&startup_first_led_us) == 0)
+				record_startup_time(&startup_first_led_us);
+
+			log_msg(LOG_INFO, "first LED update after %u ms, first measurement "
+					"after %u ms", atomic_load(&startup_first_led_us) / 1000,
+					atomic_load(&startup_first_sample_us) / 1000);
+			first_cycle = 0;
 		}
 
-		led_state = LEDsystem(co2, temp, rh, led_state);
+		for(i = 0; i < nrooms; i++)
+			write_state_files(i);
 
-		pthread_mutex_lock(&measurement_mutex);
-		measurement_lock = 0;
-		pthread_cond_signal(&measurement_cond);
-		pthread_mutex_unlock(&measurement_mutex);
+		// after the LEDs are switched and the samples published, a probe
+		// delays nothing but the next cycle
+		health_probe(nrooms);
 
-		write_state_files();
+		// the schedule is a grid of fixed points in time, so it doesn't
+		// drift by the time spent measuring
+		schedule_done(sensors, &cycle_start, nrooms);
+		schedule_wakeup(&next_cycle);
 
-		nanosleep(&measurement_interval, NULL);
+		rcu_thread_offline();
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_cycle,
+					NULL) == EINTR);
+		rcu_thread_online();
 	}
 }
 
 void signal_handler(int sig) {
 	switch(sig) {
 		case SIGHUP:
-			parse_config();
+			atomic_store(&reload_requested, 1);
+			sem_post(&control_sem);
+			break;
+		case SIGUSR1:
+			atomic_store(&trace_requested, 1);
+			sem_post(&control_sem);
+			break;
+		case SIGUSR2:
+			atomic_store(&stats_requested, 1);
+			sem_post(&control_sem);
 			break;
 		case SIGTERM:
-			syslog(LOG_INFO, "caught SIGTERM. terminating");
-			terminate(EXIT_SUCCESS);
+			atomic_store(&terminate_requested, 1);
+			sem_post(&control_sem);
 			break;
 	}
 }
@@ -193,7 +445,7 @@ void daemonize() {
 	pid = fork();
 
 	if(pid < 0) {
-		syslog(LOG_ERR, "failed to fork process: %m");
+		log_msg(LOG_ERR, "failed to fork process: %m");
 		terminate(EXIT_FAILURE);
 	}
 
@@ -207,12 +459,12 @@ void daemonize() {
 	sid = setsid();
 
 	if(sid < 0) {
-		syslog(LOG_ERR, "failed to get sid: %m");
+		log_msg(LOG_ERR, "failed to get sid: %m");
 		terminate(EXIT_FAILURE);
 	}
 
 	if(chdir("/") < 0) {
-		syslog(LOG_ERR, "failed to chdir to /: %m");
+		log_msg(LOG_ERR, "failed to chdir to /: %m");
 		terminate(EXIT_FAILURE);
 	}
 
@@ -224,12 +476,12 @@ void daemonize() {
 	pidfile = fopen(PIDFILE, "w");
 
 	if(pidfile == NULL) {
-		syslog(LOG_ERR, "failed to open pidfile " PIDFILE ": %m");
+		log_msg(LOG_ERR, "failed to open pidfile " PIDFILE ": %m");
 		terminate(EXIT_FAILURE);
 	}
 
 	if(fprintf(pidfile, "%d\n", pid) < 0) {
-		syslog(LOG_ERR, "failed to write to pidfile " PIDFILE ": %m");
+		log_msg(LOG_ERR, "failed to write to pidfile " PIDFILE ": %m");
 		terminate(EXIT_FAILURE);
 	}
 
@@ -241,13 +493,23 @@ void daemonize() {
 	sigfillset(&sa.sa_mask);
 
 	if(sigaction(SIGHUP, &sa, NULL) == -1) {
-		syslog(LOG_ERR, "failed to register SIGHUP handler: %m");
+		log_msg(LOG_ERR, "failed to register SIGHUP handler: %m");
 		terminate(EXIT_FAILURE);
 	}
 	if(sigaction(SIGTERM, &sa, NULL) == -1) {
-		syslog(LOG_ERR, "failed to register SIGTERM handler: %m");
+		log_msg(LOG_ERR, "failed to register SIGTERM handler: %m");
+		terminate(EXIT_FAILURE);
+	}
+	if(sigaction(SIGUSR1, &sa, NULL) == -1) {
+		log_msg(LOG_ERR, "failed to register SIGUSR1 handler: %m");
+		terminate(EXIT_FAILURE);
+	}
+	if(sigaction(SIGUSR2, &sa, NULL) == -1) {
+		log_msg(LOG_ERR, "failed to register SIGUSR2 handler: %m");
 		terminate(EXIT_FAILURE);
 	}
+
+	trace_install_crash_handlers();
 }
 
 // glibc does not provide definitions for init_module() and finit_module()
@@ -255,132 +517,368 @@ static inline int finit_module(int fd, const char *uargs, int flags) {
 	return syscall(__NR_finit_module, fd, uargs, flags);
 }
 
-// load i2c kernel modules
-void load_kernel_modules() {
-	const char *mod_path, *i2c_bcm2708_relative, *i2c_dev_relative;
-	char *mod_path_i2c_bcm2708, *mod_path_i2c_dev;
+// i2c kernel modules as named in /sys/module, and their paths relative to
+// /lib/modules/<kernel-release>
+static const struct {
+	const char *name;
+	const char *path;
+} i2c_modules[] = {
+	{"i2c_bcm2708", "/kernel/drivers/i2c/busses/i2c-bcm2708.ko"},
+	{"i2c_dev", "/kernel/drivers/i2c/i2c-dev.ko"},
+};
+
+// load i2c kernel modules, unless they are loaded or built in already.
+// returns 0 on success, -1 on error
+int load_kernel_modules() {
 	struct utsname system_name;
+	char path[PATH_MAX];
 	int mod_fd;
-	int ret_syscall;
+	int i;
+
+	for(i = 0; i < sizeof(i2c_modules) / sizeof(i2c_modules[0]); i++) {
+		snprintf(path, sizeof(path), "/sys/module/%s", i2c_modules[i].name);
+
+		if(access(path, F_OK) == 0)
+			continue;
+
+		// kernel-modules path contains kernel-release
+		// e.g. /lib/modules/4.1.15+/kernel/drivers/i2c/i2c-dev.ko
+		if(uname(&system_name) < 0) {
+			log_msg(LOG_ERR, "failed to get kernel release (uname -r), needed to "
+				"load kernel modules: %m");
+			return -1;
+		}
+
+		snprintf(path, sizeof(path), "/lib/modules/%s%s", system_name.release,
+				i2c_modules[i].path);
+
+		// newer kernels ship other bus drivers, opening the i2c device file
+		// fails later on if the bus is really missing
+		mod_fd = open(path, O_RDONLY | O_CLOEXEC);
+		if(mod_fd < 0) {
+			log_msg(LOG_WARNING, "failed to open kernel-module file %s: %m. "
+				"continuing without it", path);
+			continue;
+		}
+
+		if(finit_module(mod_fd, "", 0) != 0 && errno != EEXIST) {
+			log_msg(LOG_ERR, "failed to load kernel-module %s: %m", path);
+			close(mod_fd);
+			return -1;
+		}
+
+		close(mod_fd);
+	}
 
-	mod_path = "/lib/modules/";
-	i2c_bcm2708_relative = "/kernel/drivers/i2c/busses/i2c-bcm2708.ko";
-	i2c_dev_relative = "/kernel/drivers/i2c/i2c-dev.ko";
+	return 0;
+}
+
+// runs while main parses the config, so it must not terminate the process
+// itself. returns non-NULL if loading failed, for main to terminate
+void *module_loader() {
+	if(load_kernel_modules() != 0)
+		return (void *) -1;
+
+	return NULL;
+}
+
+// microseconds since process start, stored once in metric
+void record_startup_time(atomic_uint *metric) {
+	struct timespec now;
 
-	// kernel-modules path contains kernel-release
-	// e.g. /lib/modules/4.1.15+/kernel/drivers/i2c/i2c-dev.ko
-	if(uname(&system_name) < 0) {
-		syslog(LOG_ERR, "failed to get kernel release (uname -r), needed to "
-			"load kernel modules: %m");
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	atomic_store(metric, elapsed_us(&process_start, &now));
+}
+
+void *http_logger() {
+	pthread_t gateway_thread, alert_thread;
+	struct timespec slot, now;
+	struct sample samples[MAX_ROOMS];
+	uint32_t seqs[MAX_ROOMS];
+	uint32_t identity;
+	int nrooms, uploaded;
+	int i;
+
+	rcu_register_thread();
+	trace_register_thread("logger");
+
+	// this function is not thread safe, but this is the only thread using
+	// libcurl. done here so it doesn't delay the first measurement
+	if(curl_global_init(CURL_GLOBAL_ALL)) {
+		log_msg(LOG_ERR, "failed to initialize libcurl. terminating");
 		terminate(EXIT_FAILURE);
 	}
 
-	mod_path_i2c_bcm2708 = malloc(strlen(mod_path) + strlen(system_name.release)
-		+ strlen(i2c_bcm2708_relative));
+	tls_init();
 
-	strcpy(mod_path_i2c_bcm2708, mod_path);
-	strcat(mod_path_i2c_bcm2708, system_name.release);
-	strcat(mod_path_i2c_bcm2708, i2c_bcm2708_relative);
+	if(get_config()->gateway &&
+			pthread_create(&gateway_thread, NULL, gateway, NULL) != 0) {
+		log_msg(LOG_ERR, "failed to create gateway thread: %m. terminating");
+		terminate(EXIT_FAILURE);
+	}
 
-	mod_fd = open(mod_path_i2c_bcm2708, O_RDONLY | O_CLOEXEC);
-	if(mod_fd < 0) {
-		syslog(LOG_ERR, "failed to open kernel-module file %s: %m. terminating",
-			mod_path_i2c_bcm2708);
+	if(pthread_create(&alert_thread, NULL, alert_sender, NULL) != 0) {
+		log_msg(LOG_ERR, "failed to create alert thread: %m. terminating");
 		terminate(EXIT_FAILURE);
 	}
 
-	ret_syscall = finit_module(mod_fd, "", 0);
+	// the rooms cannot be changed by a reload
+	nrooms = get_config()->nrooms;
 
-	if(ret_syscall != 0) {
-		close(mod_fd);
-		if(errno != EEXIST) {
-			syslog(LOG_ERR, "failed to load kernel-module %s: %m",
-				mod_path_i2c_bcm2708);
-			terminate(EXIT_FAILURE);
+	// uploads happen in a fixed slot of every interval, which also keeps
+	// the interval that was running when a previous instance stopped
+	identity = upload_identity(get_config());
+	next_upload_slot(identity, get_config()->logging_interval_sec, &slot);
+	log_msg(LOG_INFO, "uploading %lld s into every logging interval",
+			(long long)(slot.tv_sec % get_config()->logging_interval_sec));
+
+	while(1) {
+		rcu_thread_offline();
+
+		// the wakeup follows jumps of the clock, e.g. when NTP sets it after
+		// boot. a slot in the past is served right away
+		while(clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &slot, NULL)
+				== EINTR);
+
+		// the values of a room are updated together, so they are consistent
+		// while a cycle is running. the measurements are not waited for, a
+		// cycle is bounded by its deadline only
+		pthread_mutex_lock(&measurement_mutex);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		for(i = 0; i < nrooms; i++) {
+			samples[i].timestamp = time(NULL);
+			samples[i].co2 = room_states[i].co2;
+			samples[i].temp = room_states[i].temp;
+			samples[i].rh = room_states[i].rh;
+			samples[i].led_state = room_states[i].led_state;
+			samples[i].co2_age = metric_age(&room_states[i].co2_time, &now,
+					UINT16_MAX);
+			samples[i].temp_rh_age = metric_age(&room_states[i].temp_rh_time,
+					&now, UINT16_MAX);
+			samples[i].quality = room_states[i].quality;
+			seqs[i] = history_seq(i);
 		}
-	}
 
-	close(mod_fd);
+		pthread_mutex_unlock(&measurement_mutex);
 
-	mod_path_i2c_dev = malloc(strlen(mod_path) + strlen(system_name.release)
-		+ strlen(i2c_dev_relative));
+		rcu_thread_online();
 
-	strcpy(mod_path_i2c_dev, mod_path);
-	strcat(mod_path_i2c_dev, system_name.release);
-	strcat(mod_path_i2c_dev, i2c_dev_relative);
+		uploaded = 0;
 
-	mod_fd = open(mod_path_i2c_dev, O_RDONLY | O_CLOEXEC);
-	if(mod_fd < 0) {
-		syslog(LOG_ERR, "failed to open kernel-module file %s: %m",
-				mod_path_i2c_dev);
-		terminate(EXIT_FAILURE);
+		// the gateway uploads the readings of a relaying device
+		if(get_config()->relay != NULL) {
+			if(relay_log(samples, seqs, nrooms) == 0) {
+				for(i = 0; i < nrooms; i++)
+					atomic_store(&room_states[i].upload_seq, seqs[i]);
+				uploaded = 1;
+			}
+		}
+
+		else
+			for(i = 0; i < nrooms; i++) {
+				if((samples[i].quality & SAMPLE_EMPTY) == SAMPLE_EMPTY)
+					continue;
+
+				if(get_config()->report_by_exception &&
+						report_reason(i, &samples[i]) == REPORT_SKIP) {
+					// the server still holds a value within the deadband
+					atomic_store(&room_states[i].upload_seq, seqs[i]);
+					continue;
+				}
+
+				if(http_log(i, samples[i].co2, samples[i].temp, samples[i].rh,
+						samples[i].led_state) == 0) {
+					report_sent(i, &samples[i]);
+					atomic_store(&room_states[i].upload_seq, seqs[i]);
+					uploaded = 1;
+				}
+			}
+
+		if(uploaded)
+			atomic_store(&last_upload_time, time(NULL));
+
+		// slots missed by a long upload are skipped
+		next_upload_slot(identity, get_config()->logging_interval_sec, &slot);
 	}
+}
 
-	ret_syscall = finit_module(mod_fd, "", 0);
+// serves the requests posted by signal_handler() outside of signal context
+void *controller() {
+	struct timespec next_snapshot;
 
-	if(ret_syscall != 0) {
-		close(mod_fd);
-		if(errno != EEXIST) {
-			syslog(LOG_ERR, "failed to load kernel-module %s: %m",
-					mod_path_i2c_dev);
-			terminate(EXIT_FAILURE);
+	trace_register_thread("controller");
+
+	// baseline of the first minute
+	resources_sample();
+
+	clock_gettime(CLOCK_REALTIME, &next_snapshot);
+	next_snapshot.tv_sec += SNAPSHOT_INTERVAL;
+
+	while(1) {
+		if(sem_timedwait(&control_sem, &next_snapshot) != 0) {
+			if(errno == ETIMEDOUT) {
+				write_snapshot();
+				resources_sample();
+				clock_gettime(CLOCK_REALTIME, &next_snapshot);
+				next_snapshot.tv_sec += SNAPSHOT_INTERVAL;
+			}
+			continue;
+		}
+
+		if(atomic_load(&terminate_requested)) {
+			log_msg(LOG_INFO, "caught SIGTERM. terminating");
+			write_snapshot();
+			terminate(EXIT_SUCCESS);
 		}
+
+		if(atomic_exchange(&reload_requested, 0))
+			reload_config();
+
+		if(atomic_exchange(&stats_requested, 0)) {
+			write_stats();
+			history_export();
+		}
+
+		if(atomic_exchange(&trace_requested, 0))
+			trace_dump(0);
 	}
+}
+
+// compares optional settings, NULL if not set
+static int same_string(const char *a, const char *b) {
+	if(a == NULL || b == NULL)
+		return a == b;
 
-	close(mod_fd);
+	return strcmp(a, b) == 0;
 }
 
-void *http_logger() {
-	struct timespec logging_interval;
-	int co2_local;
-	float temp_local, rh_local;
-	int led_state_local;
+// parses the config-file again and swaps it in. the old config is freed
+// after the measurement and logging threads stopped using it
+void reload_config() {
+	struct iaq_config *conf, *old_conf;
+	int i;
 
-	while(1) {
-		logging_interval.tv_sec = logging_interval_sec;
-		logging_interval.tv_nsec = 0;
+	conf = parse_config();
 
-		// don't copy measurement values while measurements are ongoing, to keep
-		// measurement values consistent
-		pthread_mutex_lock(&measurement_mutex);
-		while(measurement_lock)
-			pthread_cond_wait(&measurement_cond, &measurement_mutex);
+	if(conf == NULL) {
+		log_msg(LOG_WARNING, "failed to reload config-file. keeping current "
+				"configuration");
+		trace(TRACE_CONFIG_RELOAD, 0, -1);
+		return;
+	}
 
-		co2_local = co2;
-		temp_local = temp;
-		rh_local = rh;
-		led_state_local = led_state;
+	old_conf = get_config();
 
-		pthread_mutex_unlock(&measurement_mutex);
+	// the rooms are measured by the threads as set up at startup, so
+	// thresholds of a different set of rooms cannot be applied
+	for(i = 0; i < conf->nrooms && conf->nrooms == old_conf->nrooms; i++)
+		if(conf->rooms[i].channel != old_conf->rooms[i].channel ||
+				strcmp(conf->rooms[i].room, old_conf->rooms[i].room) != 0)
+			break;
 
-		http_log(co2_local, temp_local, rh_local, led_state_local);
-		nanosleep(&logging_interval, NULL);
+	if(i != old_conf->nrooms || conf->mux_address != old_conf->mux_address ||
+			conf->gateway != old_conf->gateway ||
+			(conf->gateway && conf->gateway_port != old_conf->gateway_port)) {
+		log_msg(LOG_WARNING, "rooms, mux_address and gateway settings cannot be "
+				"changed during operation. keeping current configuration, "
+				"restart iaq-measurementd to apply them");
+		free_config(conf);
+		trace(TRACE_CONFIG_RELOAD, 0, -1);
+		return;
 	}
+
+	for(i = 0; i < conf->nrooms * 3; i++)
+		if(room_pin(conf, i) != room_pin(old_conf, i))
+			break;
+
+	// the i2c device file, the GPIO pins and real-time scheduling are set up
+	// once at startup
+	if(strcmp(conf->i2c_device, old_conf->i2c_device) != 0 ||
+			i != conf->nrooms * 3 ||
+			conf->realtime != old_conf->realtime ||
+			conf->realtime_priority != old_conf->realtime_priority ||
+			conf->realtime_cpu != old_conf->realtime_cpu ||
+			conf->led_backend != old_conf->led_backend ||
+			strcmp(conf->gpio_chip, old_conf->gpio_chip) != 0 ||
+			!same_string(conf->multicast_group, old_conf->multicast_group) ||
+			conf->multicast_port != old_conf->multicast_port ||
+			conf->multicast_ttl != old_conf->multicast_ttl) {
+
+		log_msg(LOG_WARNING, "i2c_device, LED backend and pins, realtime and "
+				"multicast settings cannot be changed during operation. "
+				"restart iaq-measurementd to apply them");
+
+		free(conf->i2c_device);
+		free(conf->gpio_chip);
+		free(conf->multicast_group);
+		conf->gpio_chip = NULL;
+		conf->multicast_group = NULL;
+
+		if((conf->i2c_device = strdup(old_conf->i2c_device)) == NULL ||
+				(conf->gpio_chip = strdup(old_conf->gpio_chip)) == NULL ||
+				(old_conf->multicast_group != NULL &&
+				 (conf->multicast_group = strdup(old_conf->multicast_group))
+				 == NULL)) {
+			log_msg(LOG_ERR, "failed to strdup settings: %m. keeping current "
+					"configuration");
+			free_config(conf);
+			return;
+		}
+
+		conf->led_backend = old_conf->led_backend;
+		conf->multicast_port = old_conf->multicast_port;
+		conf->multicast_ttl = old_conf->multicast_ttl;
+
+		for(i = 0; i < conf->nrooms; i++) {
+			conf->rooms[i].green_pin = old_conf->rooms[i].green_pin;
+			conf->rooms[i].yellow_pin = old_conf->rooms[i].yellow_pin;
+			conf->rooms[i].red_pin = old_conf->rooms[i].red_pin;
+		}
+		conf->realtime = old_conf->realtime;
+		conf->realtime_priority = old_conf->realtime_priority;
+		conf->realtime_cpu = old_conf->realtime_cpu;
+	}
+
+	// the files other programs read must match the config in use
+	if(write_threshold_files(conf) != 0) {
+		log_msg(LOG_WARNING, "failed to reload config-file. keeping current "
+				"configuration");
+		free_config(conf);
+		trace(TRACE_CONFIG_RELOAD, 0, -1);
+		return;
+	}
+
+	atomic_store(&current_config, conf);
+	synchronize_rcu();
+	free_config(old_conf);
+
+	trace(TRACE_CONFIG_RELOAD, 0, 0);
+	log_msg(LOG_INFO, "config-file reloaded");
 }
 
 // clean up and terminate
 void terminate(int status) {
+	struct iaq_config *conf;
+
 	if(remove(PIDFILE) == -1)
 		if(errno != ENOENT)
-			syslog(LOG_ERR, "failed to remove pidfile " PIDFILE ": %m."
+			log_msg(LOG_ERR, "failed to remove pidfile " PIDFILE ": %m."
 					" please remove it manually");
 
-	// don't care about errors
-	remove(PKGSTATEDIR "/co2");
-	remove(PKGSTATEDIR "/temp");
-	remove(PKGSTATEDIR "/rh");
-	remove(PKGSTATEDIR "/led_state");
-	remove(PKGSTATEDIR "/co2_threshold_yellow");
-	remove(PKGSTATEDIR "/co2_threshold_red");
-	remove(PKGSTATEDIR "/co2_hysteresis");
-	remove(PKGSTATEDIR "/temp_threshold_yellow");
-	remove(PKGSTATEDIR "/temp_threshold_red");
-	remove(PKGSTATEDIR "/rh_threshold_yellow");
-	remove(PKGSTATEDIR "/rh_threshold_red");
-
-	digitalWrite(green_pin, OFF);
-	digitalWrite(yellow_pin, OFF);
-	digitalWrite(red_pin, OFF);
+	conf = get_config();
+
+	// don't care about errors. without a config only the files of the
+	// first room can exist
+	remove_state_files(conf != NULL ? conf->nrooms : 1);
+
+	// config not read yet, so the pins were never set up
+	if(conf != NULL)
+		leds_off(conf);
+
+	// write the messages leading to the termination
+	log_flush();
 
 	exit(status);
 }
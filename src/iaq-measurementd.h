@@ -20,6 +20,10 @@
 
 #include "config.h"
 #include <libconfig.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
 
 #define PIDFILE RUNSTATEDIR "/" PACKAGE_NAME ".pid"
 
@@ -27,8 +31,18 @@
 
 #define DEFAULT_HOST "localhost"
 
-// time between measurements in seconds
+// time between co2 measurements in seconds, default of sample_interval_min
+// and sample_interval_max
 #define MEASUREMENT_INTERVAL 10L
+// the k-30 updates its reading every 2 s
+#define SAMPLE_INTERVAL_MIN 2
+#define SAMPLE_INTERVAL_MAX 600
+// time between temperature/humidity measurements in seconds
+#define DEFAULT_SI7021_PERIOD 60
+// time budget of a measurement cycle in milliseconds
+#define DEFAULT_CYCLE_DEADLINE 2000
+#define CYCLE_DEADLINE_MIN 100
+#define CYCLE_DEADLINE_MAX 60000
 // time between log entries in minutes
 #define DEFAULT_LOGGING_INTERVAL 5L
 
@@ -44,18 +58,77 @@
 // in degree celcius (°C)
 #define DEFAULT_TEMP_THRESHOLD_YELLOW 28
 #define DEFAULT_TEMP_THRESHOLD_RED 32
+#define DEFAULT_TEMP_HYSTERESIS 1
 
 // in percent (%)
 #define DEFAULT_RH_THRESHOLD_YELLOW 80
 #define DEFAULT_RH_THRESHOLD_RED 100
+#define DEFAULT_RH_HYSTERESIS 5
+
+// si7021 resolution profiles: 12 bit rh / 14 bit temperature, 10/13 and 8/12
+#define SI7021_RESOLUTION_PRECISION 0
+#define SI7021_RESOLUTION_BALANCED 1
+#define SI7021_RESOLUTION_LATENCY 2
+
+// si7021 heater. in auto mode it is switched on once the rh reaches
+// SI7021_HEATER_ON_RH, e.g. after condensation, and off again below
+// SI7021_HEATER_OFF_RH. temperatures measured while heating are too high
+#define SI7021_HEATER_OFF 0
+#define SI7021_HEATER_ON 1
+#define SI7021_HEATER_AUTO 2
+#define SI7021_HEATER_ON_RH 98 // in percent
+#define SI7021_HEATER_OFF_RH 90 // in percent
+
+// largest calibration offset of the k-30 in ppm, its measurement range
+#define CO2_OFFSET_MAX 10000
 
 // wiringPi pin numbering goes from 0 to 20
 #define WIRING_PI_MIN 0
 #define WIRING_PI_MAX 20
 
+// the LEDs show the co2 state only, or the worst state of all metrics
+#define LED_COMBINE_CO2 0
+#define LED_COMBINE_WORST 1
+
+// LEDs driven through wiringPi or the GPIO character device of the kernel
+#define LED_BACKEND_WIRINGPI 0
+#define LED_BACKEND_GPIO_CDEV 1
+#define DEFAULT_GPIO_CHIP "/dev/gpiochip0"
+// highest line offset accepted for LED pins
+#define GPIO_LINE_MAX 1023
+
+// rooms served by one daemon through an i2c multiplexer (TCA9548A)
+#define MAX_ROOMS 8
+#define MUX_CHANNELS 8
+#define DEFAULT_MUX_ADDRESS 0x70
+#define MUX_ADDRESS_MIN 0x70
+#define MUX_ADDRESS_MAX 0x77
+// room without multiplexer
+#define NO_MUX -1
+
+// UDP port for readings relayed to a gateway
+#define DEFAULT_GATEWAY_PORT 4470
+
 // minimum logging_interval in minutes
 #define LOGGING_INTERVAL_MIN 1
 
+// report-by-exception deadbands, absolute and in percent of the last
+// uploaded value, and the maximum time without upload in minutes
+#define DEFAULT_CO2_DEADBAND 50 // in ppm
+#define DEFAULT_CO2_DEADBAND_RELATIVE 5
+#define DEFAULT_TEMP_DEADBAND 0.3f // in degree celcius
+#define DEFAULT_TEMP_DEADBAND_RELATIVE 0
+#define DEFAULT_RH_DEADBAND 2 // in percent
+#define DEFAULT_RH_DEADBAND_RELATIVE 0
+#define DEFAULT_HEARTBEAT_INTERVAL 60L
+
+// SCHED_FIFO priority of the measurement thread in real-time mode
+#define DEFAULT_REALTIME_PRIORITY 50
+#define REALTIME_PRIORITY_MIN 1
+#define REALTIME_PRIORITY_MAX 99
+// don't pin the measurement thread to a cpu
+#define DEFAULT_REALTIME_CPU -1
+
 #define XSTR(S) STR(S)
 #define STR(S) #S
 
@@ -73,38 +146,50 @@
 #define YELLOW 2
 #define RED 3
 
-// read from CONFFILE
-extern const char *i2c_device;
-// time between log entries in seconds
-extern time_t logging_interval_sec;
-// wiringPi pins for LEDs
-extern int green_pin, yellow_pin, red_pin;
-// threshold values for yellow and red LED
-extern int co2_threshold_yellow, co2_threshold_red; // in ppm
-extern int co2_hysteresis; // in ppm
-// in degree celcius
-extern float temp_threshold_yellow, temp_threshold_red;
-extern float rh_threshold_yellow, rh_threshold_red; // in percent
-
-// (optional) room number
-extern const char *room;
-
-// hostname or IP-address of the iaq-server
-extern const char *host;
-
-// measurement results
-extern int co2;
-extern float temp;
-extern float rh;
-
-// state of the LEDs
-extern int led_state;
+// metrics with LED thresholds, index of struct room_config.led_table and
+// struct room_state.metric_states
+#define LED_METRIC_CO2 0
+#define LED_METRIC_TEMP 1
+#define LED_METRIC_RH 2
+#define LED_METRICS 3
+
+struct room_state {
+	// measurement results, as read from the sensors and converted with the
+	// calibration of the room
+	uint16_t co2_word, temp_word, rh_word;
+	int co2;
+	float temp;
+	float rh;
+	// CLOCK_MONOTONIC of the last successful measurement of the sensors
+	struct timespec co2_time, temp_rh_time;
+	// SAMPLE_*_STALE and SAMPLE_*_MISSING of the metrics
+	uint8_t quality;
+	// state of the LEDs
+	int led_state;
+	// states of the single metrics for LED_COMBINE_WORST, each with its own
+	// hysteresis
+	int metric_states[LED_METRICS];
+	// history sequence number of the last successful upload
+	atomic_uint upload_seq;
+};
+
+// indexed like the rooms of the config
+extern struct room_state room_states[MAX_ROOMS];
+
+// protects the measurement results and LED states of room_states
+extern pthread_mutex_t measurement_mutex;
+
+// CLOCK_REALTIME of the last successful upload
+extern atomic_uint last_upload_time;
 
 void daemonize();
 static inline int finit_module(int fd, const char *uargs, int flags);
-void load_kernel_modules();
-void parse_config();
+int load_kernel_modules();
+void *module_loader();
+void record_startup_time(atomic_uint *metric);
+void reload_config();
 void terminate();
 void *http_logger();
+void *controller();
 
 #endif
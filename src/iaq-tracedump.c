@@ -0,0 +1,149 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/iaq-tracedump.c
+ *
+ * Decodes a flight recorder dump of iaq-measurementd into a timeline
+ *
+ * usage: iaq-tracedump [dump-file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "trace.h"
+
+static const char *type_names[TRACE_TYPE_MAX] = {
+	[TRACE_I2C_ADDRESS] = "i2c-address",
+	[TRACE_I2C_WRITE] = "i2c-write",
+	[TRACE_I2C_READ] = "i2c-read",
+	[TRACE_I2C_RETRY] = "i2c-retry",
+	[TRACE_CHECKSUM_ERROR] = "checksum-error",
+	[TRACE_RETRY_DELAY] = "retry-delay",
+	[TRACE_SENSOR_RESULT] = "sensor-result",
+	[TRACE_LED_STATE] = "led-state",
+	[TRACE_UPLOAD_START] = "upload-start",
+	[TRACE_UPLOAD_END] = "upload-end",
+	[TRACE_CONFIG_RELOAD] = "config-reload",
+	[TRACE_MUX_SELECT] = "mux-select",
+	[TRACE_GATEWAY_FORWARD] = "gateway-forward",
+	[TRACE_SI7021_CONFIG] = "si7021-config",
+	[TRACE_ALERT_START] = "alert-start",
+	[TRACE_ALERT_END] = "alert-end",
+	[TRACE_SENSOR_HEALTH] = "sensor-health",
+};
+
+struct timeline_entry {
+	struct trace_event event;
+	const char *thread;
+};
+
+static int compare_entries(const void *a, const void *b) {
+	const struct timeline_entry *x = a, *y = b;
+
+	if(x->event.timestamp < y->event.timestamp)
+		return -1;
+	return x->event.timestamp > y->event.timestamp;
+}
+
+int main(int argc, char *argv[]) {
+	const char *path = argc > 1 ? argv[1] : TRACEFILE;
+	FILE *dump;
+	struct trace_header header;
+	struct trace_ring *rings;
+	struct timeline_entry *timeline;
+	unsigned int i, j, first, count, n = 0;
+	uint64_t start = 0, timestamp;
+	time_t seconds;
+	char date[32];
+
+	if((dump = fopen(path, "r")) == NULL) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	if(fread(&header, sizeof(header), 1, dump) != 1 ||
+			header.magic != TRACE_MAGIC) {
+		fprintf(stderr, "%s: not a trace dump\n", path);
+		return EXIT_FAILURE;
+	}
+
+	if(header.version != TRACE_VERSION || header.ring_size != TRACE_RING_SIZE
+			|| header.event_size != sizeof(struct trace_event) ||
+			header.nrings > TRACE_MAX_THREADS) {
+		fprintf(stderr, "%s: written by an incompatible version\n", path);
+		return EXIT_FAILURE;
+	}
+
+	rings = calloc(header.nrings, sizeof(struct trace_ring));
+	timeline = calloc(header.nrings * TRACE_RING_SIZE,
+		sizeof(struct timeline_entry));
+
+	if(rings == NULL || timeline == NULL) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+
+	if(fread(rings, sizeof(struct trace_ring), header.nrings, dump) !=
+			header.nrings) {
+		fprintf(stderr, "%s: truncated\n", path);
+		return EXIT_FAILURE;
+	}
+
+	fclose(dump);
+
+	for(i = 0; i < header.nrings; i++) {
+		rings[i].name[TRACE_NAME_LEN - 1] = '\0';
+		count = rings[i].head;
+		first = count > TRACE_RING_SIZE ? count - TRACE_RING_SIZE : 0;
+
+		for(j = first; j < count; j++) {
+			timeline[n].event = rings[i].events[j & (TRACE_RING_SIZE - 1)];
+			timeline[n].thread = rings[i].name;
+			n++;
+		}
+	}
+
+	qsort(timeline, n, sizeof(struct timeline_entry), compare_entries);
+
+	if(header.signal != 0)
+		printf("# dumped on signal %d (%s)\n", header.signal,
+			strsignal(header.signal));
+	printf("# %u events\n", n);
+
+	for(i = 0; i < n; i++) {
+		timestamp = timeline[i].event.timestamp;
+		if(i == 0)
+			start = timestamp;
+
+		seconds = (timestamp + header.realtime_offset) / 1000000000ULL;
+		strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S",
+			localtime(&seconds));
+
+		printf("%s.%06llu +%10.6f %-12s %-15s 0x%02x %d\n", date,
+			(unsigned long long)((timestamp + header.realtime_offset) %
+			1000000000ULL) / 1000, (timestamp - start) / 1e9,
+			timeline[i].thread,
+			timeline[i].event.type < TRACE_TYPE_MAX &&
+			type_names[timeline[i].event.type] ?
+			type_names[timeline[i].event.type] : "unknown",
+			timeline[i].event.arg0, timeline[i].event.arg1);
+	}
+
+	free(rings);
+	free(timeline);
+
+	return EXIT_SUCCESS;
+}
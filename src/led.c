@@ -0,0 +1,39 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/led.c
+ *
+ * Compiles the thresholds and the hysteresis of a metric into a decision
+ * table with one rule per LED state, evaluated by led_step()
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "iaq-measurementd.h"
+#include "led.h"
+
+// fills the LED rules of one metric. the transitions are the ones of the
+// original CO2 if-chain: from OFF the value decides directly, GREEN only
+// steps up to YELLOW, YELLOW and RED step down once the value falls below
+// their threshold minus the hysteresis
+void compile_led_rules(struct led_rule *rules, float yellow, float red,
+		float hysteresis) {
+	struct led_rule table[4] = {
+		[OFF] = {yellow, red, {GREEN, YELLOW, RED}},
+		[GREEN] = {yellow, INFINITY, {GREEN, YELLOW, YELLOW}},
+		[YELLOW] = {yellow - hysteresis, red, {GREEN, YELLOW, RED}},
+		[RED] = {-INFINITY, red - hysteresis, {YELLOW, YELLOW, RED}},
+	};
+
+	memcpy(rules, table, sizeof(table));
+}
@@ -0,0 +1,43 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/led.h
+ *
+ * Header file for the LED decision tables of the metrics
+ */
+
+#ifndef _IAQ_MEASUREMENTD_LED_H_
+#define _IAQ_MEASUREMENTD_LED_H_
+
+#include <stdint.h>
+
+// transition of one LED state for one metric. a value below lo leads to
+// next[0], above hi to next[2] and in between to next[1]
+struct led_rule {
+	float lo, hi;
+	uint8_t next[3];
+};
+
+void compile_led_rules(struct led_rule *rules, float yellow, float red,
+		float hysteresis);
+
+// one step of the decision table of a metric, without branches
+static inline int led_step(const struct led_rule *rules, int state,
+		float value) {
+	const struct led_rule *rule = &rules[state];
+	int gt = value > rule->hi;
+	int lt = (value < rule->lo) & !gt;
+
+	return rule->next[1 + gt - lt];
+}
+
+#endif
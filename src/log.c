@@ -0,0 +1,280 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/log.c
+ *
+ * Asynchronous syslog front-end. log_msg() formats the message into a
+ * lock-free ring (a bounded queue after Dmitry Vyukov), a writer thread
+ * passes the messages on to syslog(). The writer collapses identical
+ * consecutive messages into a "repeated N times" summary and limits the
+ * messages per format string, so a sensor or server outage neither blocks
+ * the measurement thread nor floods the system log
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "log.h"
+
+struct log_cell {
+	// position the cell is ready for: pos while free, pos + 1 once written
+	atomic_uint seq;
+	int priority;
+	// identifies the message for rate limiting
+	const char *format;
+	char text[LOG_MSG_LEN];
+};
+
+static struct log_cell ring[LOG_RING_SIZE];
+static atomic_uint enqueue_pos;
+// only used by the consumer, under consumer_mutex
+static unsigned int dequeue_pos;
+
+// log_flush() drains the ring on termination besides the writer thread
+static pthread_mutex_t consumer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static sem_t log_sem;
+static atomic_int log_running;
+// messages lost because the ring was full
+static atomic_uint log_dropped;
+
+// last message written, for collapsing repetitions
+static int last_priority;
+static char last_text[LOG_MSG_LEN];
+static unsigned int last_repeats;
+static time_t last_repeat_start;
+
+static struct log_rate {
+	const char *format;
+	unsigned int tokens;
+	unsigned int suppressed;
+	time_t refill; // CLOCK_MONOTONIC in s
+} rates[LOG_RATE_KEYS];
+
+static time_t monotonic_sec() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec;
+}
+
+static void flush_repeats() {
+	if(last_repeats == 0)
+		return;
+
+	if(last_repeats == 1)
+		syslog(last_priority, "%s", last_text);
+	else
+		syslog(last_priority, "last message repeated %u times",
+				last_repeats);
+
+	last_repeats = 0;
+}
+
+// returns the rate limit of format, NULL if the table is full
+static struct log_rate *rate_of(const char *format) {
+	unsigned int i, hash = (uintptr_t)format >> 3;
+
+	for(i = 0; i < LOG_RATE_KEYS; i++) {
+		struct log_rate *rate = &rates[(hash + i) % LOG_RATE_KEYS];
+
+		if(rate->format == format)
+			return rate;
+
+		if(rate->format == NULL) {
+			rate->format = format;
+			rate->tokens = LOG_RATE_BURST;
+			rate->refill = monotonic_sec() + LOG_RATE_INTERVAL;
+			return rate;
+		}
+	}
+
+	return NULL;
+}
+
+// passes one message to syslog, called by the consumer only
+static void log_write(int priority, const char *format, const char *text) {
+	struct log_rate *rate;
+	unsigned int dropped;
+	time_t now = monotonic_sec();
+
+	if((dropped = atomic_exchange(&log_dropped, 0)) != 0) {
+		flush_repeats();
+		syslog(LOG_WARNING, "%u log messages dropped", dropped);
+	}
+
+	if(priority == last_priority && strcmp(text, last_text) == 0) {
+		if(last_repeats++ == 0)
+			last_repeat_start = now;
+		return;
+	}
+
+	flush_repeats();
+
+	// a different message, even if it's rate limited
+	last_priority = priority;
+	strcpy(last_text, text);
+
+	if((rate = rate_of(format)) != NULL) {
+		if(now >= rate->refill) {
+			rate->tokens = LOG_RATE_BURST;
+			rate->refill = now + LOG_RATE_INTERVAL;
+		}
+
+		if(rate->tokens == 0) {
+			rate->suppressed++;
+			return;
+		}
+
+		rate->tokens--;
+
+		if(rate->suppressed != 0) {
+			syslog(priority, "%s (%u similar messages suppressed)", text,
+					rate->suppressed);
+			rate->suppressed = 0;
+			return;
+		}
+	}
+
+	syslog(priority, "%s", text);
+}
+
+// called with consumer_mutex held
+static void log_drain() {
+	struct log_cell *cell;
+
+	while(1) {
+		cell = &ring[dequeue_pos & (LOG_RING_SIZE - 1)];
+
+		if(atomic_load_explicit(&cell->seq, memory_order_acquire) !=
+				dequeue_pos + 1)
+			break;
+
+		log_write(cell->priority, cell->format, cell->text);
+
+		// free the cell for the producer one round later
+		atomic_store_explicit(&cell->seq, dequeue_pos + LOG_RING_SIZE,
+				memory_order_release);
+		dequeue_pos++;
+	}
+
+	if(last_repeats != 0 &&
+			monotonic_sec() - last_repeat_start >= LOG_REPEAT_INTERVAL)
+		flush_repeats();
+}
+
+static void *log_writer() {
+	struct timespec deadline;
+
+	while(1) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += LOG_REPEAT_INTERVAL;
+
+		// woken by log_msg(), or to summarize repetitions
+		if(sem_timedwait(&log_sem, &deadline) != 0 && errno != ETIMEDOUT)
+			continue;
+
+		pthread_mutex_lock(&consumer_mutex);
+		log_drain();
+		pthread_mutex_unlock(&consumer_mutex);
+	}
+
+	return NULL;
+}
+
+// starts the writer thread. until then log_msg() calls syslog() directly
+void log_start() {
+	pthread_t writer_thread;
+	unsigned int i;
+
+	for(i = 0; i < LOG_RING_SIZE; i++)
+		atomic_init(&ring[i].seq, i);
+
+	if(sem_init(&log_sem, 0, 0) != 0 ||
+			pthread_create(&writer_thread, NULL, log_writer, NULL) != 0) {
+		syslog(LOG_WARNING, "failed to start log writer: %m. logging "
+				"synchronously");
+		return;
+	}
+
+	atomic_store(&log_running, 1);
+}
+
+// queues a message for syslog(). never blocks, if the ring is full the
+// message is dropped and counted. %m refers to errno at the time of the call
+void log_msg(int priority, const char *format, ...) {
+	struct log_cell *cell;
+	unsigned int pos, seq;
+	int saved_errno = errno;
+	va_list args;
+
+	if(!atomic_load_explicit(&log_running, memory_order_acquire)) {
+		va_start(args, format);
+		vsyslog(priority, format, args);
+		va_end(args);
+		return;
+	}
+
+	pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+
+	while(1) {
+		cell = &ring[pos & (LOG_RING_SIZE - 1)];
+		seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+
+		if(seq == pos) {
+			if(atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos,
+						pos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+
+		// not consumed yet from the previous round
+		else if((int)(seq - pos) < 0) {
+			atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+			errno = saved_errno;
+			return;
+		}
+
+		else
+			pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+	}
+
+	cell->priority = priority;
+	cell->format = format;
+
+	errno = saved_errno;
+	va_start(args, format);
+	vsnprintf(cell->text, LOG_MSG_LEN, format, args);
+	va_end(args);
+
+	atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+	sem_post(&log_sem);
+	errno = saved_errno;
+}
+
+// writes all queued messages synchronously, e.g. before terminating
+void log_flush() {
+	if(!atomic_load(&log_running))
+		return;
+
+	pthread_mutex_lock(&consumer_mutex);
+	log_drain();
+	flush_repeats();
+	pthread_mutex_unlock(&consumer_mutex);
+}
@@ -0,0 +1,42 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/log.h
+ *
+ * Header file for the asynchronous syslog front-end
+ */
+
+#ifndef _IAQ_MEASUREMENTD_LOG_H_
+#define _IAQ_MEASUREMENTD_LOG_H_
+
+#include <syslog.h>
+
+// messages waiting for the writer thread, must be a power of 2
+#define LOG_RING_SIZE 128
+// longer messages are truncated
+#define LOG_MSG_LEN 192
+
+// identical consecutive messages are summarized at least this often
+#define LOG_REPEAT_INTERVAL 300 // in s
+
+// per format string, at most LOG_RATE_BURST messages per LOG_RATE_INTERVAL
+#define LOG_RATE_BURST 5
+#define LOG_RATE_INTERVAL 300 // in s
+// number of format strings that are rate limited
+#define LOG_RATE_KEYS 64
+
+void log_start();
+void log_msg(int priority, const char *format, ...)
+	__attribute__((format(printf, 2, 3)));
+void log_flush();
+
+#endif
@@ -16,6 +16,7 @@
  */
 
 #include <stdlib.h>
+#include <time.h>
 #include <linux/i2c-dev.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
@@ -25,30 +26,206 @@
 
 #include "measurement.h"
 #include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "realtime.h"
+#include "stats.h"
+#include "trace.h"
+#include "log.h"
+#include "units.h"
 
 int i2c_fd;
 struct timespec error_delay = {0L, ERROR_DELAY};
 
-// changes the I2C slave address
+// failed reads/writes of the current transaction, incl. checksum errors
+static unsigned int i2c_retries;
+// current slave address, for tracing
+static int i2c_address;
+// end of the time budget of the current cycle
+static struct timespec deadline;
+
+// sets the end of the time budget of the measurements in the current cycle.
+// measurements are not started and retries not attempted after it
+void measurement_deadline(const struct timespec *end) {
+	deadline = *end;
+}
+
+// nanoseconds left until the deadline, negative once it passed
+static long long deadline_left() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (deadline.tv_sec - now.tv_sec) * 1000000000LL +
+		deadline.tv_nsec - now.tv_nsec;
+}
+
+int deadline_passed() {
+	return deadline_left() <= 0;
+}
+
+// sleeps for delay before a retry. returns -1 without sleeping if the delay
+// alone would exceed the deadline
+static int retry_delay(const struct timespec *delay) {
+	if(deadline_left() < delay->tv_sec * 1000000000LL + delay->tv_nsec) {
+		trace(TRACE_RETRY_DELAY, i2c_address, -1);
+		return -1;
+	}
+
+	timed_nanosleep(delay);
+
+	return 0;
+}
+
+// write() to the i2c device, duration recorded in hist
+static int i2c_write(const void *buffer, size_t len, struct histogram *hist) {
+	struct timespec start, end;
+	int status;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	status = write(i2c_fd, buffer, len);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	histogram_record(hist, elapsed_us(&start, &end));
+	trace(TRACE_I2C_WRITE, i2c_address, status);
+
+	if(status != len)
+		trace(TRACE_I2C_RETRY, i2c_address, ++i2c_retries);
+
+	return status;
+}
+
+// read() from the i2c device, duration recorded in hist
+static int i2c_read(void *buffer, size_t len, struct histogram *hist) {
+	struct timespec start, end;
+	int status;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	status = read(i2c_fd, buffer, len);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	histogram_record(hist, elapsed_us(&start, &end));
+	trace(TRACE_I2C_READ, i2c_address, status);
+
+	if(status != len)
+		trace(TRACE_I2C_RETRY, i2c_address, ++i2c_retries);
+
+	return status;
+}
+
+// changes the I2C slave address. the device file is closed on errors and
+// opened again by the next call
 int openI2c(int address) {
+	if(i2c_fd < 0) {
+		if((i2c_fd = open(get_config()->i2c_device, O_RDWR | O_CLOEXEC)) < 0) {
+			trace(TRACE_I2C_ADDRESS, address, -1);
+			log_msg(LOG_WARNING, "failed to open i2c device file %s: %m",
+					get_config()->i2c_device);
+			return 1;
+		}
+	}
+
 	// tell the i2c driver the slave address
+	i2c_address = address;
 	if(ioctl(i2c_fd, I2C_SLAVE, address) < 0) {
-		syslog(LOG_ERR, "failed to ioctl i2c device file %s: %m ", i2c_device);
-		if(i2c_fd != -1)
-			close(i2c_fd);
+		trace(TRACE_I2C_ADDRESS, address, -1);
+		log_msg(LOG_WARNING, "failed to ioctl i2c device file %s: %m",
+				get_config()->i2c_device);
+		close(i2c_fd);
+		i2c_fd = -1;
 		return 1;
 	}
+	trace(TRACE_I2C_ADDRESS, address, 0);
+	return 0;
+}
+
+// currently selected multiplexer channel
+static int mux_channel = NO_MUX;
+
+// connects the sensors on channel of the i2c multiplexer at address to the
+// bus. nothing is sent if the channel is selected already or there is no
+// multiplexer. returns 0 on success, 1 if the i2c device file is unusable and
+// 2 if the multiplexer didn't respond
+int mux_select(int address, int channel) {
+	uint8_t control;
+
+	if(channel == NO_MUX || channel == mux_channel)
+		return 0;
+
+	if(openI2c(address))
+		return 1;
+
+	// the control register has one bit per channel
+	control = 1 << channel;
+
+	if(write(i2c_fd, &control, 1) != 1) {
+		trace(TRACE_MUX_SELECT, channel, -1);
+		log_msg(LOG_WARNING, "failed to select channel %d of the i2c "
+				"multiplexer: %m", channel);
+		mux_channel = NO_MUX;
+		return 2;
+	}
+
+	trace(TRACE_MUX_SELECT, channel, 0);
+	mux_channel = channel;
+
 	return 0;
 }
 
-// k-30 measurement function (co2-sensor)
-int CO2(int *co2) {
+static int k30_measure(uint16_t *co2);
+static int si7021_measure(uint16_t *temp, uint16_t *rh);
+
+// k-30 measurement function (co2-sensor). co2 is the word read from the
+// sensor, see units.h for the conversion
+int CO2(uint16_t *co2) {
+	struct timespec start, end;
+	int status;
+
+	if(deadline_passed())
+		return MEASUREMENT_DEADLINE;
+
+	i2c_retries = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	status = k30_measure(co2);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	histogram_record(&k30_transaction_hist, elapsed_us(&start, &end));
+	histogram_record(&k30_retries_hist, i2c_retries);
+	trace(TRACE_SENSOR_RESULT, 0x68, status);
+
+	return status;
+}
+
+// si7021 measurement function (temperature and relative humidity sensor).
+// temp and rh are the words read from the sensor, see units.h for the
+// conversion
+int si7021(uint16_t *temp, uint16_t *rh) {
+	struct timespec start, end;
+	int status;
+
+	if(deadline_passed())
+		return MEASUREMENT_DEADLINE;
+
+	i2c_retries = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	status = si7021_measure(temp, rh);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	histogram_record(&si7021_transaction_hist, elapsed_us(&start, &end));
+	histogram_record(&si7021_retries_hist, i2c_retries);
+	trace(TRACE_SENSOR_RESULT, 0x40, status);
+
+	return status;
+}
+
+static int k30_measure(uint16_t *co2) {
 	uint8_t checksum;
 	int status_write, status_read;
 	// buffer for request
-	uint8_t *buffer_write;
+	uint8_t buffer_write[4];
 	// buffer for response
-	uint8_t *buffer_read;
+	uint8_t buffer_read[4];
 	uint8_t write_error_cnt = 0;
 	uint8_t read_error_cnt = 0;
 	uint8_t checksum_error_cnt = 0;
@@ -63,8 +240,6 @@ int CO2(int *co2) {
 	int i;
 	uint8_t success = 0;
 
-	buffer_write = malloc(4);
-
 	// command sequence according to datasheet
 	// 0x22: read 2 bytes
 	*buffer_write = 0x22;
@@ -74,8 +249,6 @@ int CO2(int *co2) {
 	// 0x2A: checksum
 	*(buffer_write+3) = 0x2A;
 
-	buffer_read = malloc(4);
-
 	// according to the datasheet (I²C communication guide), the k-30
 	// sensor will not acknowledge written bytes if it is performing
 	// measurements, which is not an error.
@@ -92,7 +265,7 @@ int CO2(int *co2) {
 
 		write(i2c_fd, buffer_write, 1);
 
-		nanosleep(&t_WUD, NULL);
+		timed_nanosleep(&t_WUD);
 
 		// address of k-30 is 0x68 according to datasheet
 		if(openI2c(0x68))
@@ -100,16 +273,21 @@ int CO2(int *co2) {
 
 		do {
 			do {
-				status_write = write(i2c_fd, buffer_write, 4);
+				status_write = i2c_write(buffer_write, 4, &k30_write_hist);
 
 				if(status_write != 4) {
 					write_error_cnt++;
 					// the k-30 co2 sensor might not respond during its
 					// measurements, so retry after one larger delay
-					if(checksum_error_cnt++ == MAX_ERROR_CNT/2)
-						nanosleep(&error_co2_delay, NULL);
-					else
-						nanosleep(&error_delay, NULL);
+					if(checksum_error_cnt++ == MAX_ERROR_CNT/2) {
+						trace(TRACE_RETRY_DELAY, 0x68, ERROR_CO2_DELAY * 1000);
+						if(retry_delay(&error_co2_delay) != 0)
+							return MEASUREMENT_DEADLINE;
+					}
+					else {
+						if(retry_delay(&error_delay) != 0)
+							return MEASUREMENT_DEADLINE;
+					}
 				}
 
 			} while(status_write != 4 && write_error_cnt < MAX_ERROR_CNT);
@@ -117,13 +295,14 @@ int CO2(int *co2) {
 			if(status_write != 4)
 				return 2;
 
-			nanosleep(&t_WAIT, NULL);
+			timed_nanosleep(&t_WAIT);
 
-			status_read = read(i2c_fd, buffer_read, 4);
+			status_read = i2c_read(buffer_read, 4, &k30_read_hist);
 
 			if(status_read != 4) {
 				read_error_cnt++;
-				nanosleep(&error_delay, NULL);
+				if(retry_delay(&error_delay) != 0)
+					return MEASUREMENT_DEADLINE;
 			}
 
 		} while(status_read != 4 && read_error_cnt < MAX_ERROR_CNT);
@@ -144,7 +323,10 @@ int CO2(int *co2) {
 		}
 		else {
 			checksum_error_cnt++;
-			nanosleep(&error_delay, NULL);
+			i2c_retries++;
+			trace(TRACE_CHECKSUM_ERROR, i2c_address, *(buffer_read+3));
+			if(retry_delay(&error_delay) != 0)
+				return MEASUREMENT_DEADLINE;
 		}
 
 	} while(!success && checksum_error_cnt < MAX_ERROR_CNT);
@@ -155,20 +337,94 @@ int CO2(int *co2) {
 	return 0;
 }
 
-// si7021 measurement function (temperature and relative humidity sensor)
-int si7021(float *temp, float *rh) {
+// si7021 user register 1: resolution in bits 7 and 0, heater enable in bit 2.
+// the other bits are reserved and written back as read
+#define SI7021_READ_USER_REG 0xE7
+#define SI7021_WRITE_USER_REG 0xE6
+#define SI7021_RES_MASK 0x81
+#define SI7021_HTRE 0x04
+
+// resolutions indexed by SI7021_RESOLUTION_*, and the time a rh measurement
+// incl. the temperature measurement takes (maximum values of the datasheet)
+static const struct {
+	uint8_t res_bits;
+	struct timespec conversion;
+} si7021_modes[] = {
+	// 12 bit rh (12 ms) and 14 bit t (10.8 ms)
+	[SI7021_RESOLUTION_PRECISION] = {0x00, {0L, 22800000L}},
+	// 10 bit rh (4.5 ms) and 13 bit t (6.2 ms)
+	[SI7021_RESOLUTION_BALANCED] = {0x80, {0L, 10700000L}},
+	// 8 bit rh (3.1 ms) and 12 bit t (3.8 ms)
+	[SI7021_RESOLUTION_LATENCY] = {0x01, {0L, 6900000L}},
+};
+
+// user register of the si7021 behind each multiplexer channel (index 0
+// without multiplexer), -1 if unknown
+static int si7021_user_reg[MUX_CHANNELS + 1] = {
+	[0 ... MUX_CHANNELS] = -1,
+};
+// heater state of SI7021_HEATER_AUTO per sensor
+static uint8_t si7021_heater_on[MUX_CHANNELS + 1];
+
+// sets resolution and heater of the selected si7021, if the user register
+// doesn't hold them already. returns 0 on success, 2 on error
+static int si7021_configure(uint8_t bits) {
+	int *cached = &si7021_user_reg[mux_channel + 1];
+	uint8_t buffer[2];
+
+	if(*cached >= 0 && (*cached & (SI7021_RES_MASK | SI7021_HTRE)) == bits)
+		return 0;
+
+	// after startup and errors, e.g. a power loss of the sensor
+	if(*cached < 0) {
+		buffer[0] = SI7021_READ_USER_REG;
+		if(i2c_write(buffer, 1, &si7021_write_hist) != 1 ||
+				i2c_read(buffer, 1, &si7021_read_hist) != 1)
+			return 2;
+		*cached = buffer[0];
+	}
+
+	buffer[0] = SI7021_WRITE_USER_REG;
+	buffer[1] = (*cached & ~(SI7021_RES_MASK | SI7021_HTRE)) | bits;
+
+	if(i2c_write(buffer, 2, &si7021_write_hist) != 2) {
+		trace(TRACE_SI7021_CONFIG, buffer[1], -1);
+		*cached = -1;
+		return 2;
+	}
+
+	trace(TRACE_SI7021_CONFIG, buffer[1], 0);
+	*cached = buffer[1];
+
+	return 0;
+}
+
+// heater for condensation recovery, decided on the last rh of the sensor
+static int si7021_heater(int mode) {
+	switch(mode) {
+		case SI7021_HEATER_ON:
+			return 1;
+		case SI7021_HEATER_AUTO:
+			return si7021_heater_on[mux_channel + 1];
+		default:
+			return 0;
+	}
+}
+
+static int si7021_measure(uint16_t *temp, uint16_t *rh) {
+	struct iaq_config *conf = get_config();
+	struct timespec conversion_start, conversion_end;
 	int status_write, status_read;
 	// buffer for request
-	uint8_t *buffer_write;
+	uint8_t buffer_write[1];
 	// buffer for response
-	uint8_t *buffer_read;
+	uint8_t buffer_read[3];
 	uint16_t r[2];
 	uint8_t crc;
 	uint8_t write_error_cnt = 0;
 	uint8_t read_error_cnt = 0;
 	uint8_t checksum_error_cnt = 0;
-	uint16_t rh_bytes, temp_bytes;
-	float rh_local = 0;
+	float rh_local;
 	int i;
 	uint8_t success = 0;
 
@@ -176,67 +432,84 @@ int si7021(float *temp, float *rh) {
 	if(openI2c(0x40))
 		return 1;
 
-	buffer_write = malloc(1);
+	// measuring with the previous settings is still better than nothing
+	if(si7021_configure(si7021_modes[conf->si7021_resolution].res_bits |
+				(si7021_heater(conf->si7021_heater) ? SI7021_HTRE : 0)) != 0)
+		log_msg(LOG_WARNING, "failed to configure si7021");
 
 	// according to datasheet:
-	// 0xE5: measure relative humidity with hold master mode (clock stretching
-	// is used)
-	*buffer_write = 0xE5;
+	// 0xF5: measure relative humidity with no hold master mode. the sensor
+	// doesn't respond until the conversion is done, so sleep for the
+	// conversion time of the resolution instead of holding the bus
+	*buffer_write = 0xF5;
 
 	// response is 3 bytes (<> is one byte):
 	// <rh-high-byte> <rh-low-byte> <crc-8>
-	buffer_read = malloc(3);
-
 	do {
+		clock_gettime(CLOCK_MONOTONIC, &conversion_start);
+
 		do {
-			status_write = write(i2c_fd, buffer_write, 1);
+			status_write = i2c_write(buffer_write, 1, &si7021_write_hist);
 
 			if(status_write != 1) {
 				write_error_cnt++;
-				nanosleep(&error_delay, NULL);
+				if(retry_delay(&error_delay) != 0)
+					return MEASUREMENT_DEADLINE;
 			}
 
 		} while(status_write != 1 && write_error_cnt < MAX_ERROR_CNT);
 
-		if(status_write != 1)
+		if(status_write != 1) {
+			si7021_user_reg[mux_channel + 1] = -1;
 			return 2;
+		}
+
+		timed_nanosleep(&si7021_modes[conf->si7021_resolution].conversion);
 
-		// due to clock stretching, clock is low during measurement. read()
-		// will return -1, so do it multiple times
+		// the sensor doesn't acknowledge its address until the measurement
+		// is done, read() will return -1, so do it multiple times
 		do {
-			status_read = read(i2c_fd, buffer_read, 3);
+			status_read = i2c_read(buffer_read, 3, &si7021_read_hist);
 
 			if(status_read != 3) {
 				read_error_cnt++;
-				nanosleep(&error_delay, NULL);
+				if(retry_delay(&error_delay) != 0)
+					return MEASUREMENT_DEADLINE;
 			}
 
 		} while(status_read != 3 && read_error_cnt < MAX_ERROR_CNT);
 
-		if(status_read != 3)
+		if(status_read != 3) {
+			si7021_user_reg[mux_channel + 1] = -1;
 			return 2;
+		}
+
+		// write until the measurement is read, incl. the conversion time
+		clock_gettime(CLOCK_MONOTONIC, &conversion_end);
+		histogram_record(&si7021_rh_conversion_hist,
+			elapsed_us(&conversion_start, &conversion_end));
 
 		crc = crc8(buffer_read, 2);
 
 		// checksum correct
 		if(crc == *(buffer_read+2)) {
-			// calculate rh according to datasheet
-			rh_bytes = (*(buffer_read) << 8) + *(buffer_read+1);
-			rh_local = ((125 * rh_bytes) / 65536) - 6;
-			// according to datasheet, rh value may be slightly negative or
-			// slightly bigger than 100% which is no error and shall be rounded
-			if(rh_local < 0)
-				*rh = 0;
-			else if(rh_local > 100)
-				*rh = 100;
-			else
-				*rh = rh_local;
+			*rh = (*(buffer_read) << 8) + *(buffer_read+1);
+			rh_local = si7021_rh(*rh);
 			success = 1;
+
+			// condensation: heat until the sensor has dried
+			if(rh_local >= SI7021_HEATER_ON_RH)
+				si7021_heater_on[mux_channel + 1] = 1;
+			else if(rh_local < SI7021_HEATER_OFF_RH)
+				si7021_heater_on[mux_channel + 1] = 0;
 		}
 
 		else {
 			checksum_error_cnt++;
-			nanosleep(&error_delay, NULL);
+			i2c_retries++;
+			trace(TRACE_CHECKSUM_ERROR, i2c_address, *(buffer_read+2));
+			if(retry_delay(&error_delay) != 0)
+				return MEASUREMENT_DEADLINE;
 		}
 
 	} while(!success && checksum_error_cnt < MAX_ERROR_CNT);
@@ -259,11 +532,12 @@ int si7021(float *temp, float *rh) {
 		read_error_cnt = 0;
 		checksum_error_cnt = 0;
 		do {
-			status_write = write(i2c_fd, buffer_write, 1);
+			status_write = i2c_write(buffer_write, 1, &si7021_write_hist);
 
 			if(status_write != 1) {
 				write_error_cnt++;
-				nanosleep(&error_delay, NULL);
+				if(retry_delay(&error_delay) != 0)
+					return MEASUREMENT_DEADLINE;
 			}
 
 		} while(status_write != 1 && write_error_cnt < MAX_ERROR_CNT);
@@ -271,15 +545,16 @@ int si7021(float *temp, float *rh) {
 		if(status_write != 1)
 			return 2;
 
-		// due to clock stretching, clock is low during measurement.
-		// read() will return -1, so do it multiple times
-		// shouldn't occur here as 0xE0 does not imply a measurement
+		// 0xE0 returns the temperature of the last rh measurement and does
+		// not start a conversion, so the sensor answers right away. the
+		// retries only cover bus errors
 		do {
-			status_read = read(i2c_fd, buffer_read, 2);
+			status_read = i2c_read(buffer_read, 2, &si7021_read_hist);
 
 			if(status_read != 2) {
 				read_error_cnt++;
-				nanosleep(&error_delay, NULL);
+				if(retry_delay(&error_delay) != 0)
+					return MEASUREMENT_DEADLINE;
 			}
 
 		} while(status_read != 2 && read_error_cnt < MAX_ERROR_CNT);
@@ -287,8 +562,7 @@ int si7021(float *temp, float *rh) {
 		if(status_read != 2)
 			return 2;
 
-		temp_bytes = (*(buffer_read) << 8) + *(buffer_read+1);
-		*temp = ((175.72 * temp_bytes) / 65536) - 46.85;
+		*temp = (*(buffer_read) << 8) + *(buffer_read+1);
 
 		return 0;
 	}
@@ -18,8 +18,17 @@
 #ifndef _IAQ_MEASUREMENTD_MEASUREMENT_H_
 #define _IAQ_MEASUREMENTD_MEASUREMENT_H_
 
-int CO2(int *co2);
-int si7021(float *temp, float *rh);
+#include <time.h>
+
+// status of CO2() and si7021() if the deadline of the cycle passed before
+// the measurement could be completed
+#define MEASUREMENT_DEADLINE 3
+
+int mux_select(int address, int channel);
+void measurement_deadline(const struct timespec *end);
+int deadline_passed();
+int CO2(uint16_t *co2);
+int si7021(uint16_t *temp, uint16_t *rh);
 
 uint8_t crc8(const void *vptr, int len);
 
@@ -16,6 +16,7 @@
  */
 
 #include <wiringPi.h>
+#include <stdio.h>
 #include <syslog.h>
 #include <string.h>
 #include <stdlib.h>
@@ -24,202 +25,368 @@
 #include <fcntl.h>
 #include <curl/curl.h>
 #include <time.h>
+#include <limits.h>
 
 #include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "led.h"
 #include "output.h"
-
-// LED-pin setup
+#include "upload.h"
+#include "trace.h"
+#include "gpio.h"
+#include "tls.h"
+#include "log.h"
+#include "resources.h"
+#include "schedule.h"
+#include "health.h"
+
+// line request of the gpio-cdev backend, -1 with wiringPi. the lines are
+// indexed like room_pin()
+static int led_fd = -1;
+
+// LED-pin setup of all rooms
 void inipin() {
+	struct iaq_config *conf = get_config();
+	unsigned int offsets[MAX_ROOMS * 3];
+	int i;
+
+	if(conf->led_backend == LED_BACKEND_GPIO_CDEV) {
+		for(i = 0; i < conf->nrooms * 3; i++)
+			offsets[i] = room_pin(conf, i);
+
+		led_fd = gpio_request_outputs(conf->gpio_chip, offsets,
+				conf->nrooms * 3);
+		if(led_fd < 0) {
+			log_msg(LOG_ERR, "failed to setup LED pins. terminating");
+			terminate(EXIT_FAILURE);
+		}
+
+		return;
+	}
+
 	if(wiringPiSetup() == -1) {
-		syslog(LOG_ERR, "failed to setup wiringPi: %m. terminating");
+		log_msg(LOG_ERR, "failed to setup wiringPi: %m. terminating");
 		terminate(EXIT_FAILURE);
 	}
 
-	pinMode(green_pin, OUTPUT);
-	pinMode(yellow_pin, OUTPUT);
-	pinMode(red_pin, OUTPUT);
-
-	digitalWrite(green_pin, LOW);
-	digitalWrite(yellow_pin, LOW);
-	digitalWrite(red_pin, LOW);
+	for(i = 0; i < conf->nrooms * 3; i++) {
+		pinMode(room_pin(conf, i), OUTPUT);
+		digitalWrite(room_pin(conf, i), LOW);
+	}
 }
 
-// controls the LEDs based on co2, temp, rh and old led_state
-// returns the new LED state
-int LEDsystem(int co2, float temp, float rh, int led_state) {
-	if((led_state == RED && co2 > (co2_threshold_red - co2_hysteresis)) ||
-			(led_state == YELLOW && co2 > co2_threshold_red) ||
-			(led_state == OFF && co2 > co2_threshold_red)) {
-
-		// avoid unnecessary calls
-		if(led_state != RED) {
-			digitalWrite(green_pin, LOW);
-			digitalWrite(yellow_pin, LOW);
-			digitalWrite(red_pin, HIGH);
-		}
+// switches on the LED of led_state in room and the others off
+void set_leds(int room, int led_state) {
+	struct room_config *room_conf = &get_config()->rooms[room];
+
+	// the three lines of the room are set at once
+	if(led_fd >= 0) {
+		if(gpio_set_values(led_fd, led_state == OFF ? 0 :
+					1ULL << (room * 3 + led_state - GREEN),
+					7ULL << (room * 3)) != 0)
+			log_msg(LOG_WARNING, "failed to set LEDs of room %s: %m",
+					room_conf->room);
+		return;
+	}
 
-		return RED;
+	digitalWrite(room_conf->green_pin, led_state == GREEN ? HIGH : LOW);
+	digitalWrite(room_conf->yellow_pin, led_state == YELLOW ? HIGH : LOW);
+	digitalWrite(room_conf->red_pin, led_state == RED ? HIGH : LOW);
+}
 
-	} else if((led_state == YELLOW && co2 < (co2_threshold_yellow -
-			co2_hysteresis)) ||
-			(led_state == GREEN && co2 < co2_threshold_yellow) ||
-			(led_state == OFF && co2 < co2_threshold_yellow)) {
+// switches off the LEDs of all rooms, on termination
+void leds_off(struct iaq_config *conf) {
+	int i;
 
-		if(led_state != GREEN) {
-			digitalWrite(green_pin, HIGH);
-			digitalWrite(yellow_pin, LOW);
-			digitalWrite(red_pin, LOW);
-		}
+	if(led_fd >= 0) {
+		gpio_set_values(led_fd, 0, ~0ULL);
+		return;
+	}
 
-		return GREEN;
+	for(i = 0; i < conf->nrooms * 3; i++)
+		digitalWrite(room_pin(conf, i), LOW);
+}
 
-	} else {
+// path of the state or threshold file of room, or of the directory of these
+// files if file is NULL. the first room uses PKGSTATEDIR itself, so single
+// room setups keep their paths. returns 0 on success, -1 if the path does
+// not fit into len
+static int room_state_path(int room, const char *file, char *path,
+		size_t len) {
+	int n;
 
-		if(led_state != YELLOW) {
-			digitalWrite(green_pin, LOW);
-			digitalWrite(yellow_pin, HIGH);
-			digitalWrite(red_pin, LOW);
-		}
+	if(room == 0)
+		n = snprintf(path, len, "%s", PKGSTATEDIR);
+	else
+		n = snprintf(path, len, PKGSTATEDIR "/room%d", room);
 
-		return YELLOW;
+	if(n >= 0 && n < len && file != NULL)
+		n += snprintf(path + n, len - n, "/%s", file);
 
-	}
+	return n >= 0 && n < len ? 0 : -1;
 }
 
-void http_log(int co2, float temp, float rh, int led_state) {
-	CURL *curl;
-	CURLcode res;
-	char *url, *room_escaped;
-	size_t url_len;
-	int status;
+// controls the LEDs of room based on the latest co2, temp and rh of sample,
+// which may have been measured in different cycles, and old led_state.
+// states are the LED states of the single metrics for LED_COMBINE_WORST and
+// are updated. returns the new LED state
+int LEDsystem(int room, const struct sample *sample, int led_state,
+		int states[LED_METRICS]) {
+	struct iaq_config *conf = get_config();
+	struct room_config *room_conf = &conf->rooms[room];
+	int new_state;
+
+	// metrics never measured don't count. stale ones are the latest
+	// values known and do
+	if((sample->quality & SAMPLE_CO2_MISSING) &&
+			(conf->led_combine == LED_COMBINE_CO2 ||
+			 (sample->quality & SAMPLE_TEMP_RH_MISSING)))
+		return led_state;
+
+	if(conf->led_combine == LED_COMBINE_CO2)
+		new_state = led_step(room_conf->led_table[LED_METRIC_CO2], led_state,
+				sample->co2);
 
-	curl = curl_easy_init();
+	else {
+		if(!(sample->quality & SAMPLE_CO2_MISSING))
+			states[LED_METRIC_CO2] = led_step(
+					room_conf->led_table[LED_METRIC_CO2],
+					states[LED_METRIC_CO2], sample->co2);
+
+		if(!(sample->quality & SAMPLE_TEMP_RH_MISSING)) {
+			states[LED_METRIC_TEMP] = led_step(
+					room_conf->led_table[LED_METRIC_TEMP],
+					states[LED_METRIC_TEMP], sample->temp);
+			states[LED_METRIC_RH] = led_step(
+					room_conf->led_table[LED_METRIC_RH],
+					states[LED_METRIC_RH], sample->rh);
+		}
 
-	if(curl == NULL) {
-		syslog(LOG_ERR, "failed to curl_easy_init(). terminating");
-		terminate(EXIT_FAILURE);
+		// the states are ordered from OFF to RED
+		new_state = states[LED_METRIC_CO2];
+		new_state = states[LED_METRIC_TEMP] > new_state ?
+			states[LED_METRIC_TEMP] : new_state;
+		new_state = states[LED_METRIC_RH] > new_state ?
+			states[LED_METRIC_RH] : new_state;
 	}
 
-	room_escaped = curl_easy_escape(curl, room, 0);
-
-	if(room_escaped == NULL) {
-		syslog(LOG_ERR, "failed to curl_easy_escape(). terminating");
-		terminate(EXIT_FAILURE);
+	// avoid unnecessary calls
+	if(new_state != led_state) {
+		trace(TRACE_LED_STATE, room << 8 | led_state, new_state);
+		set_leds(room, new_state);
 	}
 
-	// length of host + length of room_escaped + 200 extra bytes (data are 80
-	// + length of http:// and device_interface.php + buffer)
-	url_len = strlen(host) + strlen(room_escaped) + 300;
-	url = malloc(url_len);
-
-	status = snprintf(url, url_len, "http://%s/device_interface.php?action=log"
-			"&room=%s&co2=%d&temp=%.2f&rh=%.2f&led_state=%d", host,
-			room_escaped, co2, temp, rh, led_state);
+	return new_state;
+}
 
-	if(status < 0) {
-		syslog(LOG_ERR, "failed to snprintf the logging-server url. terminating"
-			);
-		terminate(EXIT_FAILURE);
-	}
+// handle of the logging thread, the connection is reused for all rooms
+static CURL *logger_curl;
 
+// returns 0 if the server received the measurement of room, -1 otherwise
+int http_log(int room, int co2, float temp, float rh, int led_state) {
+	struct iaq_config *conf = get_config();
+	char resources[RESOURCE_QUERY_LEN];
+	CURLcode res;
 
-	else {
-		curl_easy_setopt(curl, CURLOPT_URL, url);
+	if(logger_curl == NULL) {
+		if((logger_curl = curl_easy_init()) == NULL) {
+			log_msg(LOG_ERR, "failed to curl_easy_init(). terminating");
+			terminate(EXIT_FAILURE);
+		}
+		tls_setup_handle(logger_curl);
+	}
 
-		if(res = curl_easy_perform(curl) != CURLE_OK)
-			syslog(LOG_WARNING, "could not send measurement data to the logging"
-					"-server. %s%.", curl_easy_strerror(res));
+	resources_query(resources, sizeof(resources));
 
-		curl_easy_cleanup(curl);
+	trace(TRACE_UPLOAD_START, room, co2);
+	res = http_send(logger_curl, conf, conf->rooms[room].room, co2, temp, rh,
+			led_state, resources);
+	trace(TRACE_UPLOAD_END, room, res);
 
-		free(url);
-		curl_free(room_escaped);
-	}
+	return res == CURLE_OK ? 0 : -1;
 }
 
-void write_state_files() {
-	FILE *co2_file, *temp_file, *rh_file, *led_state_file;
-	FILE *co2_threshold_yellow_file, *co2_threshold_red_file;
-	FILE *co2_hysteresis_file;
+// names of the state files, one set per room
+static const char *state_file_names[] = {
+	"co2", "temp", "rh", "led_state", "co2_health", "temp_rh_health",
+};
+
+#define STATE_FILES (sizeof(state_file_names) / sizeof(state_file_names[0]))
+
+// names of the threshold files, one set per room
+static const char *threshold_file_names[] = {
+	"co2_threshold_yellow", "co2_threshold_red", "co2_hysteresis",
+	"temp_threshold_yellow", "temp_threshold_red", "temp_hysteresis",
+	"rh_threshold_yellow", "rh_threshold_red", "rh_hysteresis",
+};
+
+#define THRESHOLD_FILES \
+	(sizeof(threshold_file_names) / sizeof(threshold_file_names[0]))
+
+// state files are kept open, so a cycle costs one pwrite() and one
+// ftruncate() per file instead of a stat(), open(), write() and close()
+static int state_fds[MAX_ROOMS][STATE_FILES] = {
+	[0 ... MAX_ROOMS - 1] = {[0 ... STATE_FILES - 1] = -1},
+};
+
+static void write_state_file(int room, int file, const char *buffer,
+		int len) {
+	char path[PATH_MAX];
+	int *fd = &state_fds[room][file];
+
+	if(*fd < 0) {
+		if(room_state_path(room, state_file_names[file], path,
+					sizeof(path)) != 0) {
+			log_msg(LOG_ERR, "path of state file %s of room %d too long. "
+					"terminating", state_file_names[file], room);
+			terminate(EXIT_FAILURE);
+		}
 
-	struct stat st;
+		*fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
 
-	if(stat(PKGSTATEDIR, &st) == -1) {
-		if(mkdir(PKGSTATEDIR, 0755) == -1)
-			syslog(LOG_ERR, "failed to create directory " PKGSTATEDIR
-					". terminating");
+		if(*fd < 0) {
+			log_msg(LOG_ERR, "failed to open file %s. %m. terminating", path);
 			terminate(EXIT_FAILURE);
+		}
 	}
 
-	co2_file = fopen(PKGSTATEDIR "/co2", "w");
-
-	if(co2_file == NULL) {
-		syslog(LOG_ERR, "failed to open file " PKGSTATEDIR "/co2."
-				" %m. terminating");
+	// a shorter value leaves a stray newline until the truncate, which
+	// doesn't disturb readers parsing a number
+	if(pwrite(*fd, buffer, len, 0) != len) {
+		log_msg(LOG_ERR, "failed to write to state file %s of room %d. %m. "
+				"terminating", state_file_names[file], room);
 		terminate(EXIT_FAILURE);
 	}
 
-	else {
-		if(fprintf(co2_file, "%d\n", co2) < 0) {
-			syslog(LOG_ERR, "failed to write to file " PKGSTATEDIR "/co2."
-					" %m. terminating");
-			fclose(co2_file);
-			terminate(EXIT_FAILURE);
-			}
-		fclose(co2_file);
+	if(ftruncate(*fd, len) == -1) {
+		log_msg(LOG_ERR, "failed to truncate state file %s of room %d. %m. "
+				"terminating", state_file_names[file], room);
+		terminate(EXIT_FAILURE);
 	}
+}
 
-	temp_file = fopen(PKGSTATEDIR "/temp", "w");
+// the directories have been created by write_threshold_files() at startup.
+// called by the measurement thread, the only one changing room_states
+void write_state_files(int room) {
+	struct room_state *state = &room_states[room];
+	char buffer[32];
+	int len;
 
-	if(temp_file == NULL) {
-		syslog(LOG_ERR, "failed to open file " PKGSTATEDIR "/temp."
-				" %m. terminating");
-		terminate(EXIT_FAILURE);
-	}
+	len = snprintf(buffer, sizeof(buffer), "%d\n", state->co2);
+	write_state_file(room, 0, buffer, len);
 
-	else {
-		if(fprintf(temp_file, "%.2f\n", temp) < 0) {
-			syslog(LOG_ERR, "failed to write to file " PKGSTATEDIR "/temp."
-					" %m");
-			fclose(temp_file);
-			terminate(EXIT_FAILURE);
-		}
-		fclose(temp_file);
-	}
+	len = snprintf(buffer, sizeof(buffer), "%.2f\n", state->temp);
+	write_state_file(room, 1, buffer, len);
 
-	rh_file = fopen(PKGSTATEDIR "/rh", "w");
+	len = snprintf(buffer, sizeof(buffer), "%.2f\n", state->rh);
+	write_state_file(room, 2, buffer, len);
 
-	if(rh_file == NULL) {
-		syslog(LOG_ERR, "failed to open file " PKGSTATEDIR "/rh."
-				" %m. terminating");
-		terminate(EXIT_FAILURE);
-	}
+	len = snprintf(buffer, sizeof(buffer), "%d\n", state->led_state);
+	write_state_file(room, 3, buffer, len);
 
-	else {
-		if(fprintf(rh_file, "%.2f\n", rh) < 0) {
-			syslog(LOG_ERR, "failed to write to file " PKGSTATEDIR "/rh."
-					" %m");
-			fclose(rh_file);
-			terminate(EXIT_FAILURE);
+	len = snprintf(buffer, sizeof(buffer), "%s\n",
+			health_name(room, SENSOR_K30));
+	write_state_file(room, 4, buffer, len);
+
+	len = snprintf(buffer, sizeof(buffer), "%s\n",
+			health_name(room, SENSOR_SI7021));
+	write_state_file(room, 5, buffer, len);
+}
+
+// writes the thresholds of conf to PKGSTATEDIR, for use by other programs.
+// returns 0 on success, -1 if a file could not be written
+int write_threshold_files(struct iaq_config *conf) {
+	FILE *threshold_file;
+	struct room_config *room;
+	struct stat st;
+	char path[PATH_MAX];
+	int i, j, status;
+
+	for(i = 0; i < conf->nrooms; i++) {
+		room = &conf->rooms[i];
+
+		// in the order of threshold_file_names
+		struct {
+			int is_float;
+			int int_value;
+			float float_value;
+		} thresholds[THRESHOLD_FILES] = {
+			{0, room->co2_threshold_yellow, 0},
+			{0, room->co2_threshold_red, 0},
+			{0, room->co2_hysteresis, 0},
+			{1, 0, room->temp_threshold_yellow},
+			{1, 0, room->temp_threshold_red},
+			{1, 0, room->temp_hysteresis},
+			{1, 0, room->rh_threshold_yellow},
+			{1, 0, room->rh_threshold_red},
+			{1, 0, room->rh_hysteresis},
+		};
+
+		if(room_state_path(i, NULL, path, sizeof(path)) != 0) {
+			log_msg(LOG_ERR, "path of state directory of room %d too long",
+					i);
+			return -1;
 		}
-		fclose(rh_file);
-	}
 
-	led_state_file = fopen(PKGSTATEDIR "/led_state", "w");
+		// directory exists? if not, try to create it
+		if(stat(path, &st) == -1) {
+			if(mkdir(path, 0755) == -1) {
+				log_msg(LOG_ERR, "failed to create directory %s. %m", path);
+				return -1;
+			}
+		}
 
-	if(led_state_file == NULL) {
-		syslog(LOG_ERR, "failed to open file " PKGSTATEDIR "/led_state."
-				" %m. terminating");
-		terminate(EXIT_FAILURE);
-	}
+		for(j = 0; j < THRESHOLD_FILES; j++) {
+			if(room_state_path(i, threshold_file_names[j], path,
+						sizeof(path)) != 0) {
+				log_msg(LOG_ERR, "path of threshold file %s of room %d too "
+						"long", threshold_file_names[j], i);
+				return -1;
+			}
 
-	else {
-		if(fprintf(led_state_file, "%d\n", led_state) < 0) {
-			syslog(LOG_ERR, "failed to write to file " PKGSTATEDIR "/led_state."
-					" %m");
-			fclose(led_state_file);
-			terminate(EXIT_FAILURE);
+			threshold_file = fopen(path, "w");
+
+			if(threshold_file == NULL) {
+				log_msg(LOG_ERR, "failed to open file %s. %m", path);
+				return -1;
+			}
+
+			if(thresholds[j].is_float)
+				status = fprintf(threshold_file, "%f\n",
+						thresholds[j].float_value);
+			else
+				status = fprintf(threshold_file, "%d\n",
+						thresholds[j].int_value);
+
+			// the value is only written out by fclose()
+			if(fclose(threshold_file) != 0 || status < 0) {
+				log_msg(LOG_ERR, "failed to write to file %s. %m", path);
+				return -1;
+			}
 		}
-		fclose(led_state_file);
+	}
+
+	return 0;
+}
+
+// removes the state and threshold files of nrooms rooms, ignoring errors
+void remove_state_files(int nrooms) {
+	char path[PATH_MAX];
+	int i, j;
+
+	// a path too long was never created
+	for(i = 0; i < nrooms; i++) {
+		for(j = 0; j < STATE_FILES; j++)
+			if(room_state_path(i, state_file_names[j], path,
+						sizeof(path)) == 0)
+				remove(path);
+
+		for(j = 0; j < THRESHOLD_FILES; j++)
+			if(room_state_path(i, threshold_file_names[j], path,
+						sizeof(path)) == 0)
+				remove(path);
+
+		if(i > 0 && room_state_path(i, NULL, path, sizeof(path)) == 0)
+			rmdir(path);
 	}
 }
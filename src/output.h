@@ -18,9 +18,19 @@
 #ifndef _IAQ_MEASUREMENTD_OUTPUT_H_
 #define _IAQ_MEASUREMENTD_OUTPUT_H_
 
+#include <curl/curl.h>
+
+#include "config-parser.h"
+#include "history.h"
+
 void inipin();
-int LEDsystem(int co2, float temp, float rh, int led_state);
-void http_log(int co2, float temp, float rh, int led_state);
-void write_state_files();
+void set_leds(int room, int led_state);
+void leds_off(struct iaq_config *conf);
+int LEDsystem(int room, const struct sample *sample, int led_state,
+		int states[LED_METRICS]);
+int http_log(int room, int co2, float temp, float rh, int led_state);
+void write_state_files(int room);
+int write_threshold_files(struct iaq_config *conf);
+void remove_state_files(int nrooms);
 
 #endif
@@ -0,0 +1,118 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/phase.c
+ *
+ * Spreads the uploads of a fleet over the logging interval. Every device
+ * uploads at a fixed offset into the interval, derived from its room names
+ * and MAC address, instead of at the time it was started. After a power
+ * failure of a building, its devices would otherwise hit the server in the
+ * same second, every interval
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <syslog.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netpacket/packet.h>
+
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "phase.h"
+#include "log.h"
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len) {
+	const uint8_t *p = data;
+
+	while(len--) {
+		hash ^= *p++;
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+// the lowest hardware address of the non-loopback interfaces, so the result
+// doesn't depend on the order of the interfaces. returns 0 on success
+static int lowest_mac(uint8_t mac[8], unsigned int *len) {
+	struct ifaddrs *ifaddrs, *ifa;
+	struct sockaddr_ll *sll;
+	int found = 0;
+
+	if(getifaddrs(&ifaddrs) == -1)
+		return -1;
+
+	for(ifa = ifaddrs; ifa != NULL; ifa = ifa->ifa_next) {
+		if(ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_PACKET ||
+				(ifa->ifa_flags & IFF_LOOPBACK))
+			continue;
+
+		sll = (struct sockaddr_ll *)ifa->ifa_addr;
+		if(sll->sll_halen == 0 || sll->sll_halen > 8)
+			continue;
+
+		if(!found || sll->sll_halen < *len || (sll->sll_halen == *len &&
+					memcmp(sll->sll_addr, mac, *len) < 0)) {
+			memcpy(mac, sll->sll_addr, sll->sll_halen);
+			*len = sll->sll_halen;
+			found = 1;
+		}
+	}
+
+	freeifaddrs(ifaddrs);
+
+	return found ? 0 : -1;
+}
+
+// hash identifying the device, the rooms can't be changed by a reload
+uint32_t upload_identity(struct iaq_config *conf) {
+	uint32_t hash = FNV_OFFSET_BASIS;
+	uint8_t mac[8];
+	unsigned int len = 0;
+	int i;
+
+	// room names are unique within a building, the MAC tells apart devices
+	// with the same room names in different buildings
+	for(i = 0; i < conf->nrooms; i++)
+		hash = fnv1a(hash, conf->rooms[i].room,
+				strlen(conf->rooms[i].room) + 1);
+
+	if(lowest_mac(mac, &len) == 0)
+		hash = fnv1a(hash, mac, len);
+	else
+		log_msg(LOG_INFO, "no MAC address found. the upload phase is "
+				"derived from the room names only");
+
+	return hash;
+}
+
+// the next CLOCK_REALTIME after now at which the device with identity
+// uploads. the slots are aligned to the epoch, so devices with synchronized
+// clocks stay spread when the interval is changed by a reload
+void next_upload_slot(uint32_t identity, time_t interval,
+		struct timespec *slot) {
+	long long interval_ms = (long long)interval * 1000;
+	long long phase_ms = identity % interval_ms;
+	long long now_ms, slot_ms;
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	now_ms = (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+
+	slot_ms = (now_ms - phase_ms) / interval_ms * interval_ms + phase_ms;
+	if(slot_ms <= now_ms)
+		slot_ms += interval_ms;
+
+	slot->tv_sec = slot_ms / 1000;
+	slot->tv_nsec = slot_ms % 1000 * 1000000;
+}
@@ -0,0 +1,34 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/phase.h
+ *
+ * Header file for the upload phase of the logging thread
+ */
+
+#ifndef _IAQ_MEASUREMENTD_PHASE_H_
+#define _IAQ_MEASUREMENTD_PHASE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "config-parser.h"
+
+// 32 bit FNV-1a
+#define FNV_OFFSET_BASIS 0x811C9DC5
+#define FNV_PRIME 0x01000193
+
+uint32_t upload_identity(struct iaq_config *conf);
+void next_upload_slot(uint32_t identity, time_t interval,
+		struct timespec *slot);
+
+#endif
@@ -0,0 +1,117 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/publish.c
+ *
+ * Publishes every sample as a multicast datagram (see wire.h), so any number
+ * of consumers on the LAN can follow the measurements at no extra cost to
+ * the device. Samples are queued by the measurement thread after each room
+ * and sent with one sendmmsg() per cycle
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "publish.h"
+#include "wire.h"
+#include "log.h"
+
+// connected to the multicast group, -1 if publishing is disabled
+static int publish_fd = -1;
+
+// samples of the current cycle, sent by publish_flush()
+static struct wire_sample datagrams[MAX_ROOMS];
+static struct iovec iov[MAX_ROOMS];
+static struct mmsghdr msgs[MAX_ROOMS];
+static unsigned int queued;
+
+// per room, so consumers can detect lost datagrams
+static uint32_t publish_seq[MAX_ROOMS];
+
+// a failing send is logged once until sending works again
+static int send_failed;
+
+// connects the socket to the group of conf. called once at startup, later
+// changes of the multicast settings need a restart
+void publish_open(struct iaq_config *conf) {
+	int ttl = conf->multicast_ttl;
+	int i;
+
+	if(conf->multicast_group == NULL)
+		return;
+
+	if((publish_fd = udp_connect(conf->multicast_group,
+					conf->multicast_port)) < 0) {
+		log_msg(LOG_WARNING, "failed to set up multicast publishing to %s. "
+				"continuing without it", conf->multicast_group);
+		return;
+	}
+
+	// one of them fails, depending on the address family of the group
+	setsockopt(publish_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+	setsockopt(publish_fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl,
+			sizeof(ttl));
+
+	for(i = 0; i < MAX_ROOMS; i++) {
+		iov[i].iov_base = &datagrams[i];
+		iov[i].iov_len = sizeof(datagrams[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	log_msg(LOG_INFO, "publishing samples to %s port %d",
+			conf->multicast_group, conf->multicast_port);
+}
+
+// queues the sample of room, called by the measurement thread right after
+// the LEDs are updated
+void publish_add(int room, const struct sample *sample) {
+	if(publish_fd < 0)
+		return;
+
+	wire_encode(&datagrams[queued], get_config()->rooms[room].room,
+			publish_seq[room]++, sample);
+	queued++;
+}
+
+// sends the queued samples. the socket is not waited for, a datagram that
+// doesn't fit the send buffer is lost like any other UDP datagram
+void publish_flush() {
+	int sent;
+
+	if(queued == 0)
+		return;
+
+	sent = sendmmsg(publish_fd, msgs, queued, MSG_DONTWAIT);
+
+	if(sent < (int)queued) {
+		if(!send_failed && sent < 0)
+			log_msg(LOG_WARNING, "failed to publish samples: %m");
+		else if(!send_failed)
+			log_msg(LOG_WARNING, "failed to publish %u of %u samples",
+					queued - sent, queued);
+		send_failed = 1;
+	}
+
+	else if(send_failed) {
+		log_msg(LOG_INFO, "publishing samples again");
+		send_failed = 0;
+	}
+
+	queued = 0;
+}
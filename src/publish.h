@@ -0,0 +1,32 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/publish.h
+ *
+ * Header file for the multicast publisher
+ */
+
+#ifndef _IAQ_MEASUREMENTD_PUBLISH_H_
+#define _IAQ_MEASUREMENTD_PUBLISH_H_
+
+#include "config-parser.h"
+#include "history.h"
+
+#define DEFAULT_MULTICAST_PORT 4471
+// hops of published datagrams, 1 keeps them in the local network
+#define DEFAULT_MULTICAST_TTL 1
+
+void publish_open(struct iaq_config *conf);
+void publish_add(int room, const struct sample *sample);
+void publish_flush();
+
+#endif
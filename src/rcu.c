@@ -0,0 +1,74 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/rcu.c
+ *
+ * Quiescent state based reclamation. Readers pay one atomic load per access,
+ * the (rare) writer waits for all readers to pass a quiescent state before
+ * freeing old data.
+ */
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "rcu.h"
+#include "iaq-measurementd.h"
+#include "log.h"
+
+// grace period counter, readers copy it when passing a quiescent state
+static atomic_ulong rcu_gp_ctr = 1;
+// last grace period seen by each reader, 0 if the reader is offline
+static atomic_ulong rcu_reader_ctr[RCU_MAX_THREADS];
+static atomic_int rcu_nthreads;
+
+static __thread int rcu_slot = -1;
+
+void rcu_register_thread() {
+	rcu_slot = atomic_fetch_add(&rcu_nthreads, 1);
+
+	if(rcu_slot >= RCU_MAX_THREADS) {
+		log_msg(LOG_ERR, "too many rcu reader threads. terminating");
+		terminate(EXIT_FAILURE);
+	}
+
+	rcu_thread_online();
+}
+
+void rcu_quiescent_state() {
+	atomic_store(&rcu_reader_ctr[rcu_slot], atomic_load(&rcu_gp_ctr));
+	// later loads of protected pointers must not be reordered before the store
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+void rcu_thread_offline() {
+	atomic_store(&rcu_reader_ctr[rcu_slot], 0);
+}
+
+void rcu_thread_online() {
+	rcu_quiescent_state();
+}
+
+void synchronize_rcu() {
+	struct timespec poll_delay = {0L, RCU_POLL_DELAY};
+	unsigned long gp, ctr;
+	int i, nthreads;
+
+	gp = atomic_fetch_add(&rcu_gp_ctr, 1) + 1;
+	nthreads = atomic_load(&rcu_nthreads);
+
+	for(i = 0; i < nthreads && i < RCU_MAX_THREADS; i++) {
+		while((ctr = atomic_load(&rcu_reader_ctr[i])) != 0 && ctr < gp)
+			nanosleep(&poll_delay, NULL);
+	}
+}
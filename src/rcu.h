@@ -0,0 +1,39 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/rcu.h
+ *
+ * Header file for the quiescent state based reclamation of shared data
+ */
+
+#ifndef _IAQ_MEASUREMENTD_RCU_H_
+#define _IAQ_MEASUREMENTD_RCU_H_
+
+// maximum number of threads reading rcu protected data
+#define RCU_MAX_THREADS 8
+
+// delay between polls of the readers in synchronize_rcu()
+#define RCU_POLL_DELAY 10000000L // in ns
+
+// readers register once, announce a quiescent state whenever they hold no
+// reference to protected data and go offline around blocking calls, so
+// writers don't have to wait for them
+void rcu_register_thread();
+void rcu_quiescent_state();
+void rcu_thread_offline();
+void rcu_thread_online();
+
+// waits until every reader passed a quiescent state, after that data
+// unpublished before the call can be freed
+void synchronize_rcu();
+
+#endif
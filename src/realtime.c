@@ -0,0 +1,121 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/realtime.c
+ *
+ * Real-time scheduling of the measurement thread, so the k-30 wake-up and
+ * response delays are met on busy systems
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "realtime.h"
+#include "stats.h"
+#include "log.h"
+
+// touches one byte per page of RT_STACK_PREFAULT bytes of stack, so they are
+// locked by mlockall() before the first deep call. the stores are volatile,
+// a memset() of a buffer never read again would be optimized out
+static void prefault_stack() {
+	volatile unsigned char stack[RT_STACK_PREFAULT];
+	long page_size = sysconf(_SC_PAGESIZE);
+	size_t i;
+
+	for(i = 0; i < sizeof(stack); i += page_size)
+		stack[i] = 0;
+}
+
+// switches the calling thread to SCHED_FIFO if enabled in conf. failures are
+// not fatal, the daemon works without real-time scheduling as well
+void setup_realtime(struct iaq_config *conf) {
+	struct sched_param param;
+	cpu_set_t cpus;
+	int status;
+
+	if(!conf->realtime)
+		return;
+
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+		log_msg(LOG_WARNING, "realtime: failed to mlockall: %m");
+
+	prefault_stack();
+
+	if(prctl(PR_SET_TIMERSLACK, RT_TIMER_SLACK, 0, 0, 0) == -1)
+		log_msg(LOG_WARNING, "realtime: failed to set timer slack: %m");
+
+	if(conf->realtime_cpu >= 0) {
+		if(conf->realtime_cpu >= sysconf(_SC_NPROCESSORS_CONF))
+			log_msg(LOG_WARNING, "realtime: cpu %d does not exist. not "
+				"pinning the measurement thread", conf->realtime_cpu);
+
+		else {
+			CPU_ZERO(&cpus);
+			CPU_SET(conf->realtime_cpu, &cpus);
+
+			status = pthread_setaffinity_np(pthread_self(), sizeof(cpus),
+				&cpus);
+			if(status != 0)
+				log_msg(LOG_WARNING, "realtime: failed to pin measurement "
+					"thread to cpu %d: %s", conf->realtime_cpu,
+					strerror(status));
+		}
+	}
+
+	param.sched_priority = conf->realtime_priority;
+
+	status = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if(status != 0) {
+		log_msg(LOG_WARNING, "realtime: failed to set SCHED_FIFO: %s",
+			strerror(status));
+		return;
+	}
+
+	log_msg(LOG_INFO, "realtime: measurement thread running with SCHED_FIFO "
+		"priority %d", conf->realtime_priority);
+}
+
+uint32_t elapsed_us(const struct timespec *start, const struct timespec *end) {
+	long long us;
+
+	us = (end->tv_sec - start->tv_sec) * 1000000LL +
+		(end->tv_nsec - start->tv_nsec) / 1000;
+
+	return us < 0 ? 0 : (uint32_t)us;
+}
+
+// nanosleep() that records how much later than requested it returned
+int timed_nanosleep(const struct timespec *req) {
+	struct timespec start, end;
+	uint32_t slept, requested;
+	int status;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	status = nanosleep(req, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if(status == 0) {
+		slept = elapsed_us(&start, &end);
+		requested = req->tv_sec * 1000000 + req->tv_nsec / 1000;
+		histogram_record(&sleep_overshoot_hist,
+			slept > requested ? slept - requested : 0);
+	}
+
+	return status;
+}
@@ -0,0 +1,37 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/realtime.h
+ *
+ * Header file for the real-time scheduling mode
+ */
+
+#ifndef _IAQ_MEASUREMENTD_REALTIME_H_
+#define _IAQ_MEASUREMENTD_REALTIME_H_
+
+#include <time.h>
+#include <stdint.h>
+
+#include "config-parser.h"
+
+// stack touched once in real-time mode so it is resident before mlockall()
+// pins it
+#define RT_STACK_PREFAULT (64 * 1024) // in bytes
+
+// timer slack of the measurement thread in real-time mode
+#define RT_TIMER_SLACK 1L // in ns
+
+void setup_realtime(struct iaq_config *conf);
+int timed_nanosleep(const struct timespec *req);
+uint32_t elapsed_us(const struct timespec *start, const struct timespec *end);
+
+#endif
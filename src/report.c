@@ -0,0 +1,81 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/report.c
+ *
+ * Report-by-exception: a sample is only uploaded if a metric moved out of
+ * its deadband around the last uploaded value, the LED state changed or the
+ * heartbeat is due. The server can hold the last value, which is off by at
+ * most the deadband and at most heartbeat_interval old. LED state changes
+ * are uploaded right away by the alert thread as well (see alert.c)
+ */
+
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "report.h"
+#include "stats.h"
+
+// last uploaded samples, only used by the logging thread
+static struct {
+	int valid;
+	struct sample sample;
+	time_t time;
+} last[MAX_ROOMS];
+
+// value moved out of the deadband around sent, which is the larger of the
+// absolute and the relative one
+static int outside(float value, float sent, float absolute, float relative) {
+	float band = (sent < 0 ? -sent : sent) * relative / 100;
+	float diff = value < sent ? sent - value : value - sent;
+
+	return diff > (band > absolute ? band : absolute);
+}
+
+// why sample of room has to be uploaded
+int report_reason(int room, const struct sample *sample) {
+	struct iaq_config *conf = get_config();
+	const struct sample *sent = &last[room].sample;
+
+	if(!last[room].valid)
+		return REPORT_FIRST;
+
+	if(sample->led_state != sent->led_state) {
+		atomic_fetch_add_explicit(&report_state_changes, 1,
+				memory_order_relaxed);
+		return REPORT_STATE;
+	}
+
+	if(outside(sample->co2, sent->co2, conf->co2_deadband,
+				conf->co2_deadband_relative) ||
+			outside(sample->temp, sent->temp, conf->temp_deadband,
+				conf->temp_deadband_relative) ||
+			outside(sample->rh, sent->rh, conf->rh_deadband,
+				conf->rh_deadband_relative))
+		return REPORT_CHANGE;
+
+	if(sample->timestamp - last[room].time >= conf->heartbeat_interval_sec) {
+		atomic_fetch_add_explicit(&report_heartbeats, 1,
+				memory_order_relaxed);
+		return REPORT_HEARTBEAT;
+	}
+
+	atomic_fetch_add_explicit(&report_suppressed, 1, memory_order_relaxed);
+
+	return REPORT_SKIP;
+}
+
+// sample of room was received by the server
+void report_sent(int room, const struct sample *sample) {
+	last[room].valid = 1;
+	last[room].sample = *sample;
+	last[room].time = sample->timestamp;
+}
@@ -0,0 +1,35 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/report.h
+ *
+ * Header file for report-by-exception uploads
+ */
+
+#ifndef _IAQ_MEASUREMENTD_REPORT_H_
+#define _IAQ_MEASUREMENTD_REPORT_H_
+
+#include <time.h>
+
+#include "history.h"
+
+// reasons for uploading a sample, REPORT_SKIP if the server can do without
+#define REPORT_SKIP 0
+#define REPORT_CHANGE 1 // a metric left its deadband
+#define REPORT_STATE 2 // the LED state changed
+#define REPORT_HEARTBEAT 3 // nothing uploaded for heartbeat_interval
+#define REPORT_FIRST 4 // nothing uploaded since the start
+
+int report_reason(int room, const struct sample *sample);
+void report_sent(int room, const struct sample *sample);
+
+#endif
@@ -0,0 +1,299 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/resources.c
+ *
+ * Accounts the cpu time, context switches, wakeups, RSS and open files of
+ * the daemon once a minute, in a rolling window of the last hour. The
+ * window is uploaded with the readings and written to the runtime
+ * statistics, so creeping resource usage shows up fleet-wide
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <sys/resource.h>
+
+#include "resources.h"
+
+struct thread_usage {
+	pid_t tid;
+	char name[16];
+	// totals from schedstat at the last sample
+	uint64_t run_ns;
+	uint64_t timeslices;
+};
+
+static struct resource_sample window[RESOURCE_WINDOW];
+// samples taken so far, the newest one is at (count - 1) % RESOURCE_WINDOW
+static unsigned int count;
+static pthread_mutex_t window_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// state of the previous sample, only used by resources_sample()
+static struct thread_usage threads[RESOURCE_THREADS];
+static unsigned int nthreads;
+static struct rusage last_usage;
+static struct timespec last_time;
+
+static uint64_t timeval_us(const struct timeval *tv) {
+	return (uint64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+// slot of thread tid, allocated on first sight. NULL if all are taken
+static struct thread_usage *thread_slot(pid_t tid) {
+	unsigned int i;
+
+	for(i = 0; i < nthreads; i++)
+		if(threads[i].tid == tid)
+			return &threads[i];
+
+	if(nthreads == RESOURCE_THREADS)
+		return NULL;
+
+	threads[nthreads].tid = tid;
+	threads[nthreads].run_ns = 0;
+	threads[nthreads].timeslices = 0;
+
+	return &threads[nthreads++];
+}
+
+// reads the first line of a file below /proc/self
+static int read_proc(const char *path, char *buf, size_t len) {
+	FILE *file;
+	int status = -1;
+
+	if((file = fopen(path, "re")) == NULL)
+		return -1;
+
+	if(fgets(buf, len, file) != NULL)
+		status = 0;
+
+	fclose(file);
+
+	return status;
+}
+
+// cpu time and timeslices of every thread since the previous sample, from
+// /proc/self/task/<tid>/schedstat
+static void sample_threads(struct resource_sample *sample, double scale) {
+	struct thread_usage *thread;
+	struct dirent *entry;
+	uint64_t run_ns, wait_ns, timeslices;
+	char path[64], line[64];
+	DIR *dir;
+	pid_t tid;
+
+	if((dir = opendir("/proc/self/task")) == NULL)
+		return;
+
+	while((entry = readdir(dir)) != NULL) {
+		if((tid = atoi(entry->d_name)) <= 0)
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat", tid);
+		if(read_proc(path, line, sizeof(line)) != 0 ||
+				sscanf(line, "%" SCNu64 " %" SCNu64 " %" SCNu64, &run_ns,
+					&wait_ns, &timeslices) != 3)
+			continue;
+
+		if((thread = thread_slot(tid)) == NULL)
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/self/task/%d/comm", tid);
+		if(read_proc(path, thread->name, sizeof(thread->name)) == 0)
+			thread->name[strcspn(thread->name, "\n")] = '\0';
+
+		// the first sample of a thread covers its whole life
+		sample->thread_cpu_us[thread - threads] +=
+			(run_ns - thread->run_ns) / 1000 * scale;
+		sample->wakeups += (timeslices - thread->timeslices) * scale;
+
+		thread->run_ns = run_ns;
+		thread->timeslices = timeslices;
+	}
+
+	closedir(dir);
+}
+
+static uint32_t open_fds() {
+	struct dirent *entry;
+	uint32_t fds = 0;
+	DIR *dir;
+
+	if((dir = opendir("/proc/self/fd")) == NULL)
+		return 0;
+
+	while((entry = readdir(dir)) != NULL)
+		if(entry->d_name[0] != '.')
+			fds++;
+
+	closedir(dir);
+
+	// the directory itself
+	return fds - 1;
+}
+
+// adds the usage since the previous call to the window, scaled to one
+// minute. called by the controller thread once a minute
+void resources_sample() {
+	struct resource_sample sample;
+	struct rusage usage;
+	struct timespec now;
+	char line[64];
+	long pages;
+	double scale = 1;
+
+	memset(&sample, 0, sizeof(sample));
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	getrusage(RUSAGE_SELF, &usage);
+
+	if(count > 0)
+		scale = 60 / (now.tv_sec - last_time.tv_sec +
+				(now.tv_nsec - last_time.tv_nsec) / 1e9);
+
+	sample.cpu_us = (timeval_us(&usage.ru_utime) -
+			timeval_us(&last_usage.ru_utime) + timeval_us(&usage.ru_stime) -
+			timeval_us(&last_usage.ru_stime)) * scale;
+	sample.context_switches = (usage.ru_nvcsw - last_usage.ru_nvcsw +
+			usage.ru_nivcsw - last_usage.ru_nivcsw) * scale;
+
+	sample_threads(&sample, scale);
+
+	// resident pages are the second field
+	if(read_proc("/proc/self/statm", line, sizeof(line)) == 0 &&
+			sscanf(line, "%*d %ld", &pages) == 1)
+		sample.rss_kb = pages * (sysconf(_SC_PAGESIZE) / 1024);
+
+	sample.fds = open_fds();
+
+	last_usage = usage;
+	last_time = now;
+
+	pthread_mutex_lock(&window_mutex);
+	window[count % RESOURCE_WINDOW] = sample;
+	count++;
+	pthread_mutex_unlock(&window_mutex);
+}
+
+// the reported samples. the first sample covers the startup and is left
+// out until it is overwritten. called with window_mutex held
+static unsigned int window_range(unsigned int *first) {
+	if(count > RESOURCE_WINDOW) {
+		*first = 0;
+		return RESOURCE_WINDOW;
+	}
+
+	*first = 1;
+	return count > 0 ? count - 1 : 0;
+}
+
+// mean and maximum of the uint32_t at offset in the reported samples
+static void field_stats(size_t offset, uint32_t *mean, uint32_t *max) {
+	unsigned int i, first, n;
+	uint64_t sum = 0;
+	uint32_t value;
+
+	*mean = *max = 0;
+
+	if((n = window_range(&first)) == 0)
+		return;
+
+	for(i = first; i < first + n; i++) {
+		value = *(uint32_t *)((char *)&window[i] + offset);
+		sum += value;
+		if(value > *max)
+			*max = value;
+	}
+
+	*mean = sum / n;
+}
+
+#define FIELD(NAME) offsetof(struct resource_sample, NAME)
+
+// url query parameters for the uploads: means and maxima per minute over the
+// window, rss and fds at the end of the newest minute. empty before the
+// first full minute
+void resources_query(char *query, size_t len) {
+	uint32_t cpu, cpu_max, ctxsw, ctxsw_max, wakeups, wakeups_max;
+	uint32_t rss, rss_max, fds, fds_max;
+	unsigned int first;
+
+	pthread_mutex_lock(&window_mutex);
+
+	if(window_range(&first) == 0) {
+		pthread_mutex_unlock(&window_mutex);
+		query[0] = '\0';
+		return;
+	}
+
+	field_stats(FIELD(cpu_us), &cpu, &cpu_max);
+	field_stats(FIELD(context_switches), &ctxsw, &ctxsw_max);
+	field_stats(FIELD(wakeups), &wakeups, &wakeups_max);
+	field_stats(FIELD(rss_kb), &rss, &rss_max);
+	field_stats(FIELD(fds), &fds, &fds_max);
+	rss = window[(count - 1) % RESOURCE_WINDOW].rss_kb;
+	fds = window[(count - 1) % RESOURCE_WINDOW].fds;
+
+	pthread_mutex_unlock(&window_mutex);
+
+	snprintf(query, len, "&cpu_us=%u&cpu_us_max=%u&ctxsw=%u&ctxsw_max=%u"
+			"&wakeups=%u&wakeups_max=%u&rss_kb=%u&rss_kb_max=%u&fds=%u"
+			"&fds_max=%u", cpu, cpu_max, ctxsw, ctxsw_max, wakeups,
+			wakeups_max, rss, rss_max, fds, fds_max);
+}
+
+static void write_field(FILE *file, const char *name, size_t offset) {
+	uint32_t mean, max;
+
+	field_stats(offset, &mean, &max);
+	fprintf(file, "\"%s\":{\"mean\":%u,\"max\":%u}", name, mean, max);
+}
+
+// writes the window as one JSON object, per minute means and maxima
+void resources_write_json(FILE *file) {
+	unsigned int i, first;
+
+	pthread_mutex_lock(&window_mutex);
+
+	fprintf(file, "{\"minutes\":%u,", window_range(&first));
+	write_field(file, "cpu_us", FIELD(cpu_us));
+	fprintf(file, ",");
+	write_field(file, "context_switches", FIELD(context_switches));
+	fprintf(file, ",");
+	write_field(file, "wakeups", FIELD(wakeups));
+	fprintf(file, ",");
+	write_field(file, "rss_kb", FIELD(rss_kb));
+	fprintf(file, ",");
+	write_field(file, "fds", FIELD(fds));
+	fprintf(file, ",\"threads\":[");
+
+	// the names are only written by the controller thread, which also
+	// writes the statistics
+	for(i = 0; i < nthreads; i++) {
+		fprintf(file, "%s{\"name\":\"%s\",", i > 0 ? "," : "",
+				threads[i].name);
+		write_field(file, "cpu_us", FIELD(thread_cpu_us[i]));
+		fprintf(file, "}");
+	}
+
+	fprintf(file, "]}");
+
+	pthread_mutex_unlock(&window_mutex);
+}
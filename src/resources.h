@@ -0,0 +1,48 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/resources.h
+ *
+ * Header file for the resource accounting of the daemon
+ */
+
+#ifndef _IAQ_MEASUREMENTD_RESOURCES_H_
+#define _IAQ_MEASUREMENTD_RESOURCES_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// samples in the rolling window, one per minute
+#define RESOURCE_WINDOW 60
+// threads accounted separately, further threads are left out of
+// thread_cpu_us and wakeups
+#define RESOURCE_THREADS 12
+
+// space for the url query parameters of resources_query()
+#define RESOURCE_QUERY_LEN 256
+
+// usage during one minute, rss and fds at its end
+struct resource_sample {
+	uint32_t cpu_us;
+	uint32_t context_switches;
+	uint32_t wakeups;
+	uint32_t rss_kb;
+	uint32_t fds;
+	uint32_t thread_cpu_us[RESOURCE_THREADS];
+};
+
+void resources_sample();
+void resources_query(char *query, size_t len);
+void resources_write_json(FILE *file);
+
+#endif
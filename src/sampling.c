@@ -0,0 +1,111 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/sampling.c
+ *
+ * Adaptive sampling interval between sample_interval_min and
+ * sample_interval_max. A room is sampled often while its co2 rises or falls
+ * fast or is close to the next LED state change, and rarely while it is
+ * stable, e.g. at night
+ */
+
+#include <time.h>
+
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "sampling.h"
+
+static struct {
+	int valid;
+	int co2;
+	struct timespec time;
+	// moving average of the co2 slope
+	float slope; // in ppm/min
+	// distance to the next LED state change
+	float distance; // in ppm
+} rooms[MAX_ROOMS];
+
+// called by the measurement thread after the LED state of room was updated,
+// led_state is the new state of the co2 metric
+void sampling_update(int room, int co2, int led_state,
+		const struct timespec *now) {
+	const struct led_rule *rule =
+		&get_config()->rooms[room].led_table[LED_METRIC_CO2][led_state];
+	float minutes, slope;
+
+	if(rooms[room].valid) {
+		minutes = (now->tv_sec - rooms[room].time.tv_sec) / 60.0f +
+			(now->tv_nsec - rooms[room].time.tv_nsec) / 60e9f;
+
+		if(minutes > 0) {
+			slope = (co2 - rooms[room].co2) / minutes;
+			rooms[room].slope += SAMPLING_SLOPE_ALPHA *
+				(slope - rooms[room].slope);
+		}
+	}
+
+	rooms[room].valid = 1;
+	rooms[room].co2 = co2;
+	rooms[room].time = *now;
+
+	// the rule of the current state holds the values leaving it (see
+	// compile_led_rules()): GREEN is left upwards at lo, RED downwards at hi
+	// and YELLOW in both directions. OFF is left by any measurement
+	switch(led_state) {
+		case GREEN:
+			rooms[room].distance = rule->lo - co2;
+			break;
+		case YELLOW:
+			rooms[room].distance = co2 - rule->lo < rule->hi - co2 ?
+				co2 - rule->lo : rule->hi - co2;
+			break;
+		case RED:
+			rooms[room].distance = co2 - rule->hi;
+			break;
+		default:
+			rooms[room].distance = 0;
+	}
+}
+
+// time until the next sample, the shortest one needed by a room
+long sampling_interval(int nrooms) {
+	struct iaq_config *conf = get_config();
+	float interval = conf->sample_interval_max;
+	float slope, distance;
+	int i;
+
+	if(conf->sample_interval_min == conf->sample_interval_max)
+		return conf->sample_interval_max;
+
+	for(i = 0; i < nrooms; i++) {
+		if(!rooms[i].valid)
+			return conf->sample_interval_min;
+
+		slope = rooms[i].slope < 0 ? -rooms[i].slope : rooms[i].slope;
+		if(slope < SAMPLING_SLOPE_FLOOR)
+			slope = SAMPLING_SLOPE_FLOOR;
+		distance = rooms[i].distance;
+
+		if(distance <= SAMPLING_NEAR)
+			return conf->sample_interval_min;
+
+		// at most SAMPLING_STEP between samples, and at least two samples
+		// before the threshold is reached at the current slope
+		if(distance > 2 * SAMPLING_STEP)
+			distance = 2 * SAMPLING_STEP;
+		if(distance / 2 / slope * 60 < interval)
+			interval = distance / 2 / slope * 60;
+	}
+
+	return interval < conf->sample_interval_min ?
+		conf->sample_interval_min : (long)interval;
+}
@@ -0,0 +1,36 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/sampling.h
+ *
+ * Header file for the adaptive sampling interval
+ */
+
+#ifndef _IAQ_MEASUREMENTD_SAMPLING_H_
+#define _IAQ_MEASUREMENTD_SAMPLING_H_
+
+#include <time.h>
+
+// weight of the newest slope in the moving average
+#define SAMPLING_SLOPE_ALPHA 0.3f
+// slopes below this count as stable
+#define SAMPLING_SLOPE_FLOOR 1.0f // in ppm/min
+// co2 change aimed for between two samples
+#define SAMPLING_STEP 50 // in ppm
+// closer to a threshold, the shortest interval is used
+#define SAMPLING_NEAR 50 // in ppm
+
+void sampling_update(int room, int co2, int led_state,
+		const struct timespec *now);
+long sampling_interval(int nrooms);
+
+#endif
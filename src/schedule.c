@@ -0,0 +1,78 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/schedule.c
+ *
+ * Every sensor is measured on its own grid of CLOCK_MONOTONIC seconds: phase
+ * seconds after every multiple of its period. The k-30 follows the adaptive
+ * interval of sampling.c, the si7021 its fixed period, as temperature and
+ * humidity change slowly. Sensors due at the same time are measured in the
+ * same cycle, room by room, so each channel of the multiplexer is selected
+ * once for both
+ */
+
+#include <time.h>
+
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "schedule.h"
+#include "sampling.h"
+#include "stats.h"
+
+// next measurement of each sensor, all of them are due at startup
+static struct timespec k30_due, si7021_due;
+
+// first point of the grid after the second after
+static time_t next_slot(time_t after, long period, long phase) {
+	time_t t;
+
+	phase %= period;
+	t = after - phase;
+	// t is negative during the first period after boot
+	t -= (t % period + period) % period;
+
+	return t + period + phase;
+}
+
+// mask of the sensors due at now
+int schedule_due(const struct timespec *now) {
+	int sensors = 0;
+
+	if(k30_due.tv_sec <= now->tv_sec)
+		sensors |= SENSOR_K30;
+	if(si7021_due.tv_sec <= now->tv_sec)
+		sensors |= SENSOR_SI7021;
+
+	return sensors;
+}
+
+// schedules the next measurements of sensors, which were due at now. a
+// measurement running late keeps the grid, missed slots are skipped
+void schedule_done(int sensors, const struct timespec *now, int nrooms) {
+	struct iaq_config *conf = get_config();
+	long interval;
+
+	if(sensors & SENSOR_K30) {
+		interval = sampling_interval(nrooms);
+		histogram_record(&sample_interval_hist, interval);
+		k30_due.tv_sec = next_slot(now->tv_sec, interval, conf->co2_phase);
+	}
+
+	if(sensors & SENSOR_SI7021)
+		si7021_due.tv_sec = next_slot(now->tv_sec, conf->si7021_period,
+				conf->si7021_phase);
+}
+
+// the time the next sensor is due
+void schedule_wakeup(struct timespec *wakeup) {
+	*wakeup = k30_due.tv_sec < si7021_due.tv_sec ? k30_due : si7021_due;
+}
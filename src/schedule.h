@@ -0,0 +1,40 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/schedule.h
+ *
+ * Header file for the measurement schedule of the sensors
+ */
+
+#ifndef _IAQ_MEASUREMENTD_SCHEDULE_H_
+#define _IAQ_MEASUREMENTD_SCHEDULE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+// sensors of a room, bits of the masks passed around by the scheduler
+#define SENSOR_K30 (1 << 0)
+#define SENSOR_SI7021 (1 << 1)
+
+// seconds from read to now, saturated at max
+static inline unsigned int metric_age(const struct timespec *read,
+		const struct timespec *now, unsigned int max) {
+	time_t age = now->tv_sec - read->tv_sec;
+
+	return age < 0 ? 0 : age > max ? max : age;
+}
+
+int schedule_due(const struct timespec *now);
+void schedule_done(int sensors, const struct timespec *now, int nrooms);
+void schedule_wakeup(struct timespec *wakeup);
+
+#endif
@@ -0,0 +1,318 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/snapshot.c
+ *
+ * Saves the runtime state (last measurement, LED state, history and upload
+ * position) to a binary file and restores it on startup, so a restarted
+ * daemon continues the LED hysteresis instead of starting from OFF
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "config.h"
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "history.h"
+#include "snapshot.h"
+#include "schedule.h"
+#include "units.h"
+#include "log.h"
+
+static uint32_t crc32(const void *data, size_t len) {
+	const uint8_t *p = data;
+	uint32_t crc = 0xFFFFFFFF;
+	int i;
+
+	while(len--) {
+		crc ^= *p++;
+		for(i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+static size_t snapshot_size(unsigned int nrooms, unsigned int samples) {
+	return sizeof(struct snapshot) + nrooms * sizeof(struct snapshot_room) +
+		samples * sizeof(struct raw_sample);
+}
+
+static struct raw_sample *snapshot_history(struct snapshot *snapshot) {
+	return (struct raw_sample *)&snapshot->rooms[snapshot->nrooms];
+}
+
+// writes the snapshot to a temporary file and renames it, so there is
+// always a complete snapshot on disk. called by the controller thread, which
+// is the only one replacing the config
+void write_snapshot() {
+	struct iaq_config *conf = get_config();
+	struct snapshot *snapshot;
+	struct snapshot_room *room;
+	struct raw_sample *history;
+	struct timespec now;
+	unsigned int samples = 0;
+	size_t size;
+	int fd, i, j;
+
+	snapshot = calloc(1, snapshot_size(conf->nrooms,
+				conf->nrooms * HISTORY_LEN));
+	if(snapshot == NULL) {
+		log_msg(LOG_WARNING, "failed to allocate snapshot: %m");
+		return;
+	}
+
+	snapshot->nrooms = conf->nrooms;
+	history = snapshot_history(snapshot);
+
+	for(i = 0; i < conf->nrooms; i++) {
+		room = &snapshot->rooms[i];
+		room->history_count = history_copy_raw(i, history + samples,
+				HISTORY_LEN, &room->history_next_seq);
+		samples += room->history_count;
+	}
+
+	// nothing measured yet, keep the previous snapshot
+	if(samples == 0) {
+		free(snapshot);
+		return;
+	}
+
+	snapshot->magic = SNAPSHOT_MAGIC;
+	snapshot->version = SNAPSHOT_VERSION;
+	snapshot->sample_size = sizeof(struct raw_sample);
+	snapshot->written = time(NULL);
+	snapshot->last_upload = atomic_load(&last_upload_time);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&measurement_mutex);
+	for(i = 0; i < conf->nrooms; i++) {
+		room = &snapshot->rooms[i];
+		room->last.timestamp = snapshot->written;
+		room->last.co2 = room_states[i].co2_word;
+		room->last.temp = room_states[i].temp_word;
+		room->last.rh = room_states[i].rh_word;
+		room->last.led_state = room_states[i].led_state;
+		room->co2_age = metric_age(&room_states[i].co2_time, &now,
+				UINT16_MAX);
+		room->temp_rh_age = metric_age(&room_states[i].temp_rh_time, &now,
+				UINT16_MAX);
+		room->quality = room_states[i].quality;
+		for(j = 0; j < LED_METRICS; j++)
+			room->metric_states[j] = room_states[i].metric_states[j];
+	}
+	pthread_mutex_unlock(&measurement_mutex);
+
+	for(i = 0; i < conf->nrooms; i++)
+		snapshot->rooms[i].upload_seq =
+			atomic_load(&room_states[i].upload_seq);
+
+	// the samples were copied to the front of the history area
+	size = snapshot_size(snapshot->nrooms, samples);
+	snapshot->crc = crc32(snapshot, size);
+	fd = open(SNAPSHOTFILE ".tmp", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			0644);
+	if(fd < 0) {
+		log_msg(LOG_WARNING, "failed to open file " SNAPSHOTFILE ".tmp. %m");
+		free(snapshot);
+		return;
+	}
+
+	// the snapshot must survive a power loss right after the rename
+	if(write(fd, snapshot, size) != size || fdatasync(fd) == -1) {
+		log_msg(LOG_WARNING, "failed to write to file " SNAPSHOTFILE ".tmp. "
+				"%m");
+		close(fd);
+		unlink(SNAPSHOTFILE ".tmp");
+		free(snapshot);
+		return;
+	}
+
+	close(fd);
+	free(snapshot);
+
+	if(rename(SNAPSHOTFILE ".tmp", SNAPSHOTFILE) == -1)
+		log_msg(LOG_WARNING, "failed to rename " SNAPSHOTFILE ".tmp. %m");
+}
+
+// checks the saved state of a room. metrics never measured have no valid
+// words
+static int valid_room(const struct snapshot_room *room) {
+	int i;
+
+	// measurement ranges of the k-30 and si7021. every rh word is in range
+	if(!(room->quality & SAMPLE_CO2_MISSING) && room->last.co2 > 10000)
+		return 0;
+
+	if(!(room->quality & SAMPLE_TEMP_RH_MISSING) &&
+			(si7021_temp(room->last.temp) < -40 ||
+			 si7021_temp(room->last.temp) > 125))
+		return 0;
+
+	for(i = 0; i < LED_METRICS; i++)
+		if(room->metric_states[i] > RED)
+			return 0;
+
+	return room->last.led_state <= RED;
+}
+
+// CLOCK_MONOTONIC age s before now. the clock starts at boot, so the time of
+// a measurement made before a reboot is clamped to the start of the clock
+static struct timespec monotonic_before(const struct timespec *now,
+		time_t age) {
+	struct timespec before = *now;
+
+	if(age > before.tv_sec) {
+		before.tv_sec = 0;
+		before.tv_nsec = 0;
+	}
+	else
+		before.tv_sec -= age;
+
+	return before;
+}
+
+// restores the state saved by write_snapshot(). returns 0 on success and -1
+// if there is no usable snapshot, in which case nothing is changed
+int restore_snapshot() {
+	struct iaq_config *conf = get_config();
+	struct snapshot *snapshot;
+	struct snapshot_room *room;
+	struct raw_sample *history;
+	struct timespec monotonic;
+	struct stat st;
+	unsigned int samples;
+	uint32_t crc;
+	time_t now;
+	int fd, i, j;
+
+	fd = open(SNAPSHOTFILE, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return -1;
+
+	if(fstat(fd, &st) == -1 || st.st_size < sizeof(struct snapshot) ||
+			st.st_size > snapshot_size(MAX_ROOMS, MAX_ROOMS * HISTORY_LEN)) {
+		log_msg(LOG_WARNING, "snapshot: invalid size. ignoring it");
+		close(fd);
+		return -1;
+	}
+
+	snapshot = malloc(st.st_size);
+	if(snapshot == NULL || read(fd, snapshot, st.st_size) != st.st_size) {
+		log_msg(LOG_WARNING, "snapshot: failed to read " SNAPSHOTFILE ". "
+				"ignoring it");
+		free(snapshot);
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+
+	now = time(NULL);
+	crc = snapshot->crc;
+	snapshot->crc = 0;
+
+	if(snapshot->magic != SNAPSHOT_MAGIC ||
+			snapshot->version != SNAPSHOT_VERSION ||
+			snapshot->sample_size != sizeof(struct raw_sample) ||
+			snapshot->nrooms < 1 || snapshot->nrooms > MAX_ROOMS ||
+			st.st_size < snapshot_size(snapshot->nrooms, 0)) {
+		log_msg(LOG_WARNING, "snapshot: corrupt or written by another "
+				"version. ignoring it");
+		free(snapshot);
+		return -1;
+	}
+
+	for(i = 0, samples = 0; i < snapshot->nrooms; i++) {
+		if(snapshot->rooms[i].history_count > HISTORY_LEN)
+			break;
+		samples += snapshot->rooms[i].history_count;
+	}
+
+	if(i < snapshot->nrooms ||
+			st.st_size != snapshot_size(snapshot->nrooms, samples) ||
+			crc != crc32(snapshot, st.st_size)) {
+		log_msg(LOG_WARNING, "snapshot: corrupt. ignoring it");
+		free(snapshot);
+		return -1;
+	}
+
+	// the histories cannot be matched to the rooms anymore
+	if(snapshot->nrooms != conf->nrooms) {
+		log_msg(LOG_INFO, "snapshot: written for %u rooms. ignoring it",
+				snapshot->nrooms);
+		free(snapshot);
+		return -1;
+	}
+
+	for(i = 0; i < snapshot->nrooms; i++)
+		if(!valid_room(&snapshot->rooms[i]))
+			break;
+
+	if(snapshot->written > now || now - snapshot->written > SNAPSHOT_MAX_AGE
+			|| i < snapshot->nrooms) {
+		log_msg(LOG_INFO, "snapshot: outdated. ignoring it");
+		free(snapshot);
+		return -1;
+	}
+
+	// the ages are relative to the time the snapshot was written
+	clock_gettime(CLOCK_MONOTONIC, &monotonic);
+
+	pthread_mutex_lock(&measurement_mutex);
+	for(i = 0; i < snapshot->nrooms; i++) {
+		room = &snapshot->rooms[i];
+		room_states[i].co2_time = monotonic_before(&monotonic,
+				now - snapshot->written + room->co2_age);
+		room_states[i].temp_rh_time = monotonic_before(&monotonic,
+				now - snapshot->written + room->temp_rh_age);
+		room_states[i].quality = room->quality;
+		room_states[i].co2_word = room->last.co2;
+		room_states[i].temp_word = room->last.temp;
+		room_states[i].rh_word = room->last.rh;
+		room_states[i].co2 = co2_ppm(room_states[i].co2_word, &conf->rooms[i]);
+		room_states[i].temp = temp_celsius(room_states[i].temp_word,
+				&conf->rooms[i]);
+		room_states[i].rh = rh_percent(room_states[i].rh_word,
+				&conf->rooms[i]);
+		room_states[i].led_state = room->last.led_state;
+		for(j = 0; j < LED_METRICS; j++)
+			room_states[i].metric_states[j] = room->metric_states[j];
+	}
+	pthread_mutex_unlock(&measurement_mutex);
+
+	atomic_store(&last_upload_time, snapshot->last_upload);
+
+	history = snapshot_history(snapshot);
+	for(i = 0; i < snapshot->nrooms; i++) {
+		atomic_store(&room_states[i].upload_seq,
+				snapshot->rooms[i].upload_seq);
+		history_restore(i, history, snapshot->rooms[i].history_count,
+				snapshot->rooms[i].history_next_seq);
+		history += snapshot->rooms[i].history_count;
+	}
+
+	log_msg(LOG_INFO, "snapshot: restored state from %u s ago",
+			(unsigned int)(now - snapshot->written));
+
+	free(snapshot);
+
+	return 0;
+}
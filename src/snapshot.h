@@ -0,0 +1,70 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/snapshot.h
+ *
+ * Header file for the runtime state snapshots used for warm restarts
+ */
+
+#ifndef _IAQ_MEASUREMENTD_SNAPSHOT_H_
+#define _IAQ_MEASUREMENTD_SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include "iaq-measurementd.h"
+#include "history.h"
+
+#define SNAPSHOTFILE PKGSTATEDIR "/snapshot.bin"
+
+#define SNAPSHOT_MAGIC 0x53514149 // "IAQS"
+#define SNAPSHOT_VERSION 5
+
+// time between periodic snapshots
+#define SNAPSHOT_INTERVAL 60 // in s
+// older snapshots don't describe the room anymore and are ignored
+#define SNAPSHOT_MAX_AGE 3600 // in s
+
+// samples are saved as read from the sensors and converted with the
+// calibration in effect when they are restored
+struct snapshot_room {
+	// last measurement and LED state
+	struct raw_sample last;
+	// position of the uploads in the history
+	uint32_t upload_seq;
+	uint32_t history_next_seq;
+	uint32_t history_count;
+	// time from the last successful measurements to written, in s
+	uint16_t co2_age;
+	uint16_t temp_rh_age;
+	// SAMPLE_*_STALE and SAMPLE_*_MISSING of last
+	uint8_t quality;
+	// LED states of the single metrics for LED_COMBINE_WORST
+	uint8_t metric_states[LED_METRICS];
+};
+
+// header, followed by the histories of all rooms in room order, oldest
+// sample first
+struct snapshot {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t sample_size;
+	uint32_t crc; // crc32 of the whole snapshot with crc set to 0
+	uint32_t written; // CLOCK_REALTIME in s
+	uint32_t nrooms;
+	uint32_t last_upload; // CLOCK_REALTIME in s
+	struct snapshot_room rooms[];
+};
+
+void write_snapshot();
+int restore_snapshot();
+
+#endif
@@ -0,0 +1,158 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/stats.c
+ *
+ * Runtime statistics, exported as JSON on request
+ */
+
+#include <stdio.h>
+#include <syslog.h>
+
+#include "config.h"
+#include "stats.h"
+#include "histogram.h"
+#include "resources.h"
+#include "log.h"
+
+// time nanosleep() returned later than requested
+struct histogram sleep_overshoot_hist = HISTOGRAM_INIT("sleep_overshoot",
+	"us");
+// duration of a measurement cycle from first i2c access to LED update
+struct histogram cycle_latency_hist = HISTOGRAM_INIT("cycle_latency", "us");
+// adaptive time between measurement cycles
+struct histogram sample_interval_hist = HISTOGRAM_INIT("sample_interval", "s");
+
+// single write()/read() calls, failed ones included
+struct histogram k30_write_hist = HISTOGRAM_INIT("k30_write", "us");
+struct histogram k30_read_hist = HISTOGRAM_INIT("k30_read", "us");
+// complete CO2() calls and their number of failed reads/writes/checksums
+struct histogram k30_transaction_hist = HISTOGRAM_INIT("k30_transaction",
+	"us");
+struct histogram k30_retries_hist = HISTOGRAM_INIT("k30_retries", "retries");
+
+struct histogram si7021_write_hist = HISTOGRAM_INIT("si7021_write", "us");
+struct histogram si7021_read_hist = HISTOGRAM_INIT("si7021_read", "us");
+// rh measurement request until the result could be read
+struct histogram si7021_rh_conversion_hist =
+	HISTOGRAM_INIT("si7021_rh_conversion", "us");
+struct histogram si7021_transaction_hist =
+	HISTOGRAM_INIT("si7021_transaction", "us");
+struct histogram si7021_retries_hist = HISTOGRAM_INIT("si7021_retries",
+	"retries");
+
+// curl_easy_perform() of a measurement upload
+struct histogram http_upload_hist = HISTOGRAM_INIT("http_upload", "us");
+// connect until the TLS handshake completed, full and resumed ones
+struct histogram tls_handshake_hist = HISTOGRAM_INIT("tls_handshake", "us");
+atomic_uint http_connections;
+atomic_uint tls_handshakes;
+// report-by-exception: samples not uploaded and the reasons for uploads
+atomic_uint report_suppressed;
+atomic_uint report_state_changes;
+atomic_uint report_heartbeats;
+
+// LED state change until the server received the alert
+struct histogram alert_latency_hist = HISTOGRAM_INIT("alert_latency", "us");
+atomic_uint alerts_sent;
+atomic_uint alerts_dropped;
+
+atomic_uint deadline_misses;
+atomic_uint deadline_skipped;
+
+atomic_uint health_quarantines;
+atomic_uint health_probes;
+atomic_uint health_recoveries;
+
+// gateway: forwarding a batch of relayed readings
+struct histogram gateway_forward_hist = HISTOGRAM_INIT("gateway_forward",
+	"us");
+atomic_uint gateway_received;
+atomic_uint gateway_invalid;
+atomic_uint gateway_dropped;
+atomic_uint gateway_forwarded;
+
+atomic_uint startup_first_led_us;
+atomic_uint startup_first_sample_us;
+
+static struct histogram *histograms[] = {
+	&sleep_overshoot_hist,
+	&cycle_latency_hist,
+	&sample_interval_hist,
+	&k30_write_hist,
+	&k30_read_hist,
+	&k30_transaction_hist,
+	&k30_retries_hist,
+	&si7021_write_hist,
+	&si7021_read_hist,
+	&si7021_rh_conversion_hist,
+	&si7021_transaction_hist,
+	&si7021_retries_hist,
+	&http_upload_hist,
+	&tls_handshake_hist,
+	&alert_latency_hist,
+	&gateway_forward_hist,
+};
+
+// writes all statistics to STATSFILE. a temporary file is renamed, so
+// readers never see a partial file
+void write_stats() {
+	FILE *stats_file;
+	unsigned int i;
+
+	stats_file = fopen(STATSFILE ".tmp", "w");
+
+	if(stats_file == NULL) {
+		log_msg(LOG_WARNING, "failed to open file " STATSFILE ".tmp. %m");
+		return;
+	}
+
+	fprintf(stats_file, "{\"histograms\":[");
+
+	for(i = 0; i < sizeof(histograms) / sizeof(histograms[0]); i++) {
+		if(i > 0)
+			fprintf(stats_file, ",");
+		histogram_write_json(stats_file, histograms[i]);
+	}
+
+	fprintf(stats_file, "],\"startup_first_led_us\":%u,"
+		"\"startup_first_sample_us\":%u,"
+		"\"gateway\":{\"received\":%u,\"invalid\":%u,\"dropped\":%u,"
+		"\"forwarded\":%u},\"http\":{\"connections\":%u,"
+		"\"tls_handshakes\":%u},\"report_by_exception\":{\"suppressed\":%u,"
+		"\"state_changes\":%u,\"heartbeats\":%u},\"alerts\":{\"sent\":%u,"
+		"\"dropped\":%u},\"deadline\":{\"misses\":%u,\"skipped\":%u},"
+		"\"health\":{\"quarantines\":%u,\"probes\":%u,\"recoveries\":%u},"
+		"\"resources\":",
+		atomic_load(&startup_first_led_us),
+		atomic_load(&startup_first_sample_us), atomic_load(&gateway_received),
+		atomic_load(&gateway_invalid), atomic_load(&gateway_dropped),
+		atomic_load(&gateway_forwarded), atomic_load(&http_connections),
+		atomic_load(&tls_handshakes), atomic_load(&report_suppressed),
+		atomic_load(&report_state_changes), atomic_load(&report_heartbeats),
+		atomic_load(&alerts_sent), atomic_load(&alerts_dropped),
+		atomic_load(&deadline_misses), atomic_load(&deadline_skipped),
+		atomic_load(&health_quarantines), atomic_load(&health_probes),
+		atomic_load(&health_recoveries));
+
+	resources_write_json(stats_file);
+	fprintf(stats_file, "}\n");
+
+	if(fclose(stats_file) != 0) {
+		log_msg(LOG_WARNING, "failed to write to file " STATSFILE ".tmp. %m");
+		remove(STATSFILE ".tmp");
+		return;
+	}
+
+	if(rename(STATSFILE ".tmp", STATSFILE) == -1)
+		log_msg(LOG_WARNING, "failed to rename " STATSFILE ".tmp. %m");
+}
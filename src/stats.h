@@ -0,0 +1,85 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/stats.h
+ *
+ * Header file for the runtime statistics
+ */
+
+#ifndef _IAQ_MEASUREMENTD_STATS_H_
+#define _IAQ_MEASUREMENTD_STATS_H_
+
+#include "histogram.h"
+
+// written on SIGUSR2
+#define STATSFILE PKGSTATEDIR "/stats.json"
+
+// latencies are recorded in microseconds
+extern struct histogram sleep_overshoot_hist;
+extern struct histogram cycle_latency_hist;
+// in seconds
+extern struct histogram sample_interval_hist;
+
+extern struct histogram k30_write_hist;
+extern struct histogram k30_read_hist;
+extern struct histogram k30_transaction_hist;
+extern struct histogram k30_retries_hist;
+
+extern struct histogram si7021_write_hist;
+extern struct histogram si7021_read_hist;
+extern struct histogram si7021_rh_conversion_hist;
+extern struct histogram si7021_transaction_hist;
+extern struct histogram si7021_retries_hist;
+
+extern struct histogram http_upload_hist;
+// new connections of the uploads and TLS handshakes on them
+extern struct histogram tls_handshake_hist;
+extern atomic_uint http_connections;
+extern atomic_uint tls_handshakes;
+
+// samples skipped by report-by-exception, uploads for LED state changes and
+// heartbeats
+extern atomic_uint report_suppressed;
+extern atomic_uint report_state_changes;
+extern atomic_uint report_heartbeats;
+
+// uploads of LED state changes by the alert thread, dropped ones were
+// pushed out of a full queue or too old
+extern struct histogram alert_latency_hist;
+extern atomic_uint alerts_sent;
+extern atomic_uint alerts_dropped;
+
+// measurement cycles running out of their deadline, and the sensor
+// measurements skipped or aborted because of it
+extern atomic_uint deadline_misses;
+extern atomic_uint deadline_skipped;
+
+// sensors quarantined, the probes of quarantined sensors and those the
+// sensor responded to
+extern atomic_uint health_quarantines;
+extern atomic_uint health_probes;
+extern atomic_uint health_recoveries;
+
+// relayed readings received, rejected, dropped and forwarded by the gateway
+extern struct histogram gateway_forward_hist;
+extern atomic_uint gateway_received;
+extern atomic_uint gateway_invalid;
+extern atomic_uint gateway_dropped;
+extern atomic_uint gateway_forwarded;
+
+// time from process start to the first LED update and first measurement
+extern atomic_uint startup_first_led_us;
+extern atomic_uint startup_first_sample_us;
+
+void write_stats();
+
+#endif
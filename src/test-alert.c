@@ -0,0 +1,265 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/test-alert.c
+ *
+ * Alert test for make check. An alert is uploaded to a stand-in for
+ * device_interface.php, which answers the first request with an HTTP error,
+ * so the alert must arrive with its retry. A relaying device sends its alert
+ * as a datagram marked with WIRE_ALERT right away
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <curl/curl.h>
+
+#include "config.h"
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "history.h"
+#include "alert.h"
+#include "wire.h"
+#include "stats.h"
+#include "tls.h"
+#include "log.h"
+
+// the rejected alert is retried after ALERT_RETRY_DELAY
+#define TEST_TIMEOUT (ALERT_RETRY_DELAY + 20) // in s
+// a relayed alert is sent without waiting for the logging interval
+#define RELAY_TIMEOUT 2 // in s
+#define TEST_SEQ 42
+
+#define STANDIN_BUFFER 2048
+
+_Atomic(struct iaq_config *) current_config;
+
+// requests of the stand-in, those answered with 500 Internal Server Error,
+// and the led_state of the last one
+static atomic_int requests;
+static atomic_int rejected;
+static atomic_int received_state = -1;
+
+// the shared upload code terminates the daemon on fatal errors
+void terminate(int status) {
+	log_flush();
+	exit(status);
+}
+
+// counts one request, a GET of device_interface.php. the first one is
+// rejected. returns the response
+static const char *standin_count(const char *request) {
+	static const char ok[] = "HTTP/1.1 200 OK\r\n"
+		"Content-Length: 0\r\n\r\n";
+	static const char error[] = "HTTP/1.1 500 Internal Server Error\r\n"
+		"Content-Length: 0\r\n\r\n";
+	const char *query;
+	int led_state;
+
+	atomic_fetch_add(&requests, 1);
+
+	// served by one thread
+	if(atomic_load(&rejected) == 0) {
+		atomic_store(&rejected, 1);
+		return error;
+	}
+
+	query = strstr(request, "&led_state=");
+	if(strncmp(request, "GET /device_interface.php?", 26) == 0 &&
+			query != NULL && sscanf(query, "&led_state=%d", &led_state) == 1)
+		atomic_store(&received_state, led_state);
+
+	return ok;
+}
+
+// serves the persistent connections of the alert thread one after the other
+static void *standin_server(void *arg) {
+	char buffer[STANDIN_BUFFER];
+	int listen_fd = *(int *)arg;
+	const char *response;
+	size_t len;
+	ssize_t n;
+	char *end;
+	int fd;
+
+	while((fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+		len = 0;
+
+		while((n = read(fd, buffer + len, sizeof(buffer) - 1 - len)) > 0) {
+			len += n;
+			buffer[len] = '\0';
+
+			// requests without a body, each ends with an empty line
+			while((end = strstr(buffer, "\r\n\r\n")) != NULL) {
+				*end = '\0';
+				response = standin_count(buffer);
+				if(write(fd, response, strlen(response)) != strlen(response))
+					break;
+
+				len -= end + 4 - buffer;
+				memmove(buffer, end + 4, len + 1);
+			}
+
+			if(len == sizeof(buffer) - 1)
+				break;
+		}
+
+		close(fd);
+	}
+
+	return NULL;
+}
+
+// binds a socket of type to an ephemeral port of the loopback interface.
+// returns the socket and stores the port in port, or returns -1
+static int loopback_socket(int type, int *port) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if((fd = socket(AF_INET, type | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+			getsockname(fd, (struct sockaddr *)&addr, &len) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	*port = ntohs(addr.sin_port);
+
+	return fd;
+}
+
+static void sleep_ms(long ms) {
+	struct timespec t = {ms / 1000, ms % 1000 * 1000000};
+
+	nanosleep(&t, NULL);
+}
+
+int main() {
+	static struct iaq_config conf, relay_conf;
+	static int listen_fd;
+	pthread_t standin_thread, alert_thread;
+	struct timespec timeout = {RELAY_TIMEOUT, 0};
+	struct wire_sample datagram;
+	struct sample sample, received;
+	char host[32], room[WIRE_ROOM_LEN];
+	uint32_t seq;
+	int http_port, udp_port, waited, alert;
+	ssize_t len;
+	int udp_fd;
+
+	if((listen_fd = loopback_socket(SOCK_STREAM, &http_port)) < 0 ||
+			listen(listen_fd, 4) == -1 ||
+			pthread_create(&standin_thread, NULL, standin_server, &listen_fd)
+			!= 0) {
+		fprintf(stderr, "failed to start the stand-in server: %s\n",
+				strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	snprintf(host, sizeof(host), "127.0.0.1:%d", http_port);
+	conf.host = host;
+	conf.nrooms = 1;
+	conf.rooms[0].room = "test-alert";
+	atomic_store(&current_config, &conf);
+
+	if(curl_global_init(CURL_GLOBAL_ALL)) {
+		fprintf(stderr, "failed to initialize libcurl\n");
+		return EXIT_FAILURE;
+	}
+
+	tls_init();
+
+	if(pthread_create(&alert_thread, NULL, alert_sender, NULL) != 0) {
+		fprintf(stderr, "failed to create the alert thread\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(&sample, 0, sizeof(sample));
+	sample.timestamp = time(NULL);
+	sample.co2 = 1950;
+	sample.temp = 22;
+	sample.rh = 45;
+	sample.led_state = RED;
+	alert_push(0, &sample, YELLOW, TEST_SEQ);
+
+	for(waited = 0; atomic_load(&alerts_sent) == 0; waited += 10) {
+		if(waited >= TEST_TIMEOUT * 1000) {
+			fprintf(stderr, "the alert was not retried after %d requests\n",
+					atomic_load(&requests));
+			return EXIT_FAILURE;
+		}
+		sleep_ms(10);
+	}
+
+	printf("alert uploaded after %d requests in %d ms\n",
+			atomic_load(&requests), waited);
+
+	if(atomic_load(&requests) != 2 || atomic_load(&received_state) != RED) {
+		fprintf(stderr, "%d requests with LED state %d, expected 2 with %d\n",
+				atomic_load(&requests), atomic_load(&received_state), RED);
+		return EXIT_FAILURE;
+	}
+
+	// an alert of a relaying device, the socket stands in for the gateway
+	if((udp_fd = loopback_socket(SOCK_DGRAM, &udp_port)) < 0 ||
+			setsockopt(udp_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+				sizeof(timeout)) == -1) {
+		fprintf(stderr, "failed to open the gateway socket: %s\n",
+				strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	relay_conf = conf;
+	relay_conf.relay = "127.0.0.1";
+	relay_conf.gateway_port = udp_port;
+	atomic_store(&current_config, &relay_conf);
+
+	sample.led_state = GREEN;
+	alert_push(0, &sample, YELLOW, TEST_SEQ + 1);
+
+	len = recv(udp_fd, &datagram, sizeof(datagram), 0);
+	if(len < 0) {
+		fprintf(stderr, "no datagram from the relaying device: %s\n",
+				strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if(wire_decode(&datagram, len, room, &seq, &received, &alert) != 0 ||
+			!alert || seq != TEST_SEQ + 1 ||
+			received.led_state != GREEN || received.co2 != 1950 ||
+			strcmp(room, "test-alert") != 0) {
+		fprintf(stderr, "the relayed alert does not match\n");
+		return EXIT_FAILURE;
+	}
+
+	if(atomic_load(&requests) != 2) {
+		fprintf(stderr, "the relayed alert was uploaded as well\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,439 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/test-cycle-budget.c
+ *
+ * Performance test for make check. Runs iaq-measurementd-check, built with
+ * its files in CHECK_DIR, against the emulated sensors of fake-i2c.so and
+ * fails if a measurement cycle needs more syscalls, wakeups or context
+ * switches than given in the checked-in file cycle-budget.
+ *
+ * The wakeups and context switches of the measurement thread are read from
+ * /proc between cycles. Its syscalls are counted with ptrace() afterwards,
+ * every syscall is counted no matter where it is issued. A cycle ends with
+ * the absolute sleep until the next one
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "config.h"
+
+#define CHECK_CONFFILE CHECK_DIR "/" PACKAGE_NAME ".cfg"
+#define CHECK_PIDFILE CHECK_DIR "/" PACKAGE_NAME ".pid"
+#define CHECK_SNAPSHOTFILE CHECK_DIR "/snapshot.bin"
+#define CHECK_LOCKFILE CHECK_DIR "/check.lock"
+
+// the cycles are 2 s apart, the first ones open the state files
+#define CYCLE_PERIOD 2 // in s
+#define WARMUP_CYCLES 2
+#define MEASURED_CYCLES 5
+#define STARTUP_TIMEOUT 10 // in s
+
+// exit status of a skipped test for the automake test driver
+#define EXIT_SKIP 77
+
+// two rooms behind a multiplexer, both sensors measured in every cycle
+static const char *check_config =
+	"i2c_device: \"/dev/i2c-check\"\n"
+	"host: \"127.0.0.1\"\n"
+	"logging_interval: 60\n"
+	"sample_interval_min: 2\n"
+	"sample_interval_max: 2\n"
+	"si7021_period: 2\n"
+	"rooms: (\n"
+	"	{ room: \"check-1\"; channel: 0; green_pin: 0; yellow_pin: 1; "
+	"red_pin: 2; },\n"
+	"	{ room: \"check-2\"; channel: 1; green_pin: 3; yellow_pin: 4; "
+	"red_pin: 5; }\n"
+	")\n";
+
+struct cycle_budget {
+	unsigned int syscalls;
+	unsigned int wakeups;
+	unsigned int context_switches;
+};
+
+// reads the budget file, lines of name and value. # starts a comment
+static int read_budget(struct cycle_budget *budget) {
+	FILE *file;
+	char path[4096], line[256], name[64];
+	const char *srcdir = getenv("srcdir");
+	unsigned int value;
+	int found = 0;
+
+	snprintf(path, sizeof(path), "%s/cycle-budget", srcdir ? srcdir : ".");
+
+	if((file = fopen(path, "r")) == NULL) {
+		fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), file) != NULL) {
+		if(line[0] == '#' || sscanf(line, "%63s %u", name, &value) != 2)
+			continue;
+
+		if(strcmp(name, "syscalls") == 0)
+			budget->syscalls = value;
+		else if(strcmp(name, "wakeups") == 0)
+			budget->wakeups = value;
+		else if(strcmp(name, "context_switches") == 0)
+			budget->context_switches = value;
+		else
+			continue;
+
+		found++;
+	}
+
+	fclose(file);
+
+	if(found != 3) {
+		fprintf(stderr, "%s: syscalls, wakeups and context_switches must be "
+				"set\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+// the daemon tests share CHECK_DIR, a parallel make check runs them one
+// after the other. the lock is released when this process exits
+static int lock_check_dir() {
+	int fd;
+
+	if(mkdir(CHECK_DIR, 0755) == -1 && errno != EEXIST) {
+		fprintf(stderr, "failed to create %s: %s\n", CHECK_DIR,
+				strerror(errno));
+		return -1;
+	}
+
+	if((fd = open(CHECK_LOCKFILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0 ||
+			flock(fd, LOCK_EX) == -1) {
+		fprintf(stderr, "failed to lock %s: %s\n", CHECK_LOCKFILE,
+				strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int write_config() {
+	FILE *file;
+
+	// left by an aborted run
+	remove(CHECK_PIDFILE);
+	remove(CHECK_SNAPSHOTFILE);
+
+	if((file = fopen(CHECK_CONFFILE, "w")) == NULL ||
+			fputs(check_config, file) == EOF || fclose(file) != 0) {
+		fprintf(stderr, "failed to write %s\n", CHECK_CONFFILE);
+		return -1;
+	}
+
+	return 0;
+}
+
+// starts the daemon with the shim. it forks into the background, as this
+// process is a subreaper the daemon stays its child. returns its pid
+static pid_t start_daemon() {
+	struct timespec delay = {0, 100000000L};
+	FILE *pidfile;
+	pid_t pid;
+	int status, i;
+
+	if((pid = fork()) == 0) {
+		setenv("LD_PRELOAD", FAKE_I2C, 1);
+		execl(CHECK_DAEMON, CHECK_DAEMON, NULL);
+		_exit(127);
+	}
+
+	if(pid < 0 || waitpid(pid, &status, 0) != pid ||
+			!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "failed to start %s\n", CHECK_DAEMON);
+		return -1;
+	}
+
+	for(i = 0; i < STARTUP_TIMEOUT * 10; i++) {
+		if((pidfile = fopen(CHECK_PIDFILE, "r")) != NULL) {
+			status = fscanf(pidfile, "%d", &pid);
+			fclose(pidfile);
+			if(status == 1)
+				return pid;
+		}
+
+		nanosleep(&delay, NULL);
+	}
+
+	fprintf(stderr, "%s did not write its pidfile\n", CHECK_DAEMON);
+	return -1;
+}
+
+// the thread named "measurement" by trace_register_thread()
+static pid_t measurement_thread(pid_t pid) {
+	struct timespec delay = {0, 100000000L};
+	struct dirent *entry;
+	char path[PATH_MAX], comm[32];
+	FILE *file;
+	DIR *dir;
+	pid_t tid = -1;
+	int i;
+
+	snprintf(path, sizeof(path), "/proc/%d/task", pid);
+
+	for(i = 0; i < STARTUP_TIMEOUT * 10 && tid < 0; i++) {
+		if((dir = opendir(path)) == NULL)
+			return -1;
+
+		while((entry = readdir(dir)) != NULL && tid < 0) {
+			if(entry->d_name[0] == '.')
+				continue;
+
+			snprintf(path, sizeof(path), "/proc/%d/task/%s/comm", pid,
+					entry->d_name);
+
+			if((file = fopen(path, "r")) == NULL)
+				continue;
+
+			if(fgets(comm, sizeof(comm), file) != NULL &&
+					strcmp(comm, "measurement\n") == 0)
+				tid = atoi(entry->d_name);
+
+			fclose(file);
+		}
+
+		closedir(dir);
+		snprintf(path, sizeof(path), "/proc/%d/task", pid);
+
+		if(tid < 0)
+			nanosleep(&delay, NULL);
+	}
+
+	return tid;
+}
+
+// voluntary switches of tid, each one a wakeup later on, and all switches
+static int context_switches(pid_t pid, pid_t tid, unsigned long *voluntary,
+		unsigned long *all) {
+	char path[64], line[128];
+	unsigned long value;
+	FILE *file;
+	int found = 0;
+
+	snprintf(path, sizeof(path), "/proc/%d/task/%d/status", pid, tid);
+
+	if((file = fopen(path, "r")) == NULL)
+		return -1;
+
+	*all = 0;
+
+	while(fgets(line, sizeof(line), file) != NULL) {
+		if(sscanf(line, "voluntary_ctxt_switches: %lu", &value) == 1) {
+			*voluntary = value;
+			*all += value;
+			found++;
+		}
+
+		else if(sscanf(line, "nonvoluntary_ctxt_switches: %lu", &value)
+				== 1) {
+			*all += value;
+			found++;
+		}
+	}
+
+	fclose(file);
+
+	return found == 2 ? 0 : -1;
+}
+
+// sleeps until the middle of the gap between two cycles, cycles from now.
+// cycles start at multiples of CYCLE_PERIOD of CLOCK_MONOTONIC
+static void sleep_between_cycles(int cycles) {
+	struct timespec now, wakeup = {0, 0};
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	wakeup.tv_sec = (now.tv_sec / CYCLE_PERIOD + cycles) * CYCLE_PERIOD +
+		CYCLE_PERIOD / 2;
+
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL)
+			== EINTR);
+}
+
+// the sleep at the end of a cycle, nanosleep() of glibc is a relative
+// clock_nanosleep() as well
+static int cycle_sleep(const struct __ptrace_syscall_info *info) {
+	if(info->op != PTRACE_SYSCALL_INFO_ENTRY ||
+			info->entry.args[0] != CLOCK_MONOTONIC ||
+			info->entry.args[1] != TIMER_ABSTIME)
+		return 0;
+
+#ifdef SYS_clock_nanosleep_time64
+	if(info->entry.nr == SYS_clock_nanosleep_time64)
+		return 1;
+#endif
+
+	return info->entry.nr == SYS_clock_nanosleep;
+}
+
+// counts the syscalls of tid in each of cycles cycles. returns the maximum,
+// -1 on errors and -2 if tracing is not permitted
+static long count_syscalls(pid_t tid, int cycles) {
+	struct __ptrace_syscall_info info;
+	long count = 0, max = 0;
+	int status, signal, started = 0;
+
+	if(ptrace(PTRACE_SEIZE, tid, NULL, PTRACE_O_TRACESYSGOOD) == -1) {
+		fprintf(stderr, "failed to trace the measurement thread: %s\n",
+				strerror(errno));
+		return errno == EPERM ? -2 : -1;
+	}
+
+	if(ptrace(PTRACE_INTERRUPT, tid, NULL, NULL) == -1)
+		return -1;
+
+	while(cycles > 0) {
+		if(waitpid(tid, &status, __WALL) != tid || !WIFSTOPPED(status))
+			return -1;
+
+		signal = WSTOPSIG(status);
+
+		if(signal == (SIGTRAP | 0x80)) {
+			signal = 0;
+
+			if(ptrace(PTRACE_GET_SYSCALL_INFO, tid, sizeof(info), &info) <= 0)
+				return -1;
+
+			if(info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+				count++;
+
+				// the sleep ends the cycle. interrupted while sleeping, the
+				// sleep is continued by restart_syscall()
+				if(cycle_sleep(&info)) {
+					if(started) {
+						printf("cycle: %ld syscalls\n", count);
+						max = count > max ? count : max;
+						cycles--;
+					}
+
+					started = 1;
+					count = 0;
+				}
+
+				else if(info.entry.nr == SYS_restart_syscall && !started) {
+					started = 1;
+					count = 0;
+				}
+			}
+		}
+
+		// the stop of PTRACE_INTERRUPT
+		else if(status >> 16 == PTRACE_EVENT_STOP)
+			signal = 0;
+
+		if(cycles > 0 && ptrace(PTRACE_SYSCALL, tid, NULL, signal) == -1)
+			return -1;
+	}
+
+	ptrace(PTRACE_DETACH, tid, NULL, NULL);
+
+	return max;
+}
+
+int main() {
+	struct cycle_budget budget;
+	unsigned long voluntary_start, voluntary_end, all_start, all_end;
+	unsigned long wakeups, switches;
+	long syscalls;
+	pid_t pid, tid;
+	int status, result = EXIT_FAILURE;
+
+	if(read_budget(&budget) != 0 || lock_check_dir() != 0 ||
+			write_config() != 0)
+		return EXIT_FAILURE;
+
+	// the daemon forks into the background, it must stay a child of this
+	// process to be traced
+	if(prctl(PR_SET_CHILD_SUBREAPER, 1) == -1) {
+		fprintf(stderr, "failed to become a subreaper: %s\n", strerror(errno));
+		return EXIT_SKIP;
+	}
+
+	if((pid = start_daemon()) < 0)
+		return EXIT_FAILURE;
+
+	if((tid = measurement_thread(pid)) < 0) {
+		fprintf(stderr, "measurement thread not found\n");
+		goto out;
+	}
+
+	sleep_between_cycles(WARMUP_CYCLES);
+
+	if(context_switches(pid, tid, &voluntary_start, &all_start) != 0) {
+		fprintf(stderr, "failed to read the context switches\n");
+		goto out;
+	}
+
+	sleep_between_cycles(MEASURED_CYCLES);
+
+	if(context_switches(pid, tid, &voluntary_end, &all_end) != 0) {
+		fprintf(stderr, "failed to read the context switches\n");
+		goto out;
+	}
+
+	// rounded up
+	wakeups = (voluntary_end - voluntary_start + MEASURED_CYCLES - 1) /
+		MEASURED_CYCLES;
+	switches = (all_end - all_start + MEASURED_CYCLES - 1) / MEASURED_CYCLES;
+
+	sleep_between_cycles(1);
+	syscalls = count_syscalls(tid, MEASURED_CYCLES);
+
+	if(syscalls == -2) {
+		result = EXIT_SKIP;
+		goto out;
+	}
+
+	if(syscalls < 0) {
+		fprintf(stderr, "failed to count syscalls\n");
+		goto out;
+	}
+
+	printf("per cycle: %ld syscalls (budget %u), %lu wakeups (budget %u), "
+			"%lu context switches (budget %u)\n", syscalls, budget.syscalls,
+			wakeups, budget.wakeups, switches, budget.context_switches);
+
+	if(syscalls <= budget.syscalls && wakeups <= budget.wakeups &&
+			switches <= budget.context_switches)
+		result = EXIT_SUCCESS;
+	else
+		fprintf(stderr, "measurement cycle over budget, see cycle-budget\n");
+
+out:
+	kill(pid, SIGTERM);
+	waitpid(pid, &status, 0);
+
+	return result;
+}
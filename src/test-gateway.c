@@ -0,0 +1,363 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/test-gateway.c
+ *
+ * Gateway test for make check. relay_log() sends the samples of three rooms
+ * over loopback UDP to the gateway thread, which forwards them to a stand-in
+ * for device_interface.php. Every sample must arrive with its values, except
+ * those of the room without any measurement, which are dropped as empty. The
+ * first request is answered with an HTTP error, the gateway must retry it.
+ * A state change sent with relay_alert() is forwarded right away
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <curl/curl.h>
+
+#include "config.h"
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "history.h"
+#include "gateway.h"
+#include "stats.h"
+#include "tls.h"
+#include "log.h"
+
+#define TEST_ROOMS 3
+// relay_log() calls, the two rooms with samples fill a batch that is
+// forwarded without waiting for GATEWAY_FLUSH_INTERVAL
+#define TEST_INTERVALS (GATEWAY_FLUSH_COUNT / 2)
+// the rejected readings are retried after GATEWAY_FLUSH_INTERVAL
+#define TEST_TIMEOUT (GATEWAY_FLUSH_INTERVAL + 20) // in s
+// a state change is forwarded well before GATEWAY_FLUSH_INTERVAL
+#define ALERT_TIMEOUT 2 // in s
+#define ALERT_CO2 1950
+
+#define STANDIN_BUFFER 2048
+
+_Atomic(struct iaq_config *) current_config;
+
+static struct iaq_config conf;
+
+// requests accepted by the stand-in per room, and the values of the last
+static struct {
+	atomic_int requests;
+	atomic_int co2;
+	atomic_int led_state;
+} received[TEST_ROOMS];
+static atomic_int unexpected;
+// requests answered with 500 Internal Server Error
+static atomic_int rejected;
+
+// the shared upload code terminates the daemon on fatal errors
+void terminate(int status) {
+	log_flush();
+	exit(status);
+}
+
+// counts one request, a GET of device_interface.php with the room and its
+// values as query parameters. the first one is rejected. returns the
+// response
+static const char *standin_count(const char *request) {
+	static const char ok[] = "HTTP/1.1 200 OK\r\n"
+		"Content-Length: 0\r\n\r\n";
+	static const char error[] = "HTTP/1.1 500 Internal Server Error\r\n"
+		"Content-Length: 0\r\n\r\n";
+	char room[32];
+	int co2, led_state, i;
+	const char *query;
+
+	query = strstr(request, "?action=log&room=");
+	if(strncmp(request, "GET /device_interface.php?", 26) != 0 ||
+			query == NULL || sscanf(query, "?action=log&room=%31[^&]&co2=%d&"
+				"temp=%*f&rh=%*f&led_state=%d", room, &co2, &led_state)
+			!= 3) {
+		atomic_fetch_add(&unexpected, 1);
+		return ok;
+	}
+
+	// served by one thread
+	if(atomic_load(&rejected) == 0) {
+		atomic_store(&rejected, 1);
+		return error;
+	}
+
+	for(i = 0; i < TEST_ROOMS; i++)
+		if(strcmp(room, conf.rooms[i].room) == 0) {
+			atomic_store(&received[i].co2, co2);
+			atomic_store(&received[i].led_state, led_state);
+			atomic_fetch_add(&received[i].requests, 1);
+			return ok;
+		}
+
+	atomic_fetch_add(&unexpected, 1);
+	return ok;
+}
+
+// serves the persistent connections of the gateway one after the other
+static void *standin_server(void *arg) {
+	char buffer[STANDIN_BUFFER];
+	const char *response;
+	int listen_fd = *(int *)arg;
+	size_t len;
+	ssize_t n;
+	char *end;
+	int fd;
+
+	while((fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC)) >= 0) {
+		len = 0;
+
+		while((n = read(fd, buffer + len, sizeof(buffer) - 1 - len)) > 0) {
+			len += n;
+			buffer[len] = '\0';
+
+			// requests without a body, each ends with an empty line
+			while((end = strstr(buffer, "\r\n\r\n")) != NULL) {
+				*end = '\0';
+				response = standin_count(buffer);
+				if(write(fd, response, strlen(response)) != strlen(response))
+					break;
+
+				len -= end + 4 - buffer;
+				memmove(buffer, end + 4, len + 1);
+			}
+
+			if(len == sizeof(buffer) - 1)
+				break;
+		}
+
+		close(fd);
+	}
+
+	return NULL;
+}
+
+// listens on an ephemeral TCP port of the loopback interface. returns the
+// port or -1
+static int standin_start(pthread_t *thread) {
+	static int listen_fd;
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(listen_fd < 0 ||
+			bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+			listen(listen_fd, 4) == -1 ||
+			getsockname(listen_fd, (struct sockaddr *)&addr, &len) == -1 ||
+			pthread_create(thread, NULL, standin_server, &listen_fd) != 0)
+		return -1;
+
+	return ntohs(addr.sin_port);
+}
+
+// binds loopback UDP port (0 for an ephemeral one). returns the port, or -1
+// if it is in use
+static int udp_bind(int port) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+
+	if((fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+			getsockname(fd, (struct sockaddr *)&addr, &len) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+
+	return ntohs(addr.sin_port);
+}
+
+static void sleep_ms(long ms) {
+	struct timespec t = {ms / 1000, ms % 1000 * 1000000};
+
+	nanosleep(&t, NULL);
+}
+
+int main() {
+	pthread_t standin_thread, gateway_thread;
+	struct sample samples[TEST_ROOMS];
+	uint32_t seqs[TEST_ROOMS];
+	char host[32];
+	int http_port, i, waited;
+
+	if((http_port = standin_start(&standin_thread)) < 0) {
+		fprintf(stderr, "failed to start the stand-in server: %s\n",
+				strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	// a free port for the gateway, taken again right away
+	if((conf.gateway_port = udp_bind(0)) < 0) {
+		fprintf(stderr, "failed to find a free UDP port: %s\n",
+				strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	snprintf(host, sizeof(host), "127.0.0.1:%d", http_port);
+	conf.host = host;
+	conf.relay = "127.0.0.1";
+	conf.gateway = 1;
+	conf.nrooms = TEST_ROOMS;
+	conf.rooms[0].room = "test-both";
+	conf.rooms[1].room = "test-empty";
+	conf.rooms[2].room = "test-temp-rh";
+	atomic_store(&current_config, &conf);
+
+	if(curl_global_init(CURL_GLOBAL_ALL)) {
+		fprintf(stderr, "failed to initialize libcurl\n");
+		return EXIT_FAILURE;
+	}
+
+	tls_init();
+
+	if(pthread_create(&gateway_thread, NULL, gateway, NULL) != 0) {
+		fprintf(stderr, "failed to create the gateway thread\n");
+		return EXIT_FAILURE;
+	}
+
+	// datagrams sent before the gateway is bound are lost
+	for(waited = 0; udp_bind(conf.gateway_port) >= 0; waited += 10) {
+		if(waited >= TEST_TIMEOUT * 1000) {
+			fprintf(stderr, "gateway did not bind port %d\n",
+					conf.gateway_port);
+			return EXIT_FAILURE;
+		}
+		sleep_ms(10);
+	}
+
+	memset(samples, 0, sizeof(samples));
+	for(i = 0; i < TEST_ROOMS; i++) {
+		samples[i].timestamp = time(NULL);
+		samples[i].led_state = GREEN;
+	}
+
+	samples[0].co2 = 650;
+	samples[0].temp = 22;
+	samples[0].rh = 45;
+	samples[0].led_state = YELLOW;
+
+	// never measured, relay_log() leaves it out
+	samples[1].quality = SAMPLE_EMPTY;
+
+	// the k-30 is missing, the other metrics are relayed
+	samples[2].temp = 21.5;
+	samples[2].rh = 40;
+	samples[2].quality = SAMPLE_CO2_MISSING;
+
+	for(i = 0; i < TEST_INTERVALS; i++) {
+		seqs[0] = seqs[1] = seqs[2] = i;
+		if(relay_log(samples, seqs, TEST_ROOMS) != 0) {
+			fprintf(stderr, "relay_log() failed\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	for(waited = 0; atomic_load(&received[0].requests) +
+			atomic_load(&received[2].requests) < 2 * TEST_INTERVALS;
+			waited += 10) {
+		if(waited >= TEST_TIMEOUT * 1000)
+			break;
+		sleep_ms(10);
+	}
+
+	// requests after the expected ones would be counted as well
+	sleep_ms(100);
+
+	printf("received %u datagrams, forwarded %u readings\n",
+			atomic_load(&gateway_received), atomic_load(&gateway_forwarded));
+	for(i = 0; i < TEST_ROOMS; i++)
+		printf("%s: %d requests\n", conf.rooms[i].room,
+				atomic_load(&received[i].requests));
+
+	if(atomic_load(&received[0].requests) != TEST_INTERVALS ||
+			atomic_load(&received[2].requests) != TEST_INTERVALS) {
+		fprintf(stderr, "relayed samples did not arrive\n");
+		return EXIT_FAILURE;
+	}
+
+	if(atomic_load(&received[1].requests) != 0) {
+		fprintf(stderr, "empty samples were relayed\n");
+		return EXIT_FAILURE;
+	}
+
+	if(atomic_load(&rejected) != 1) {
+		fprintf(stderr, "the stand-in rejected %d requests instead of 1\n",
+				atomic_load(&rejected));
+		return EXIT_FAILURE;
+	}
+
+	if(atomic_load(&unexpected) != 0) {
+		fprintf(stderr, "%d unexpected requests\n", atomic_load(&unexpected));
+		return EXIT_FAILURE;
+	}
+
+	if(atomic_load(&received[0].co2) != 650 ||
+			atomic_load(&received[0].led_state) != YELLOW ||
+			atomic_load(&received[2].led_state) != GREEN) {
+		fprintf(stderr, "relayed values changed on the way\n");
+		return EXIT_FAILURE;
+	}
+
+	if(atomic_load(&gateway_received) != 2 * TEST_INTERVALS ||
+			atomic_load(&gateway_invalid) != 0) {
+		fprintf(stderr, "gateway statistics do not match the datagrams\n");
+		return EXIT_FAILURE;
+	}
+
+	// alone in the batch, it would wait for GATEWAY_FLUSH_INTERVAL
+	samples[0].co2 = ALERT_CO2;
+	samples[0].led_state = RED;
+	if(relay_alert(0, &samples[0], TEST_INTERVALS) != 0) {
+		fprintf(stderr, "relay_alert() failed\n");
+		return EXIT_FAILURE;
+	}
+
+	for(waited = 0; atomic_load(&received[0].co2) != ALERT_CO2; waited += 10) {
+		if(waited >= ALERT_TIMEOUT * 1000) {
+			fprintf(stderr, "the state change was not forwarded right away\n");
+			return EXIT_FAILURE;
+		}
+		sleep_ms(10);
+	}
+
+	printf("state change forwarded after %d ms\n", waited);
+
+	if(atomic_load(&received[0].led_state) != RED) {
+		fprintf(stderr, "the state change was forwarded without its state\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
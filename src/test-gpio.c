@@ -0,0 +1,319 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/test-gpio.c
+ *
+ * GPIO test for make check. The open() and ioctl() calls of gpio.c are
+ * served by a simulated chip, which checks the GPIO v2 line requests as the
+ * kernel does and keeps the values of its lines. The LEDs of three rooms are
+ * switched like set_leds() and leds_off() do, one ioctl() per change
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <linux/gpio.h>
+
+#include "config.h"
+#include "iaq-measurementd.h"
+#include "gpio.h"
+
+#define FAKE_CHIP "/dev/gpiochip-check"
+#define FAKE_CHIP_LINES 32
+
+#define TEST_ROOMS 3
+
+// the simulated chip, one line request at a time
+static struct {
+	int chip_fd;
+	int request_fd;
+	unsigned int opened;
+	unsigned int set_calls;
+	struct gpio_v2_line_request request;
+	int values[FAKE_CHIP_LINES];
+} chip = {-1, -1};
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_close)(int);
+static int (*real_ioctl)(int, unsigned long, ...);
+
+int open(const char *path, int flags, ...) {
+	va_list ap;
+	mode_t mode = 0;
+
+	if(real_open == NULL)
+		real_open = dlsym(RTLD_NEXT, "open");
+
+	if(flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	if(strcmp(path, FAKE_CHIP) != 0)
+		return real_open(path, flags, mode);
+
+	chip.opened++;
+	chip.chip_fd = real_open("/dev/null", flags);
+
+	return chip.chip_fd;
+}
+
+int close(int fd) {
+	if(real_close == NULL)
+		real_close = dlsym(RTLD_NEXT, "close");
+
+	if(fd == chip.chip_fd)
+		chip.chip_fd = -1;
+	if(fd == chip.request_fd)
+		chip.request_fd = -1;
+
+	return real_close(fd);
+}
+
+// GPIO_V2_GET_LINE_IOCTL of the chip, the checks of linereq_create() in
+// drivers/gpio/gpiolib-cdev.c for output lines
+static int fake_get_line(struct gpio_v2_line_request *request) {
+	unsigned int i, j;
+
+	if(request->num_lines == 0 || request->num_lines > GPIO_V2_LINES_MAX ||
+			request->config.num_attrs > GPIO_V2_LINE_NUM_ATTRS_MAX ||
+			request->config.flags != GPIO_V2_LINE_FLAG_OUTPUT)
+		return -EINVAL;
+
+	for(i = 0; i < sizeof(request->padding) / sizeof(request->padding[0]);
+			i++)
+		if(request->padding[i] != 0)
+			return -EINVAL;
+
+	for(i = 0; i < request->num_lines; i++) {
+		if(request->offsets[i] >= FAKE_CHIP_LINES)
+			return -EINVAL;
+
+		// a line cannot be requested twice
+		for(j = 0; j < i; j++)
+			if(request->offsets[j] == request->offsets[i])
+				return -EBUSY;
+	}
+
+	if(chip.request_fd >= 0)
+		return -EBUSY;
+
+	if((chip.request_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+		return -errno;
+
+	// outputs start inactive
+	memset(chip.values, 0, sizeof(chip.values));
+	chip.request = *request;
+	request->fd = chip.request_fd;
+
+	return 0;
+}
+
+// GPIO_V2_LINE_SET_VALUES_IOCTL of a line request. bits of the mask beyond
+// the requested lines are ignored, as by the kernel
+static int fake_set_values(struct gpio_v2_line_values *values) {
+	unsigned int i;
+
+	if(values->mask == 0)
+		return -EINVAL;
+
+	chip.set_calls++;
+
+	for(i = 0; i < chip.request.num_lines; i++)
+		if(values->mask & (1ULL << i))
+			chip.values[chip.request.offsets[i]] = (values->bits >> i) & 1;
+
+	return 0;
+}
+
+int ioctl(int fd, unsigned long request, ...) {
+	va_list ap;
+	void *arg;
+	int status;
+
+	if(real_ioctl == NULL)
+		real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if(fd >= 0 && fd == chip.chip_fd && request == GPIO_V2_GET_LINE_IOCTL)
+		status = fake_get_line(arg);
+	else if(fd >= 0 && fd == chip.request_fd &&
+			request == GPIO_V2_LINE_SET_VALUES_IOCTL)
+		status = fake_set_values(arg);
+	else if(fd >= 0 && (fd == chip.chip_fd || fd == chip.request_fd))
+		status = -ENOTTY;
+	else
+		return real_ioctl(fd, request, arg);
+
+	if(status < 0) {
+		errno = -status;
+		return -1;
+	}
+
+	return 0;
+}
+
+// lines of the rooms as given by room_pin(), green, yellow and red
+static const unsigned int offsets[TEST_ROOMS * 3] = {
+	4, 5, 6, 17, 18, 19, 22, 23, 24,
+};
+
+// the LEDs expected per room, OFF or the one switched on
+static int check_leds(const int *led_states, const char *step) {
+	int room, led, expected;
+
+	for(room = 0; room < TEST_ROOMS; room++)
+		for(led = GREEN; led <= RED; led++) {
+			expected = led_states[room] == led;
+			if(chip.values[offsets[room * 3 + led - GREEN]] != expected) {
+				fprintf(stderr, "%s: line %u of room %d is %d, expected %d\n",
+						step, offsets[room * 3 + led - GREEN], room,
+						chip.values[offsets[room * 3 + led - GREEN]], expected);
+				return -1;
+			}
+		}
+
+	return 0;
+}
+
+// switches the LEDs of room like set_leds(), with one ioctl()
+static int switch_leds(int fd, int room, int led_state, int *led_states) {
+	unsigned int calls = chip.set_calls;
+
+	if(gpio_set_values(fd, led_state == OFF ? 0 :
+				1ULL << (room * 3 + led_state - GREEN),
+				7ULL << (room * 3)) != 0) {
+		fprintf(stderr, "failed to set LEDs of room %d: %s\n", room,
+				strerror(errno));
+		return -1;
+	}
+
+	if(chip.set_calls != calls + 1) {
+		fprintf(stderr, "LEDs of room %d not set by one ioctl()\n", room);
+		return -1;
+	}
+
+	led_states[room] = led_state;
+
+	return 0;
+}
+
+int main() {
+	static const struct {
+		int room, led_state;
+	} steps[] = {
+		{1, YELLOW}, {0, RED}, {2, GREEN}, {1, GREEN}, {0, OFF}, {2, RED},
+	};
+	unsigned int bad_offsets[2] = {4, FAKE_CHIP_LINES};
+	unsigned int many[GPIO_V2_LINES_MAX + 1];
+	int led_states[TEST_ROOMS] = {OFF, OFF, OFF};
+	char step[32];
+	unsigned int i;
+	int fd;
+
+	fd = gpio_request_outputs(FAKE_CHIP, offsets, TEST_ROOMS * 3);
+	if(fd < 0) {
+		fprintf(stderr, "failed to request the LED lines\n");
+		return EXIT_FAILURE;
+	}
+
+	if(fd != chip.request_fd || chip.chip_fd != -1) {
+		fprintf(stderr, "the chip is not closed after the request\n");
+		return EXIT_FAILURE;
+	}
+
+	if(strcmp(chip.request.consumer, PACKAGE) != 0 ||
+			chip.request.num_lines != TEST_ROOMS * 3) {
+		fprintf(stderr, "line request with consumer \"%s\" and %u lines\n",
+				chip.request.consumer, chip.request.num_lines);
+		return EXIT_FAILURE;
+	}
+
+	for(i = 0; i < TEST_ROOMS * 3; i++)
+		if(chip.request.offsets[i] != offsets[i]) {
+			fprintf(stderr, "line %u requested at offset %u instead of %u\n",
+					i, chip.request.offsets[i], offsets[i]);
+			return EXIT_FAILURE;
+		}
+
+	if(check_leds(led_states, "after the request") != 0)
+		return EXIT_FAILURE;
+
+	// the other rooms keep their LEDs
+	for(i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+		if(switch_leds(fd, steps[i].room, steps[i].led_state, led_states)
+				!= 0)
+			return EXIT_FAILURE;
+
+		snprintf(step, sizeof(step), "step %u", i + 1);
+		if(check_leds(led_states, step) != 0)
+			return EXIT_FAILURE;
+	}
+
+	// leds_off() selects all lines, also those not requested
+	if(gpio_set_values(fd, 0, ~0ULL) != 0) {
+		fprintf(stderr, "failed to switch off all LEDs: %s\n",
+				strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	for(i = 0; i < TEST_ROOMS; i++)
+		led_states[i] = OFF;
+	if(check_leds(led_states, "all off") != 0)
+		return EXIT_FAILURE;
+
+	if(gpio_set_values(fd, 1, 0) != -1 || errno != EINVAL) {
+		fprintf(stderr, "an empty mask was accepted\n");
+		return EXIT_FAILURE;
+	}
+
+	close(fd);
+
+	// rejected by the chip, nothing stays open
+	if(gpio_request_outputs(FAKE_CHIP, bad_offsets, 2) != -1 ||
+			chip.chip_fd != -1 || chip.request_fd != -1) {
+		fprintf(stderr, "a line beyond the chip was requested\n");
+		return EXIT_FAILURE;
+	}
+
+	// rejected before the chip is opened
+	memset(many, 0, sizeof(many));
+	i = chip.opened;
+	if(gpio_request_outputs(FAKE_CHIP, many, GPIO_V2_LINES_MAX + 1) != -1 ||
+			chip.opened != i) {
+		fprintf(stderr, "more than %d lines were requested\n",
+				GPIO_V2_LINES_MAX);
+		return EXIT_FAILURE;
+	}
+
+	if(gpio_request_outputs("/nonexistent/gpiochip0", offsets, 3) != -1) {
+		fprintf(stderr, "a missing chip was opened\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("LEDs of %d rooms switched by %u ioctl() calls\n", TEST_ROOMS,
+			chip.set_calls);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,247 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/test-health.c
+ *
+ * Sensor health test for make check. Runs iaq-measurementd-check against the
+ * emulated sensors of fake-i2c.so and lets the multiplexer NAK every write
+ * once the sensors were measured. A failing multiplexer says nothing about
+ * the sensors behind it, they must stay healthy for more cycles than it
+ * takes to quarantine a failing sensor
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "config.h"
+#include "health.h"
+
+#define CHECK_CONFFILE CHECK_DIR "/" PACKAGE_NAME ".cfg"
+#define CHECK_PIDFILE CHECK_DIR "/" PACKAGE_NAME ".pid"
+#define CHECK_SNAPSHOTFILE CHECK_DIR "/snapshot.bin"
+#define CHECK_LOCKFILE CHECK_DIR "/check.lock"
+// while it exists, the multiplexer of fake-i2c.so NAKs
+#define CHECK_MUX_NAK CHECK_DIR "/mux-nak"
+
+#define CYCLE_PERIOD 2 // in s
+#define STARTUP_TIMEOUT 10 // in s
+// cycles with a failing multiplexer, more than quarantine a sensor
+#define NAK_CYCLES (HEALTH_QUARANTINE_FAILURES + 2)
+#define ROOMS 2
+
+// exit status of a skipped test for the automake test driver
+#define EXIT_SKIP 77
+
+// two rooms behind a multiplexer, both sensors measured in every cycle
+static const char *check_config =
+	"i2c_device: \"/dev/i2c-check\"\n"
+	"host: \"127.0.0.1\"\n"
+	"logging_interval: 60\n"
+	"sample_interval_min: 2\n"
+	"sample_interval_max: 2\n"
+	"si7021_period: 2\n"
+	"rooms: (\n"
+	"	{ room: \"check-1\"; channel: 0; green_pin: 0; yellow_pin: 1; "
+	"red_pin: 2; },\n"
+	"	{ room: \"check-2\"; channel: 1; green_pin: 3; yellow_pin: 4; "
+	"red_pin: 5; }\n"
+	")\n";
+
+// health state files of both rooms, see write_state_files()
+static const char *health_files[] = {
+	CHECK_DIR "/co2_health", CHECK_DIR "/temp_rh_health",
+	CHECK_DIR "/room1/co2_health", CHECK_DIR "/room1/temp_rh_health",
+};
+
+// the daemon tests share CHECK_DIR, a parallel make check runs them one
+// after the other. the lock is released when this process exits
+static int lock_check_dir() {
+	int fd;
+
+	if(mkdir(CHECK_DIR, 0755) == -1 && errno != EEXIST) {
+		fprintf(stderr, "failed to create %s: %s\n", CHECK_DIR,
+				strerror(errno));
+		return -1;
+	}
+
+	if((fd = open(CHECK_LOCKFILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0 ||
+			flock(fd, LOCK_EX) == -1) {
+		fprintf(stderr, "failed to lock %s: %s\n", CHECK_LOCKFILE,
+				strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int write_config() {
+	FILE *file;
+
+	// left by an aborted run
+	remove(CHECK_PIDFILE);
+	remove(CHECK_SNAPSHOTFILE);
+	remove(CHECK_MUX_NAK);
+
+	if((file = fopen(CHECK_CONFFILE, "w")) == NULL ||
+			fputs(check_config, file) == EOF || fclose(file) != 0) {
+		fprintf(stderr, "failed to write %s\n", CHECK_CONFFILE);
+		return -1;
+	}
+
+	return 0;
+}
+
+// starts the daemon with the shim. it forks into the background, as this
+// process is a subreaper the daemon stays its child. returns its pid
+static pid_t start_daemon() {
+	struct timespec delay = {0, 100000000L};
+	FILE *pidfile;
+	pid_t pid;
+	int status, i;
+
+	if((pid = fork()) == 0) {
+		setenv("LD_PRELOAD", FAKE_I2C, 1);
+		setenv("FAKE_I2C_MUX_NAK", CHECK_MUX_NAK, 1);
+		execl(CHECK_DAEMON, CHECK_DAEMON, NULL);
+		_exit(127);
+	}
+
+	if(pid < 0 || waitpid(pid, &status, 0) != pid ||
+			!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "failed to start %s\n", CHECK_DAEMON);
+		return -1;
+	}
+
+	for(i = 0; i < STARTUP_TIMEOUT * 10; i++) {
+		if((pidfile = fopen(CHECK_PIDFILE, "r")) != NULL) {
+			status = fscanf(pidfile, "%d", &pid);
+			fclose(pidfile);
+			if(status == 1)
+				return pid;
+		}
+
+		nanosleep(&delay, NULL);
+	}
+
+	fprintf(stderr, "%s did not write its pidfile\n", CHECK_DAEMON);
+	return -1;
+}
+
+// reads the first word of a state file into value. returns 0 on success
+static int read_state(const char *path, char *value, size_t len) {
+	char format[16];
+	FILE *file;
+	int status;
+
+	if((file = fopen(path, "r")) == NULL)
+		return -1;
+
+	snprintf(format, sizeof(format), "%%%zus", len - 1);
+	status = fscanf(file, format, value);
+	fclose(file);
+
+	return status == 1 ? 0 : -1;
+}
+
+// waits until the co2 of both rooms was measured
+static int wait_measured() {
+	struct timespec delay = {0, 100000000L};
+	char co2[2][16];
+	int i;
+
+	for(i = 0; i < STARTUP_TIMEOUT * 10; i++) {
+		if(read_state(CHECK_DIR "/co2", co2[0], sizeof(co2[0])) == 0 &&
+				read_state(CHECK_DIR "/room1/co2", co2[1],
+					sizeof(co2[1])) == 0 &&
+				strcmp(co2[0], "0") != 0 && strcmp(co2[1], "0") != 0)
+			return 0;
+
+		nanosleep(&delay, NULL);
+	}
+
+	fprintf(stderr, "the sensors were not measured\n");
+	return -1;
+}
+
+int main() {
+	struct timespec nak_time = {NAK_CYCLES * CYCLE_PERIOD, 0};
+	struct stat st;
+	char health[32];
+	pid_t pid;
+	int status, i, result = EXIT_FAILURE;
+	FILE *file;
+
+	if(lock_check_dir() != 0 || write_config() != 0)
+		return EXIT_FAILURE;
+
+	if(prctl(PR_SET_CHILD_SUBREAPER, 1) == -1) {
+		fprintf(stderr, "failed to become a subreaper: %s\n", strerror(errno));
+		return EXIT_SKIP;
+	}
+
+	if((pid = start_daemon()) < 0)
+		return EXIT_FAILURE;
+
+	if(wait_measured() != 0)
+		goto out;
+
+	if((file = fopen(CHECK_MUX_NAK, "w")) == NULL || fclose(file) != 0) {
+		fprintf(stderr, "failed to create %s\n", CHECK_MUX_NAK);
+		goto out;
+	}
+
+	while(nanosleep(&nak_time, &nak_time) == -1 && errno == EINTR);
+
+	if(stat(CHECK_MUX_NAK, &st) == -1)
+		st.st_size = 0;
+
+	// one NAK per room and cycle
+	if(st.st_size < HEALTH_QUARANTINE_FAILURES * ROOMS) {
+		fprintf(stderr, "the multiplexer NAKed only %lld writes\n",
+				(long long)st.st_size);
+		goto out;
+	}
+
+	printf("the multiplexer NAKed %lld writes\n", (long long)st.st_size);
+	result = EXIT_SUCCESS;
+
+	for(i = 0; i < sizeof(health_files) / sizeof(health_files[0]); i++) {
+		if(read_state(health_files[i], health, sizeof(health)) != 0) {
+			fprintf(stderr, "failed to read %s\n", health_files[i]);
+			result = EXIT_FAILURE;
+		}
+
+		else if(strcmp(health, "healthy") != 0) {
+			fprintf(stderr, "%s: %s instead of healthy\n", health_files[i],
+					health);
+			result = EXIT_FAILURE;
+		}
+	}
+
+out:
+	remove(CHECK_MUX_NAK);
+	kill(pid, SIGTERM);
+	waitpid(pid, &status, 0);
+
+	return result;
+}
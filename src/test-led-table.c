@@ -0,0 +1,85 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/test-led-table.c
+ *
+ * LED table test for make check. Compares compile_led_rules() and
+ * led_step() exhaustively against the CO2 if-chain LEDsystem() used before
+ * the decision tables: every LED state and every CO2 value of the K-30 range,
+ * for a grid of thresholds and hystereses
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "iaq-measurementd.h"
+#include "led.h"
+
+#define CO2_MAX 10000 // measurement range of the k-30, in ppm
+
+// thresholds from 0 to CO2_MAX, not aligned to round values
+#define THRESHOLD_STEP 333 // in ppm
+
+static const int hystereses[] = {0, 1, 50, 199, 200, 201, 500, 1000, 10000};
+
+// the if-chain of LEDsystem() before the decision tables, without the LED
+// updates. returns the new LED state
+static int led_chain(int co2, int led_state, int yellow, int red,
+		int hysteresis) {
+	if((led_state == RED && co2 > (red - hysteresis)) ||
+			(led_state == YELLOW && co2 > red) ||
+			(led_state == OFF && co2 > red))
+		return RED;
+
+	else if((led_state == YELLOW && co2 < (yellow - hysteresis)) ||
+			(led_state == GREEN && co2 < yellow) ||
+			(led_state == OFF && co2 < yellow))
+		return GREEN;
+
+	else
+		return YELLOW;
+}
+
+int main() {
+	struct led_rule rules[4];
+	unsigned long checked = 0, mismatches = 0;
+	int yellow, red, h, state, co2, expected, actual;
+
+	// yellow > red is rejected by parse_config()
+	for(yellow = 0; yellow <= CO2_MAX; yellow += THRESHOLD_STEP)
+		for(red = yellow; red <= CO2_MAX; red += THRESHOLD_STEP)
+			for(h = 0; h < sizeof(hystereses) / sizeof(hystereses[0]); h++) {
+				compile_led_rules(rules, yellow, red, hystereses[h]);
+
+				for(state = OFF; state <= RED; state++)
+					for(co2 = 0; co2 <= CO2_MAX; co2++) {
+						expected = led_chain(co2, state, yellow, red,
+								hystereses[h]);
+						actual = led_step(rules, state, co2);
+						checked++;
+
+						if(actual == expected)
+							continue;
+
+						// the first ones are enough to find the rule
+						if(mismatches++ < 10)
+							fprintf(stderr, "yellow %d, red %d, hysteresis "
+									"%d, state %d, co2 %d: %d instead of %d\n",
+									yellow, red, hystereses[h], state, co2,
+									actual, expected);
+					}
+			}
+
+	printf("%lu transitions checked, %lu mismatches\n", checked, mismatches);
+
+	return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
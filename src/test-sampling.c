@@ -0,0 +1,99 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/test-sampling.c
+ *
+ * Adaptive sampling test for make check. A room with stable co2 must be
+ * sampled at sample_interval_max in every LED state, one close to the next
+ * state change or with fast changing co2 more often
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "sampling.h"
+
+#define INTERVAL_MIN 2 // in s
+#define INTERVAL_MAX 600 // in s
+
+// the slope of a jump to a new value is averaged away by then
+#define SETTLE_SAMPLES 30
+
+_Atomic(struct iaq_config *) current_config;
+
+static struct iaq_config conf;
+static struct timespec now;
+
+// samples room 0 from co2 on with the given slope (in ppm/min) until the
+// average follows it. returns the interval afterwards
+static long settle(int co2, float slope, int led_state) {
+	long interval = INTERVAL_MAX;
+	int i;
+
+	for(i = 0; i < SETTLE_SAMPLES; i++) {
+		now.tv_sec += interval;
+		co2 += slope * interval / 60;
+		sampling_update(0, co2, led_state, &now);
+		interval = sampling_interval(1);
+	}
+
+	return interval;
+}
+
+static int check(const char *name, long interval, long min, long max) {
+	if(interval >= min && interval <= max)
+		return 0;
+
+	fprintf(stderr, "%s: %ld s between samples, expected %ld to %ld s\n",
+			name, interval, min, max);
+	return 1;
+}
+
+int main() {
+	int failed = 0;
+
+	conf.sample_interval_min = INTERVAL_MIN;
+	conf.sample_interval_max = INTERVAL_MAX;
+	conf.nrooms = 1;
+	compile_led_rules(conf.rooms[0].led_table[LED_METRIC_CO2], 1000, 1900,
+			200);
+	atomic_store(&current_config, &conf);
+
+	if(sampling_interval(1) != INTERVAL_MIN) {
+		fprintf(stderr, "a room never sampled is not sampled right away\n");
+		failed++;
+	}
+
+	failed += check("stable green", settle(450, 0, GREEN),
+			INTERVAL_MAX, INTERVAL_MAX);
+	failed += check("stable yellow", settle(1400, 0, YELLOW),
+			INTERVAL_MAX, INTERVAL_MAX);
+	failed += check("stable red", settle(2500, 0, RED),
+			INTERVAL_MAX, INTERVAL_MAX);
+
+	// within SAMPLING_NEAR of yellow, and of red - hysteresis
+	failed += check("green below yellow", settle(980, 0, GREEN),
+			INTERVAL_MIN, INTERVAL_MIN);
+	failed += check("red above the hysteresis", settle(1720, 0, RED),
+			INTERVAL_MIN, INTERVAL_MIN);
+	failed += check("yellow above the hysteresis", settle(820, 0, YELLOW),
+			INTERVAL_MIN, INTERVAL_MIN);
+
+	// 100 ppm/min far from the threshold, SAMPLING_STEP between samples
+	failed += check("falling red", settle(9000, -100, RED),
+			60 * SAMPLING_STEP / 100 / 2, 60 * SAMPLING_STEP / 100);
+
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,420 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/test-tls.c
+ *
+ * TLS test for make check. Uploads with http_send() to a stand-in for
+ * device_interface.php on the loopback interface, with a self-signed
+ * certificate created at startup as ca_file. The stand-in reports which
+ * handshakes resumed a session, so the test checks that:
+ * - a second handle on the share of tls_init() resumes the session of the
+ *   first one
+ * - the sessions file is written and a new share imports it, as after a
+ *   restart of the daemon
+ * - a corrupt sessions file is ignored and a full handshake is made
+ * The sessions file needs libcurl 8.12.0 built with SSLS-EXPORT, otherwise
+ * only the shared handles and the corrupt file are checked
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <openssl/pem.h>
+
+#include "config.h"
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "upload.h"
+#include "stats.h"
+#include "tls.h"
+#include "log.h"
+
+#define TEST_CERTFILE CHECK_DIR "/tls-check.pem"
+
+#define STANDIN_BUFFER 2048
+
+_Atomic(struct iaq_config *) current_config;
+
+static struct iaq_config conf;
+
+// handshakes and requests served by the stand-in
+static struct {
+	SSL_CTX *ctx;
+	int listen_fd;
+	atomic_int handshakes;
+	atomic_int resumed;
+	atomic_int requests;
+} standin;
+
+// the shared upload code terminates the daemon on fatal errors
+void terminate(int status) {
+	log_flush();
+	exit(status);
+}
+
+// creates a key and a certificate for 127.0.0.1 signed by itself, for the
+// stand-in and as ca_file of the uploads
+static int create_certificate(EVP_PKEY **key, X509 **cert) {
+	X509V3_CTX ext_ctx;
+	X509_EXTENSION *ext;
+	X509_NAME *name;
+	FILE *file;
+	int i;
+	static const struct {
+		int nid;
+		const char *value;
+	} exts[] = {
+		{NID_basic_constraints, "critical,CA:TRUE"},
+		{NID_subject_alt_name, "IP:127.0.0.1"},
+	};
+
+	if((*key = EVP_EC_gen("P-256")) == NULL || (*cert = X509_new()) == NULL)
+		return -1;
+
+	X509_set_version(*cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(*cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(*cert), -60);
+	X509_gmtime_adj(X509_getm_notAfter(*cert), 3600);
+	X509_set_pubkey(*cert, *key);
+
+	name = X509_get_subject_name(*cert);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+			(const unsigned char *)"iaq-measurementd check", -1, -1, 0);
+	X509_set_issuer_name(*cert, name);
+
+	X509V3_set_ctx(&ext_ctx, *cert, *cert, NULL, NULL, 0);
+	for(i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+		ext = X509V3_EXT_conf_nid(NULL, &ext_ctx, exts[i].nid,
+				exts[i].value);
+		if(ext == NULL || X509_add_ext(*cert, ext, -1) != 1)
+			return -1;
+		X509_EXTENSION_free(ext);
+	}
+
+	if(X509_sign(*cert, *key, EVP_sha256()) == 0)
+		return -1;
+
+	if((file = fopen(TEST_CERTFILE, "w")) == NULL)
+		return -1;
+
+	if(PEM_write_X509(file, *cert) != 1) {
+		fclose(file);
+		return -1;
+	}
+
+	return fclose(file) == 0 ? 0 : -1;
+}
+
+// answers the requests of one connection, which ends with the connection
+static void standin_serve(SSL *ssl) {
+	static const char response[] = "HTTP/1.1 200 OK\r\n"
+		"Content-Length: 0\r\n\r\n";
+	char buffer[STANDIN_BUFFER];
+	size_t len = 0;
+	char *end;
+	int n;
+
+	while((n = SSL_read(ssl, buffer + len, sizeof(buffer) - 1 - len)) > 0) {
+		len += n;
+		buffer[len] = '\0';
+
+		// requests without a body, each ends with an empty line
+		while((end = strstr(buffer, "\r\n\r\n")) != NULL) {
+			if(strncmp(buffer, "GET /device_interface.php?action=log&",
+						37) == 0)
+				atomic_fetch_add(&standin.requests, 1);
+
+			if(SSL_write(ssl, response, sizeof(response) - 1) <= 0)
+				return;
+
+			len -= end + 4 - buffer;
+			memmove(buffer, end + 4, len + 1);
+		}
+
+		if(len == sizeof(buffer) - 1)
+			return;
+	}
+}
+
+// serves one connection, in its own thread
+static void *standin_connection(void *arg) {
+	int fd = (intptr_t)arg;
+	SSL *ssl;
+
+	if((ssl = SSL_new(standin.ctx)) == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	SSL_set_fd(ssl, fd);
+
+	if(SSL_accept(ssl) == 1) {
+		atomic_fetch_add(&standin.handshakes, 1);
+		if(SSL_session_reused(ssl))
+			atomic_fetch_add(&standin.resumed, 1);
+
+		standin_serve(ssl);
+		SSL_shutdown(ssl);
+	}
+
+	SSL_free(ssl);
+	close(fd);
+
+	return NULL;
+}
+
+// the connections of the handles are kept open, so they are served at the
+// same time
+static void *standin_server() {
+	pthread_attr_t attr;
+	pthread_t thread;
+	int fd;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	while((fd = accept(standin.listen_fd, NULL, NULL)) >= 0)
+		if(pthread_create(&thread, &attr, standin_connection,
+					(void *)(intptr_t)fd) != 0)
+			close(fd);
+
+	return NULL;
+}
+
+// listens on an ephemeral port of the loopback interface. returns the port
+// or -1
+static int standin_start(EVP_PKEY *key, X509 *cert) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	pthread_t thread;
+
+	if((standin.ctx = SSL_CTX_new(TLS_server_method())) == NULL ||
+			SSL_CTX_use_certificate(standin.ctx, cert) != 1 ||
+			SSL_CTX_use_PrivateKey(standin.ctx, key) != 1)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	standin.listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(standin.listen_fd < 0 ||
+			bind(standin.listen_fd, (struct sockaddr *)&addr, sizeof(addr))
+			== -1 || listen(standin.listen_fd, 4) == -1 ||
+			getsockname(standin.listen_fd, (struct sockaddr *)&addr, &len)
+			== -1 || pthread_create(&thread, NULL, standin_server, NULL) != 0)
+		return -1;
+
+	return ntohs(addr.sin_port);
+}
+
+// tls.c saves the sessions with libcurl 8.12.0 or later, if it was built
+// with the experimental session export
+static int sessions_exported() {
+#if LIBCURL_VERSION_NUM >= 0x080c00
+	const char *const *feature;
+
+	for(feature = curl_version_info(CURLVERSION_NOW)->feature_names;
+			*feature != NULL; feature++)
+		if(strcmp(*feature, "SSLS-EXPORT") == 0)
+			return 1;
+#endif
+
+	return 0;
+}
+
+// a handle as set up by the logging and the gateway thread
+static CURL *upload_handle() {
+	CURL *curl;
+
+	if((curl = curl_easy_init()) == NULL) {
+		fprintf(stderr, "failed to curl_easy_init()\n");
+		exit(EXIT_FAILURE);
+	}
+
+	tls_setup_handle(curl);
+
+	return curl;
+}
+
+// uploads one sample with curl and checks the handshake it took, if any.
+// the stand-in has finished the handshake before it answers the request
+static int upload(CURL *curl, const char *step, int handshake, int resumed) {
+	int handshakes = atomic_load(&standin.handshakes);
+	int resumed_before = atomic_load(&standin.resumed);
+	int requests = atomic_load(&standin.requests);
+	CURLcode res;
+
+	res = http_send(curl, &conf, "tls-check", 650, 22, 45, GREEN, NULL);
+	if(res != CURLE_OK) {
+		fprintf(stderr, "%s: upload failed: %s\n", step,
+				curl_easy_strerror(res));
+		return -1;
+	}
+
+	if(atomic_load(&standin.requests) != requests + 1) {
+		fprintf(stderr, "%s: request did not arrive\n", step);
+		return -1;
+	}
+
+	if(atomic_load(&standin.handshakes) != handshakes + handshake ||
+			atomic_load(&standin.resumed) != resumed_before + resumed) {
+		fprintf(stderr, "%s: expected %s, got %d handshakes, %d resumed\n",
+				step, !handshake ? "no handshake" : resumed ?
+				"a resumed handshake" : "a full handshake",
+				atomic_load(&standin.handshakes) - handshakes,
+				atomic_load(&standin.resumed) - resumed_before);
+		return -1;
+	}
+
+	printf("%s: %s\n", step, !handshake ? "connection reused" : resumed ?
+			"session resumed" : "full handshake");
+
+	return 0;
+}
+
+static int write_file(const char *path, const void *data, size_t len) {
+	FILE *file;
+
+	if((file = fopen(path, "w")) == NULL)
+		return -1;
+
+	if(fwrite(data, 1, len, file) != len) {
+		fclose(file);
+		return -1;
+	}
+
+	return fclose(file) == 0 ? 0 : -1;
+}
+
+int main() {
+	struct tls_sessions header = {TLS_SESSIONS_MAGIC, TLS_SESSIONS_VERSION, 2};
+	EVP_PKEY *key;
+	X509 *cert;
+	CURL *logger, *gateway, *restarted;
+	char host[32];
+	int port;
+
+	if(mkdir(CHECK_DIR, 0755) == -1 && errno != EEXIST) {
+		fprintf(stderr, "failed to create %s: %s\n", CHECK_DIR,
+				strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	// no sessions of an earlier run
+	unlink(TLS_SESSIONS_FILE);
+
+	if(create_certificate(&key, &cert) != 0) {
+		fprintf(stderr, "failed to create a certificate\n");
+		return EXIT_FAILURE;
+	}
+
+	if((port = standin_start(key, cert)) < 0) {
+		fprintf(stderr, "failed to start the stand-in server\n");
+		return EXIT_FAILURE;
+	}
+
+	snprintf(host, sizeof(host), "127.0.0.1:%d", port);
+	conf.host = host;
+	conf.https = 1;
+	conf.ca_file = TEST_CERTFILE;
+	conf.nrooms = 1;
+	conf.rooms[0].room = "tls-check";
+	atomic_store(&current_config, &conf);
+
+	if(curl_global_init(CURL_GLOBAL_ALL)) {
+		fprintf(stderr, "failed to initialize libcurl\n");
+		return EXIT_FAILURE;
+	}
+
+	tls_init();
+
+	// the handles of the logging and the gateway thread share the session
+	logger = upload_handle();
+	gateway = upload_handle();
+
+	if(upload(logger, "first upload", 1, 0) != 0 ||
+			upload(logger, "second upload", 0, 0) != 0 ||
+			upload(gateway, "other handle", 1, 1) != 0)
+		return EXIT_FAILURE;
+
+	if(atomic_load(&tls_handshakes) != 2) {
+		fprintf(stderr, "%u handshakes counted instead of 2\n",
+				atomic_load(&tls_handshakes));
+		return EXIT_FAILURE;
+	}
+
+	curl_easy_cleanup(logger);
+	curl_easy_cleanup(gateway);
+
+	if(sessions_exported()) {
+		if(access(TLS_SESSIONS_FILE, R_OK) != 0) {
+			fprintf(stderr, "sessions file not written: %s\n",
+					strerror(errno));
+			return EXIT_FAILURE;
+		}
+
+		// a new share, as after a restart of the daemon
+		tls_init();
+
+		restarted = upload_handle();
+		if(upload(restarted, "after restart", 1, 1) != 0)
+			return EXIT_FAILURE;
+		curl_easy_cleanup(restarted);
+	}
+
+	else
+		printf("libcurl %s cannot export TLS sessions, sessions file not "
+				"checked\n", curl_version_info(CURLVERSION_NOW)->version);
+
+	// neither the file nor its records can be read
+	if(write_file(TLS_SESSIONS_FILE, "not a sessions file", 19) != 0) {
+		fprintf(stderr, "failed to write %s\n", TLS_SESSIONS_FILE);
+		return EXIT_FAILURE;
+	}
+
+	tls_init();
+
+	restarted = upload_handle();
+	if(upload(restarted, "corrupt file", 1, 0) != 0)
+		return EXIT_FAILURE;
+	curl_easy_cleanup(restarted);
+
+	// a valid header, but the records are missing
+	if(write_file(TLS_SESSIONS_FILE, &header, sizeof(header)) != 0) {
+		fprintf(stderr, "failed to write %s\n", TLS_SESSIONS_FILE);
+		return EXIT_FAILURE;
+	}
+
+	tls_init();
+
+	restarted = upload_handle();
+	if(upload(restarted, "truncated file", 1, 0) != 0)
+		return EXIT_FAILURE;
+	curl_easy_cleanup(restarted);
+
+	unlink(TLS_SESSIONS_FILE);
+	unlink(TEST_CERTFILE);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,282 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/tls.c
+ *
+ * TLS for the uploads to the iaq-server. A full handshake costs more cpu
+ * than a measurement cycle, so the handles of the logging and gateway
+ * threads keep their connections open and share their TLS sessions, which
+ * are also saved for the next start of the daemon
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <curl/curl.h>
+
+#include "config.h"
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "stats.h"
+#include "tls.h"
+#include "log.h"
+
+// TLS sessions and DNS results shared by all upload handles
+static CURLSH *share;
+static pthread_mutex_t share_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void share_lock(CURL *handle, curl_lock_data data,
+		curl_lock_access access, void *userptr) {
+	pthread_mutex_lock(&share_mutex);
+}
+
+static void share_unlock(CURL *handle, curl_lock_data data, void *userptr) {
+	pthread_mutex_unlock(&share_mutex);
+}
+
+// curl_easy_ssls_export() and curl_easy_ssls_import() were added in libcurl
+// 8.12.0. without them sessions are only resumed until the daemon stops
+#if LIBCURL_VERSION_NUM >= 0x080c00
+
+// serializes the writers of TLS_SESSIONS_FILE
+static pthread_mutex_t sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
+// libcurl was built without session export
+static int sessions_disabled;
+
+struct sessions_writer {
+	FILE *file;
+	unsigned int count;
+};
+
+static CURLcode export_session(CURL *handle, void *userptr,
+		const char *session_key, const unsigned char *shmac, size_t shmac_len,
+		const unsigned char *sdata, size_t sdata_len, curl_off_t valid_until,
+		int ietf_tls_id, const char *alpn, size_t earlydata_max) {
+	struct sessions_writer *writer = userptr;
+	struct tls_session_record record;
+
+	// the session key contains the host name, the salted hash is enough to
+	// import the session again
+	if(shmac == NULL || writer->count == TLS_SESSIONS_MAX ||
+			shmac_len > TLS_SESSION_MAX_SIZE ||
+			sdata_len > TLS_SESSION_MAX_SIZE)
+		return CURLE_OK;
+
+	record.valid_until = valid_until;
+	record.shmac_len = shmac_len;
+	record.sdata_len = sdata_len;
+
+	if(fwrite(&record, sizeof(record), 1, writer->file) != 1 ||
+			fwrite(shmac, 1, shmac_len, writer->file) != shmac_len ||
+			fwrite(sdata, 1, sdata_len, writer->file) != sdata_len)
+		return CURLE_WRITE_ERROR;
+
+	writer->count++;
+
+	return CURLE_OK;
+}
+
+// writes the sessions of the share to a temporary file and renames it. the
+// count in the header is filled in last
+static void save_sessions(CURL *curl) {
+	struct tls_sessions header = {TLS_SESSIONS_MAGIC, TLS_SESSIONS_VERSION, 0};
+	struct sessions_writer writer = {NULL, 0};
+	CURLcode res;
+	int fd;
+
+	pthread_mutex_lock(&sessions_mutex);
+
+	if(sessions_disabled) {
+		pthread_mutex_unlock(&sessions_mutex);
+		return;
+	}
+
+	fd = open(TLS_SESSIONS_FILE ".tmp", O_WRONLY | O_CREAT | O_TRUNC |
+			O_CLOEXEC, 0600);
+	if(fd < 0 || (writer.file = fdopen(fd, "w")) == NULL) {
+		log_msg(LOG_WARNING, "failed to open file " TLS_SESSIONS_FILE ".tmp. "
+				"%m");
+		if(fd >= 0)
+			close(fd);
+		pthread_mutex_unlock(&sessions_mutex);
+		return;
+	}
+
+	if(fwrite(&header, sizeof(header), 1, writer.file) != 1)
+		res = CURLE_WRITE_ERROR;
+	else
+		res = curl_easy_ssls_export(curl, export_session, &writer);
+
+	if(res == CURLE_NOT_BUILT_IN) {
+		log_msg(LOG_INFO, "libcurl cannot export TLS sessions. they are not "
+				"kept across restarts");
+		sessions_disabled = 1;
+	}
+
+	else if(res == CURLE_OK) {
+		header.count = writer.count;
+		if(fseek(writer.file, 0, SEEK_SET) != 0 ||
+				fwrite(&header, sizeof(header), 1, writer.file) != 1)
+			res = CURLE_WRITE_ERROR;
+	}
+
+	if(fclose(writer.file) != 0 && res == CURLE_OK)
+		res = CURLE_WRITE_ERROR;
+
+	if(res != CURLE_OK) {
+		if(res != CURLE_NOT_BUILT_IN)
+			log_msg(LOG_WARNING, "failed to save TLS sessions. %s",
+					curl_easy_strerror(res));
+		unlink(TLS_SESSIONS_FILE ".tmp");
+	}
+
+	else if(rename(TLS_SESSIONS_FILE ".tmp", TLS_SESSIONS_FILE) == -1)
+		log_msg(LOG_WARNING, "failed to rename " TLS_SESSIONS_FILE ".tmp. %m");
+
+	pthread_mutex_unlock(&sessions_mutex);
+}
+
+// imports the sessions saved by a previous instance into the share. invalid
+// or expired sessions are skipped
+static void load_sessions() {
+	struct tls_sessions header;
+	struct tls_session_record record;
+	unsigned char *shmac = NULL, *sdata = NULL;
+	unsigned int i, imported = 0;
+	time_t now = time(NULL);
+	FILE *file;
+	CURL *curl;
+
+	file = fopen(TLS_SESSIONS_FILE, "re");
+	if(file == NULL)
+		return;
+
+	if(fread(&header, sizeof(header), 1, file) != 1 ||
+			header.magic != TLS_SESSIONS_MAGIC ||
+			header.version != TLS_SESSIONS_VERSION ||
+			header.count > TLS_SESSIONS_MAX) {
+		log_msg(LOG_WARNING, "TLS sessions: corrupt or written by another "
+				"version. ignoring them");
+		fclose(file);
+		return;
+	}
+
+	if((curl = curl_easy_init()) == NULL ||
+			(shmac = malloc(TLS_SESSION_MAX_SIZE)) == NULL ||
+			(sdata = malloc(TLS_SESSION_MAX_SIZE)) == NULL) {
+		log_msg(LOG_WARNING, "failed to allocate for TLS sessions. ignoring "
+				"them");
+		goto out;
+	}
+
+	curl_easy_setopt(curl, CURLOPT_SHARE, share);
+
+	for(i = 0; i < header.count; i++) {
+		if(fread(&record, sizeof(record), 1, file) != 1 ||
+				record.shmac_len > TLS_SESSION_MAX_SIZE ||
+				record.sdata_len > TLS_SESSION_MAX_SIZE ||
+				fread(shmac, 1, record.shmac_len, file) != record.shmac_len ||
+				fread(sdata, 1, record.sdata_len, file) != record.sdata_len) {
+			log_msg(LOG_WARNING, "TLS sessions: corrupt. ignoring the rest");
+			break;
+		}
+
+		if(record.valid_until < now)
+			continue;
+
+		if(curl_easy_ssls_import(curl, NULL, shmac, record.shmac_len, sdata,
+					record.sdata_len) == CURLE_OK)
+			imported++;
+	}
+
+	if(imported > 0)
+		log_msg(LOG_INFO, "TLS sessions: restored %u sessions", imported);
+
+out:
+	free(shmac);
+	free(sdata);
+	if(curl != NULL)
+		curl_easy_cleanup(curl);
+	fclose(file);
+}
+
+#endif
+
+// sets up the share. called by the logging thread after curl_global_init(),
+// before the gateway thread is started
+void tls_init() {
+	if((share = curl_share_init()) == NULL) {
+		log_msg(LOG_ERR, "failed to curl_share_init(). terminating");
+		terminate(EXIT_FAILURE);
+	}
+
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+
+#if LIBCURL_VERSION_NUM >= 0x080c00
+	load_sessions();
+#endif
+}
+
+// options kept for the lifetime of an upload handle. connections are not
+// shared, libcurl doesn't support that between threads. without tls_init()
+// each handle has its own session cache
+void tls_setup_handle(CURL *curl) {
+	curl_easy_setopt(curl, CURLOPT_SHARE, share);
+	// keeps idle connections open through NAT between logging intervals
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+}
+
+// options that can be changed by a reload, set before every upload. NULL
+// restores the defaults of libcurl
+void tls_setopt(CURL *curl, struct iaq_config *conf) {
+	curl_easy_setopt(curl, CURLOPT_CAINFO, conf->ca_file);
+	curl_easy_setopt(curl, CURLOPT_PINNEDPUBLICKEY, conf->pinned_public_key);
+}
+
+// counts new connections and TLS handshakes of the last upload of curl.
+// sessions are saved after every handshake, resumed ones included, since
+// the server may have issued a new ticket
+void tls_account(CURL *curl) {
+	curl_off_t connect_us, appconnect_us;
+	long connects;
+
+	if(curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects) != CURLE_OK
+			|| connects == 0)
+		return;
+
+	atomic_fetch_add(&http_connections, 1);
+
+	// times since the start of the transfer, appconnect is 0 without TLS
+	if(curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect_us)
+			!= CURLE_OK ||
+			curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T,
+				&appconnect_us) != CURLE_OK ||
+			appconnect_us == 0)
+		return;
+
+	atomic_fetch_add(&tls_handshakes, 1);
+	histogram_record(&tls_handshake_hist, appconnect_us - connect_us);
+
+#if LIBCURL_VERSION_NUM >= 0x080c00
+	// only the daemon keeps its sessions across restarts
+	if(share != NULL)
+		save_sessions(curl);
+#endif
+}
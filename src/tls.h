@@ -0,0 +1,54 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/tls.h
+ *
+ * Header file for the TLS setup of the uploads
+ */
+
+#ifndef _IAQ_MEASUREMENTD_TLS_H_
+#define _IAQ_MEASUREMENTD_TLS_H_
+
+#include <curl/curl.h>
+
+#include "config-parser.h"
+
+// TLS sessions saved for the next start. the file holds session secrets
+#define TLS_SESSIONS_FILE PKGSTATEDIR "/tls-sessions.bin"
+
+#define TLS_SESSIONS_MAGIC 0x54514149 // "IAQT"
+#define TLS_SESSIONS_VERSION 1
+// limits of a sessions file
+#define TLS_SESSIONS_MAX 16
+#define TLS_SESSION_MAX_SIZE 16384 // in bytes
+
+// record of the sessions file, followed by shmac_len bytes of the salted
+// hash of the peer and sdata_len bytes of session data
+struct tls_session_record {
+	int64_t valid_until; // CLOCK_REALTIME in s
+	uint32_t shmac_len;
+	uint32_t sdata_len;
+};
+
+// header of the sessions file, followed by count records
+struct tls_sessions {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t count;
+};
+
+void tls_init();
+void tls_setup_handle(CURL *curl);
+void tls_setopt(CURL *curl, struct iaq_config *conf);
+void tls_account(CURL *curl);
+
+#endif
@@ -0,0 +1,155 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/trace.c
+ *
+ * Flight recorder: every thread writes timestamped binary events into its
+ * own ring buffer, which is dumped on request or when the daemon crashes
+ */
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "trace.h"
+#include "log.h"
+
+static struct trace_ring trace_rings[TRACE_MAX_THREADS];
+static atomic_int trace_nrings;
+
+static __thread struct trace_ring *trace_ring;
+
+void trace_register_thread(const char *name) {
+	int slot;
+
+	slot = atomic_fetch_add(&trace_nrings, 1);
+
+	if(slot >= TRACE_MAX_THREADS) {
+		log_msg(LOG_WARNING, "trace: no ring left for thread %s", name);
+		return;
+	}
+
+	strncpy(trace_rings[slot].name, name, TRACE_NAME_LEN - 1);
+	trace_ring = &trace_rings[slot];
+
+	// shown in /proc/self/task/<tid>/comm, which names the threads in the
+	// resource accounting
+	pthread_setname_np(pthread_self(), name);
+}
+
+void trace(uint16_t type, uint16_t arg0, int32_t arg1) {
+	struct trace_ring *ring = trace_ring;
+	struct trace_event *event;
+	struct timespec now;
+	unsigned int head;
+
+	if(ring == NULL)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+
+	event->timestamp = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	event->type = type;
+	event->arg0 = arg0;
+	event->arg1 = arg1;
+
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static int write_all(int fd, const void *buffer, size_t len) {
+	const char *p = buffer;
+	ssize_t status;
+
+	while(len > 0) {
+		status = write(fd, p, len);
+		if(status <= 0)
+			return -1;
+		p += status;
+		len -= status;
+	}
+
+	return 0;
+}
+
+// writes all rings to TRACEFILE. only uses async-signal-safe functions, so
+// it can be called from the crash handler. sig is 0 for requested dumps
+void trace_dump(int sig) {
+	struct trace_header header;
+	struct timespec realtime, monotonic;
+	int fd, nrings, failed;
+
+	nrings = atomic_load(&trace_nrings);
+	if(nrings > TRACE_MAX_THREADS)
+		nrings = TRACE_MAX_THREADS;
+
+	clock_gettime(CLOCK_REALTIME, &realtime);
+	clock_gettime(CLOCK_MONOTONIC, &monotonic);
+
+	memset(&header, 0, sizeof(header));
+	header.magic = TRACE_MAGIC;
+	header.version = TRACE_VERSION;
+	header.nrings = nrings;
+	header.ring_size = TRACE_RING_SIZE;
+	header.event_size = sizeof(struct trace_event);
+	header.realtime_offset = (realtime.tv_sec - monotonic.tv_sec) *
+		1000000000LL + (realtime.tv_nsec - monotonic.tv_nsec);
+	header.signal = sig;
+
+	fd = open(TRACEFILE ".tmp", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		0644);
+	if(fd < 0)
+		return;
+
+	failed = write_all(fd, &header, sizeof(header)) ||
+		write_all(fd, trace_rings, nrings * sizeof(struct trace_ring));
+
+	close(fd);
+
+	if(failed)
+		unlink(TRACEFILE ".tmp");
+	else
+		rename(TRACEFILE ".tmp", TRACEFILE);
+}
+
+static void crash_handler(int sig) {
+	trace_dump(sig);
+
+	// SA_RESETHAND restored the default action, so this terminates with a
+	// core dump as usual
+	raise(sig);
+}
+
+void trace_install_crash_handlers() {
+	struct sigaction crash_sa;
+	int signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+	int i;
+
+	memset(&crash_sa, 0, sizeof(crash_sa));
+	crash_sa.sa_handler = &crash_handler;
+	crash_sa.sa_flags = SA_RESETHAND;
+	sigfillset(&crash_sa.sa_mask);
+
+	for(i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+		if(sigaction(signals[i], &crash_sa, NULL) == -1)
+			log_msg(LOG_WARNING, "trace: failed to register crash handler: "
+					"%m");
+}
@@ -0,0 +1,88 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/trace.h
+ *
+ * Header file for the flight recorder, shared with iaq-tracedump
+ */
+
+#ifndef _IAQ_MEASUREMENTD_TRACE_H_
+#define _IAQ_MEASUREMENTD_TRACE_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// written on SIGUSR1 and on crashes, decoded by iaq-tracedump
+#define TRACEFILE PKGSTATEDIR "/trace.bin"
+
+#define TRACE_MAGIC 0x54514149 // "IAQT"
+#define TRACE_VERSION 1
+
+// events per thread, must be a power of two
+#define TRACE_RING_SIZE 1024
+#define TRACE_MAX_THREADS 8
+#define TRACE_NAME_LEN 16
+
+enum trace_type {
+	TRACE_I2C_ADDRESS = 1,	// arg0: slave address, arg1: ioctl result
+	TRACE_I2C_WRITE,		// arg0: slave address, arg1: write() result
+	TRACE_I2C_READ,			// arg0: slave address, arg1: read() result
+	TRACE_I2C_RETRY,		// arg0: slave address, arg1: retries so far
+	TRACE_CHECKSUM_ERROR,	// arg0: slave address, arg1: received checksum
+	TRACE_RETRY_DELAY,		// arg0: slave address, arg1: delay in ms
+	TRACE_SENSOR_RESULT,	// arg0: slave address, arg1: driver status
+	TRACE_LED_STATE,		// arg0: room << 8 | old state, arg1: new state
+	TRACE_UPLOAD_START,		// arg0: room, arg1: co2
+	TRACE_UPLOAD_END,		// arg0: room, arg1: CURLcode, -errno if relayed
+	TRACE_CONFIG_RELOAD,	// arg1: 0 on success, -1 on error
+	TRACE_MUX_SELECT,		// arg0: channel, arg1: 0 on success, -1 on error
+	TRACE_GATEWAY_FORWARD,	// arg0: readings forwarded, arg1: readings left
+	TRACE_SI7021_CONFIG,	// arg0: user register, arg1: 0 or -1 on error
+	TRACE_ALERT_START,		// arg0: room << 8 | old state, arg1: new state
+	TRACE_ALERT_END,		// arg0: room, arg1: CURLcode, -1 for a failed relay
+	TRACE_SENSOR_HEALTH,	// arg0: room << 8 | SENSOR_*, arg1: HEALTH_*
+	TRACE_TYPE_MAX
+};
+
+struct trace_event {
+	uint64_t timestamp; // CLOCK_MONOTONIC in ns
+	uint16_t type;
+	uint16_t arg0;
+	int32_t arg1;
+};
+
+// written by its thread only, so no locking is needed
+struct trace_ring {
+	char name[TRACE_NAME_LEN];
+	atomic_uint head; // number of events ever written
+	struct trace_event events[TRACE_RING_SIZE];
+};
+
+// dump file: header followed by nrings struct trace_ring
+struct trace_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t nrings;
+	uint32_t ring_size;
+	uint32_t event_size;
+	// CLOCK_REALTIME - CLOCK_MONOTONIC at dump time in ns
+	int64_t realtime_offset;
+	int32_t signal; // 0 if requested, else the fatal signal
+	uint32_t reserved;
+};
+
+void trace_register_thread(const char *name);
+void trace(uint16_t type, uint16_t arg0, int32_t arg1);
+void trace_dump(int sig);
+void trace_install_crash_handlers();
+
+#endif
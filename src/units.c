@@ -0,0 +1,63 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/units.c
+ *
+ * Batch conversion of sensor words to physical units, with the calibration
+ * of the room. Samples are kept as the words read from the sensors and only
+ * converted when they are read, so a changed calibration applies to the
+ * stored samples as well
+ */
+
+// the kernels are simple enough to be vectorised, which gcc only does from
+// -O3 on
+#pragma GCC optimize("tree-vectorize", "vect-cost-model=dynamic")
+
+#include <stdint.h>
+
+#include "config-parser.h"
+#include "units.h"
+
+// the offsets are copied, so the compiler doesn't have to assume they are
+// changed by the stores
+void convert_co2(const uint16_t *words, int32_t *ppm, unsigned int n,
+		const struct room_config *room) {
+	int32_t offset = room->co2_offset;
+	int32_t value;
+	unsigned int i;
+
+	for(i = 0; i < n; i++) {
+		value = words[i] + offset;
+		ppm[i] = value < 0 ? 0 : value;
+	}
+}
+
+void convert_temp(const uint16_t *words, float *celsius, unsigned int n,
+		const struct room_config *room) {
+	float offset = room->temp_offset;
+	unsigned int i;
+
+	for(i = 0; i < n; i++)
+		celsius[i] = si7021_temp(words[i]) + offset;
+}
+
+void convert_rh(const uint16_t *words, float *percent, unsigned int n,
+		const struct room_config *room) {
+	float offset = room->rh_offset;
+	float value;
+	unsigned int i;
+
+	for(i = 0; i < n; i++) {
+		value = si7021_rh(words[i]) + offset;
+		percent[i] = value < 0 ? 0 : value > 100 ? 100 : value;
+	}
+}
@@ -0,0 +1,62 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/units.h
+ *
+ * Header file for the conversion of sensor words to physical units
+ */
+
+#ifndef _IAQ_MEASUREMENTD_UNITS_H_
+#define _IAQ_MEASUREMENTD_UNITS_H_
+
+#include <stdint.h>
+
+#include "config-parser.h"
+
+// conversions of the si7021 words according to the datasheet, without
+// calibration. rh may be slightly negative or bigger than 100 %
+static inline float si7021_temp(uint16_t word) {
+	return word * (175.72f / 65536) - 46.85f;
+}
+
+static inline float si7021_rh(uint16_t word) {
+	return word * (125.0f / 65536) - 6;
+}
+
+// the k-30 word is the co2 concentration in ppm. a negative offset must not
+// lead to a negative concentration
+static inline int32_t co2_ppm(uint16_t word, const struct room_config *room) {
+	int32_t ppm = word + room->co2_offset;
+
+	return ppm < 0 ? 0 : ppm;
+}
+
+static inline float temp_celsius(uint16_t word,
+		const struct room_config *room) {
+	return si7021_temp(word) + room->temp_offset;
+}
+
+// rh out of 0..100 % is no error and is rounded
+static inline float rh_percent(uint16_t word, const struct room_config *room) {
+	float rh = si7021_rh(word) + room->rh_offset;
+
+	return rh < 0 ? 0 : rh > 100 ? 100 : rh;
+}
+
+void convert_co2(const uint16_t *words, int32_t *ppm, unsigned int n,
+		const struct room_config *room);
+void convert_temp(const uint16_t *words, float *celsius, unsigned int n,
+		const struct room_config *room);
+void convert_rh(const uint16_t *words, float *percent, unsigned int n,
+		const struct room_config *room);
+
+#endif
@@ -0,0 +1,117 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/upload.c
+ *
+ * Upload of measurements to the iaq-server, shared by the logging and
+ * gateway threads and by iaq-loadgen
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <curl/curl.h>
+
+#include "iaq-measurementd.h"
+#include "config-parser.h"
+#include "upload.h"
+#include "realtime.h"
+#include "stats.h"
+#include "tls.h"
+#include "log.h"
+
+// the response body is of no interest. without a write function libcurl
+// writes it to stdout, which the daemon has closed
+static size_t discard(char *data, size_t size, size_t nmemb, void *userdata) {
+	return size * nmemb;
+}
+
+// sends one measurement to the iaq-server at conf->host. extra are further
+// query parameters appended to the url, NULL for none. curl is reused
+// between calls, so its connection to the server is kept open. returns the
+// result of curl_easy_perform(), an HTTP error response of the server is
+// CURLE_HTTP_RETURNED_ERROR, so the measurement is not counted as delivered
+CURLcode http_send(CURL *curl, struct iaq_config *conf, const char *room,
+		int co2, float temp, float rh, int led_state, const char *extra) {
+	CURLcode res;
+	char *url, *room_escaped;
+	size_t url_len;
+	int status;
+	long response;
+	struct timespec start, end;
+
+	room_escaped = curl_easy_escape(curl, room, 0);
+
+	if(room_escaped == NULL) {
+		log_msg(LOG_ERR, "failed to curl_easy_escape(). terminating");
+		terminate(EXIT_FAILURE);
+	}
+
+	if(extra == NULL)
+		extra = "";
+
+	// length of host + length of room_escaped + length of extra + 300 extra
+	// bytes (data are 80 + length of https:// and device_interface.php +
+	// buffer)
+	url_len = strlen(conf->host) + strlen(room_escaped) + strlen(extra) + 300;
+	url = malloc(url_len);
+
+	if(url == NULL) {
+		log_msg(LOG_ERR, "failed to allocate the logging-server url. "
+				"terminating");
+		terminate(EXIT_FAILURE);
+	}
+
+	status = snprintf(url, url_len, "%s://%s/device_interface.php?action=log"
+			"&room=%s&co2=%d&temp=%.2f&rh=%.2f&led_state=%d%s",
+			conf->https ? "https" : "http", conf->host, room_escaped, co2,
+			temp, rh, led_state, extra);
+
+	if(status < 0) {
+		log_msg(LOG_ERR, "failed to snprintf the logging-server url. terminating"
+			);
+		terminate(EXIT_FAILURE);
+	}
+
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard);
+	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+	// the timeouts must not use signals in a multithreaded program
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)HTTP_TIMEOUT);
+	if(conf->https)
+		tls_setopt(curl, conf);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	res = curl_easy_perform(curl);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	histogram_record(&http_upload_hist, elapsed_us(&start, &end));
+	tls_account(curl);
+
+	if(res == CURLE_HTTP_RETURNED_ERROR &&
+			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response)
+			== CURLE_OK)
+		log_msg(LOG_WARNING, "logging-server rejected the measurement data "
+				"with HTTP status %ld.", response);
+
+	else if(res != CURLE_OK)
+		log_msg(LOG_WARNING, "could not send measurement data to the logging"
+				"-server. %s.", curl_easy_strerror(res));
+
+	free(url);
+	curl_free(room_escaped);
+
+	return res;
+}
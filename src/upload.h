@@ -0,0 +1,32 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/upload.h
+ *
+ * Header file for the upload of measurements to the iaq-server
+ */
+
+#ifndef _IAQ_MEASUREMENTD_UPLOAD_H_
+#define _IAQ_MEASUREMENTD_UPLOAD_H_
+
+#include <curl/curl.h>
+
+#include "config-parser.h"
+
+// time budget of one upload, including the connection. a server accepting
+// the connection and never responding doesn't block the uploading thread
+#define HTTP_TIMEOUT 20 // in s
+
+CURLcode http_send(CURL *curl, struct iaq_config *conf, const char *room,
+		int co2, float temp, float rh, int led_state, const char *extra);
+
+#endif
@@ -0,0 +1,151 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/wire.c
+ *
+ * Encoding of samples into fixed size UDP datagrams, used between relaying
+ * devices and a gateway
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "iaq-measurementd.h"
+#include "wire.h"
+#include "log.h"
+
+// rounded to the nearest hundredth
+static int32_t wire_hundredths(float value) {
+	return value * 100 + (value < 0 ? -0.5f : 0.5f);
+}
+
+static uint8_t wire_age(unsigned int age, int stale, int missing) {
+	if(missing)
+		return WIRE_MISSING;
+
+	return (age < WIRE_AGE_MAX ? age : WIRE_AGE_MAX) | (stale ? WIRE_STALE : 0);
+}
+
+// inverse of wire_age(), the quality flags are or'ed to quality
+static uint16_t wire_quality(uint8_t age, uint8_t *quality, uint8_t stale,
+		uint8_t missing) {
+	if(age == WIRE_MISSING) {
+		*quality |= missing;
+		return 0;
+	}
+
+	if(age & WIRE_STALE)
+		*quality |= stale;
+
+	return age & ~WIRE_STALE;
+}
+
+void wire_encode(struct wire_sample *datagram, const char *room, uint32_t seq,
+		const struct sample *sample) {
+	memset(datagram, 0, sizeof(*datagram));
+
+	datagram->magic = htonl(WIRE_MAGIC);
+	datagram->version = WIRE_VERSION;
+	datagram->led_state = sample->led_state;
+	datagram->co2_age = wire_age(sample->co2_age,
+			sample->quality & SAMPLE_CO2_STALE,
+			sample->quality & SAMPLE_CO2_MISSING);
+	datagram->temp_rh_age = wire_age(sample->temp_rh_age,
+			sample->quality & SAMPLE_TEMP_RH_STALE,
+			sample->quality & SAMPLE_TEMP_RH_MISSING);
+	datagram->seq = htonl(seq);
+	datagram->timestamp = htonl(sample->timestamp);
+	datagram->co2 = htonl(sample->co2);
+	datagram->temp = htonl(wire_hundredths(sample->temp));
+	datagram->rh = htonl(wire_hundredths(sample->rh));
+
+	// longer names are rejected by the config parser
+	strncpy(datagram->room, room, WIRE_ROOM_LEN - 1);
+}
+
+// checks a received datagram of len bytes and decodes it. room must hold
+// WIRE_ROOM_LEN bytes, alert is set if the sample is a state change. returns
+// 0 on success, -1 if the datagram is invalid
+int wire_decode(const struct wire_sample *datagram, size_t len, char *room,
+		uint32_t *seq, struct sample *sample, int *alert) {
+	if(len != sizeof(*datagram) || ntohl(datagram->magic) != WIRE_MAGIC ||
+			datagram->version != WIRE_VERSION ||
+			(datagram->led_state & ~WIRE_ALERT) > RED ||
+			memchr(datagram->room, '\0', WIRE_ROOM_LEN) == NULL ||
+			datagram->room[0] == '\0')
+		return -1;
+
+	memcpy(room, datagram->room, WIRE_ROOM_LEN);
+	*seq = ntohl(datagram->seq);
+
+	sample->timestamp = ntohl(datagram->timestamp);
+	sample->co2 = (int32_t)ntohl(datagram->co2);
+	sample->temp = (int32_t)ntohl(datagram->temp) / 100.0f;
+	sample->rh = (int32_t)ntohl(datagram->rh) / 100.0f;
+	sample->led_state = datagram->led_state & ~WIRE_ALERT;
+	*alert = (datagram->led_state & WIRE_ALERT) != 0;
+	sample->quality = 0;
+	sample->co2_age = wire_quality(datagram->co2_age, &sample->quality,
+			SAMPLE_CO2_STALE, SAMPLE_CO2_MISSING);
+	sample->temp_rh_age = wire_quality(datagram->temp_rh_age,
+			&sample->quality, SAMPLE_TEMP_RH_STALE, SAMPLE_TEMP_RH_MISSING);
+
+	return 0;
+}
+
+// returns a UDP socket connected to port of host, or -1 on error. connecting
+// resolves the address once and lets the kernel skip the route lookup on
+// every send
+int udp_connect(const char *host, int port) {
+	struct addrinfo hints, *res, *ai;
+	char service[8];
+	int fd = -1;
+	int status;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	snprintf(service, sizeof(service), "%d", port);
+
+	if((status = getaddrinfo(host, service, &hints, &res)) != 0) {
+		log_msg(LOG_WARNING, "failed to resolve %s: %s", host,
+				gai_strerror(status));
+		return -1;
+	}
+
+	for(ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+				ai->ai_protocol);
+		if(fd < 0)
+			continue;
+
+		if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+
+	if(fd < 0)
+		log_msg(LOG_WARNING, "failed to connect to %s port %d: %m", host,
+				port);
+
+	return fd;
+}
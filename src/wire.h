@@ -0,0 +1,69 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright (C) 2016, Simon Adam, Markus Dullnig, Paul Soelder
+ *   All rights reserved.
+ *
+ *   This file is part of the indoor air quality measurement daemon,
+ *   and is made available under the terms of the BSD 3-Clause Licence.
+ *   A full copy of the licence can be found in the COPYING file.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * src/wire.h
+ *
+ * Header file for the UDP datagram format of relayed samples
+ */
+
+#ifndef _IAQ_MEASUREMENTD_WIRE_H_
+#define _IAQ_MEASUREMENTD_WIRE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "history.h"
+
+#define WIRE_MAGIC 0x44514149 // "IAQD"
+#define WIRE_VERSION 1
+
+// including the terminating '\0'
+#define WIRE_ROOM_LEN 32
+
+// ages of the metrics in s. older metrics are sent with WIRE_AGE_MAX, stale
+// ones with WIRE_STALE set and missing ones as WIRE_MISSING. 0 is a metric
+// measured for this sample
+#define WIRE_AGE_MAX 126
+#define WIRE_STALE 0x80
+#define WIRE_MISSING 0xFF
+
+// or'ed to the LED state of a sample sent right after the LED state of its
+// room changed. the gateway forwards it ahead of the buffered readings
+#define WIRE_ALERT 0x80
+
+// one sample per datagram. integers are sent in network byte order,
+// temperature and humidity in hundredths
+struct wire_sample {
+	uint32_t magic;
+	uint8_t version;
+	uint8_t led_state; // WIRE_ALERT for a state change
+	// time since the metrics were measured and their quality, see above
+	uint8_t co2_age;
+	uint8_t temp_rh_age;
+	uint32_t seq; // per sender and room, for detecting losses
+	uint32_t timestamp; // CLOCK_REALTIME in s
+	int32_t co2; // in ppm
+	int32_t temp; // in 0.01 degree celsius
+	int32_t rh; // in 0.01 percent
+	char room[WIRE_ROOM_LEN]; // padded with '\0'
+};
+
+_Static_assert(sizeof(struct wire_sample) == 60,
+		"struct wire_sample must not contain padding");
+
+void wire_encode(struct wire_sample *datagram, const char *room, uint32_t seq,
+		const struct sample *sample);
+int wire_decode(const struct wire_sample *datagram, size_t len, char *room,
+		uint32_t *seq, struct sample *sample, int *alert);
+int udp_connect(const char *host, int port);
+
+#endif